@@ -58,7 +58,8 @@
 #define ALIGNMENT 8  
 
 /* 
- * Maximum heap size in bytes 
+ * Default maximum heap size in bytes. This is only the size of the
+ * virtual range memlib.c reserves; override it at runtime with -m.
  */
 #define MAX_HEAP (20*(1<<20))  /* 20 MB */
 
@@ -67,6 +68,7 @@
  *****************************************************************************/
 #define USE_FCYC   0   /* cycle counter w/K-best scheme (x86 & Alpha only) */
 #define USE_ITIMER 0   /* interval timer (any Unix box) */
-#define USE_GETTOD 1   /* gettimeofday (any Unix box) */
+#define USE_GETTOD 0   /* gettimeofday (any Unix box) */
+#define USE_TSC    1   /* invariant TSC, cntvct_el0 or CLOCK_MONOTONIC_RAW */
 
 #endif /* __CONFIG_H */
@@ -0,0 +1,149 @@
+/*
+ * fastbench.c - cycles per malloc/free pair, out of line and inline
+ *
+ * Allocates a batch of blocks of one constant size and frees them again,
+ * many times over, through mm_malloc and mm_free, through the inline
+ * mm_malloc_small and mm_free_small in mm.h, and through glibc malloc,
+ * and prints the mean cost of a malloc/free pair for each. Build it as
+ * fastbench and, with link-time optimization, as fastbench-lto, so the
+ * out-of-line calls can be compared with and without cross-module
+ * inlining.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "memlib.h"
+#include "mm.h"
+
+/* Defaults for -n */
+#define DEFAULT_ROUNDS 200000
+
+#define BATCH 32 /* blocks live at once */
+
+enum { MM_CALL, MM_INLINE, GLIBC, NVARIANTS };
+
+static const char *variant_names[NVARIANTS] = {
+    "mm_malloc", "inline", "glibc"
+};
+
+static void *volatile sink; /* keeps the loops from being elided */
+
+/*
+ * now - a cycle count where the CPU has one, else nanoseconds
+ */
+static inline unsigned long long now(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/*
+ * ROUNDS - time rounds batches of BATCH allocations of size bytes through
+ *     alloc and release, freeing in reverse order, and yield the mean
+ *     cost of a pair. size must be a constant for the inline path to fold.
+ */
+#define ROUNDS(rounds, size, alloc, release) ({			\
+	void *blocks[BATCH];						\
+	unsigned long long start = now();				\
+	int r, i;							\
+									\
+	for (r = 0; r < (rounds); r++) {				\
+	    for (i = 0; i < BATCH; i++)					\
+		blocks[i] = alloc(size);				\
+	    sink = blocks[BATCH - 1];					\
+	    for (i = BATCH - 1; i >= 0; i--)				\
+		release(blocks[i], size);				\
+	}								\
+	(double)(now() - start) / ((double)(rounds) * BATCH);		\
+    })
+
+#define MM_FREE(p, size)    mm_free(p)
+#define GLIBC_FREE(p, size) free(p)
+
+/*
+ * bench - one table row: the cost of a pair under every variant
+ */
+#define BENCH(rounds, size) do {					\
+	double cost[NVARIANTS];						\
+	int v;								\
+									\
+	mem_reset_brk();						\
+	if (mm_init() < 0) {						\
+	    fprintf(stderr, "mm_init failed\n");			\
+	    exit(1);							\
+	}								\
+	cost[MM_CALL] = ROUNDS(rounds, size, mm_malloc, MM_FREE);	\
+	cost[MM_INLINE] = ROUNDS(rounds, size, mm_malloc_small,		\
+				 mm_free_small);			\
+	mm_fast_flush();						\
+	cost[GLIBC] = ROUNDS(rounds, size, malloc, GLIBC_FREE);		\
+	printf("%6d", size);						\
+	for (v = 0; v < NVARIANTS; v++)					\
+	    printf("%12.1f", cost[v]);					\
+	printf("\n");							\
+    } while (0)
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: fastbench [-h] [-n <rounds>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h          Print this message.\n");
+    fprintf(stderr, "\t-n <rounds> Batches of %d per size (default %d).\n",
+	    BATCH, DEFAULT_ROUNDS);
+}
+
+int main(int argc, char **argv)
+{
+    int rounds = DEFAULT_ROUNDS;
+    int c, v;
+
+    while ((c = getopt(argc, argv, "hn:")) != EOF) {
+	switch (c) {
+	case 'n':
+	    rounds = atoi(optarg);
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (rounds <= 0) {
+	usage();
+	exit(1);
+    }
+
+    mem_init();
+
+#if defined(__i386__) || defined(__x86_64__)
+    printf("cycles per malloc/free pair\n");
+#else
+    printf("ns per malloc/free pair\n");
+#endif
+    printf("%6s", "size");
+    for (v = 0; v < NVARIANTS; v++)
+	printf("%12s", variant_names[v]);
+    printf("\n");
+
+    BENCH(rounds, 8);
+    BENCH(rounds, 16);
+    BENCH(rounds, 32);
+    BENCH(rounds, 64);
+    BENCH(rounds, 120);
+
+    mem_deinit();
+    return 0;
+}
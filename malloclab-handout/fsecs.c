@@ -2,6 +2,8 @@
  * High-level timing wrappers
  ****************************/
 #include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
 #include "fsecs.h"
 #include "fcyc.h"
 #include "clock.h"
@@ -10,6 +12,19 @@
 
 static double Mhz;  /* estimated CPU clock frequency */
 
+/* fsecs_adaptive: warm up for ADAPT_WARMUP_NS, then take samples of
+   at least ADAPT_SAMPLE_NS each, between ADAPT_MIN_SAMPLES and
+   ADAPT_MAX_SAMPLES of them. A sample more than ADAPT_OUTLIER scaled
+   median absolute deviations from the median is an outlier. */
+#define ADAPT_WARMUP_NS   20000000.0
+#define ADAPT_SAMPLE_NS   100000.0
+#define ADAPT_MIN_SAMPLES 10
+#define ADAPT_MAX_SAMPLES 10000
+#define ADAPT_OUTLIER     3.0
+
+static double adapt_width = 0.01; /* target interval width / median */
+static double adapt_budget = 2.0; /* seconds of sampling per call */
+
 extern int verbose; /* -v option in mdriver.c */
 
 /*
@@ -36,9 +51,148 @@ void init_fsecs(void)
 #elif USE_GETTOD
     if (verbose)
 	printf("Measuring performance with gettimeofday().\n");
+#elif USE_TSC
+    Mhz = ftimer_counter_init() / 1e6;
+    if (verbose)
+	printf("Measuring performance with the %s (%.1f MHz).\n",
+	       ftimer_counter_name(), Mhz);
 #endif
 }
 
+/*
+ * set_fsecs_adaptive - set the target interval width, relative to the
+ *     median, and the time budget of fsecs_adaptive
+ */
+void set_fsecs_adaptive(double width, double budget)
+{
+    adapt_width = width;
+    adapt_budget = budget;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * sorted_median - the median of the n values in sorted array x
+ */
+static double sorted_median(double *x, int n)
+{
+    return (n % 2) ? x[n / 2] : (x[n / 2 - 1] + x[n / 2]) / 2;
+}
+
+/*
+ * summarize - sort the n samples in x, drop the outliers and describe
+ *     the rest in st
+ */
+static void summarize(double *x, int n, fsecs_stats_t *st)
+{
+    double *dev, med, mad, half, sum = 0, sumsq = 0, mean;
+    int i, first, last, kept, lo, hi;
+
+    qsort(x, n, sizeof(double), compare_doubles);
+    med = sorted_median(x, n);
+
+    /* 1.4826 MAD estimates the standard deviation of normal noise,
+       without being dragged along by the outliers themselves */
+    if ((dev = malloc(n * sizeof(double))) == NULL) {
+	fprintf(stderr, "fsecs: out of memory\n");
+	exit(1);
+    }
+    for (i = 0; i < n; i++)
+	dev[i] = fabs(x[i] - med);
+    qsort(dev, n, sizeof(double), compare_doubles);
+    mad = 1.4826 * sorted_median(dev, n);
+    free(dev);
+
+    for (first = 0; x[first] < med - ADAPT_OUTLIER * mad; first++)
+	;
+    for (last = n; x[last - 1] > med + ADAPT_OUTLIER * mad; last--)
+	;
+    kept = last - first;
+    x += first;
+
+    /* The median's interval lies between two order statistics: the
+       number of samples below the true median is Binomial(kept, 1/2) */
+    half = 0.98 * sqrt(kept); /* 1.96 standard deviations of it */
+    lo = (int)floor(kept / 2.0 - half) - 1;
+    hi = (int)ceil(kept / 2.0 + half);
+    if (lo < 0)
+	lo = 0;
+    if (hi > kept - 1)
+	hi = kept - 1;
+
+    for (i = 0; i < kept; i++) {
+	sum += x[i];
+	sumsq += x[i] * x[i];
+    }
+    mean = sum / kept;
+    st->median = sorted_median(x, kept);
+    st->ci_lo = x[lo];
+    st->ci_hi = x[hi];
+    st->cv = (kept > 1 && mean > 0) ?
+	sqrt(fmax(sumsq / kept - mean * mean, 0) * kept / (kept - 1)) / mean : 0;
+    st->samples = kept;
+    st->rejected = n - kept;
+}
+
+/*
+ * fsecs_adaptive - Return the median running time of f (in seconds),
+ *     sampling until its confidence interval is narrow enough, and
+ *     describe the samples in st
+ */
+double fsecs_adaptive(fsecs_test_funct f, void *argp, fsecs_stats_t *st)
+{
+    double hz = ftimer_counter_init();
+    unsigned long long start, now, deadline;
+    double *x, run_ticks;
+    int n = 0, runs = 0, check = ADAPT_MIN_SAMPLES, i;
+
+    /* Warm up caches and branch predictors, and learn how many runs
+       make a sample long enough to time well */
+    start = ftimer_count_start();
+    do {
+	f(argp);
+	runs++;
+	now = ftimer_count_stop();
+    } while (now - start < ADAPT_WARMUP_NS * hz / 1e9);
+    run_ticks = (double)(now - start) / runs;
+    st->reps = (int)ceil(ADAPT_SAMPLE_NS * hz / 1e9 / run_ticks);
+
+    if ((x = malloc(ADAPT_MAX_SAMPLES * sizeof(double))) == NULL) {
+	fprintf(stderr, "fsecs: out of memory\n");
+	exit(1);
+    }
+    st->converged = 0;
+    deadline = now + (unsigned long long)(adapt_budget * hz);
+    while (n < ADAPT_MAX_SAMPLES) {
+	start = ftimer_count_start();
+	for (i = 0; i < st->reps; i++)
+	    f(argp);
+	now = ftimer_count_stop();
+	x[n++] = (now - start) / hz / st->reps;
+
+	/* Sorting is the costly part, so look again only once there
+	   are a tenth more samples */
+	if (n >= check) {
+	    summarize(x, n, st);
+	    if (st->ci_hi - st->ci_lo <= adapt_width * st->median) {
+		st->converged = 1;
+		break;
+	    }
+	    check = n + n / 10 + 1;
+	}
+	if (now >= deadline && n >= ADAPT_MIN_SAMPLES)
+	    break;
+    }
+    summarize(x, n, st);
+    free(x);
+    return st->median;
+}
+
 /*
  * fsecs - Return the running time of a function f (in seconds)
  */
@@ -51,6 +205,8 @@ double fsecs(fsecs_test_funct f, void *argp)
     return ftimer_itimer(f, argp, 10);
 #elif USE_GETTOD
     return ftimer_gettod(f, argp, 10);
+#elif USE_TSC
+    return ftimer_counter(f, argp, 10);
 #endif 
 }
 
@@ -1,4 +1,20 @@
 typedef void (*fsecs_test_funct)(void *);
 
+/* What fsecs_adaptive measured; times are seconds per run of f */
+typedef struct {
+    double median;       /* median of the samples kept */
+    double ci_lo, ci_hi; /* 95% confidence interval of that median */
+    double cv;           /* coefficient of variation of the samples kept */
+    int samples;         /* samples kept */
+    int rejected;        /* samples dropped as outliers */
+    int reps;            /* runs of f timed together as one sample */
+    int converged;       /* did the interval narrow before the budget ran out? */
+} fsecs_stats_t;
+
 void init_fsecs(void);
 double fsecs(fsecs_test_funct f, void *argp);
+
+/* Repeat f until the 95% confidence interval of the median time is
+   within width of the median, or budget seconds have gone by */
+void set_fsecs_adaptive(double width, double budget);
+double fsecs_adaptive(fsecs_test_funct f, void *argp, fsecs_stats_t *st);
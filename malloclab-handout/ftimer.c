@@ -7,11 +7,23 @@
  * Function timers that estimate the running time (in seconds) of a function f.
  *    ftimer_itimer: version that uses the interval timer
  *    ftimer_gettod: version that uses gettimeofday
+ *    ftimer_counter: version that uses the invariant TSC, cntvct_el0
+ *                    or CLOCK_MONOTONIC_RAW, whichever is best here
  */
 #include <stdio.h>
 #include <sys/time.h>
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#endif
 #include "ftimer.h"
 
+/* How long ftimer_counter_init watches a hardware counter against
+   FTIMER_CLOCK; the error is about the clock read time over this */
+#define CALIBRATION_NS 50000000ULL /* 50 ms */
+
+int ftimer_hw_counter = 0;     /* read the hardware counter? */
+static double counter_hz = 0;  /* its ticks per second; 0 until picked */
+
 /* function prototypes */
 static void init_etime(void);
 static double get_etime(void);
@@ -53,6 +65,90 @@ double ftimer_gettod(ftimer_test_funct f, void *argp, int n)
 }
 
 
+/*
+ * hw_counter_usable - does this CPU have a counter that ticks at a
+ *     constant rate whatever the power state, and can we read it?
+ */
+static int hw_counter_usable(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    unsigned int eax, ebx, ecx, edx;
+
+    /* rdtscp is in 0x80000001 EDX bit 27, invariant TSC in 0x80000007
+       EDX bit 8 */
+    if (!__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx) ||
+	!(edx & (1u << 27)))
+	return 0;
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+	return 0;
+    return (edx & (1u << 8)) != 0;
+#elif defined(__aarch64__)
+    return 1; /* the generic timer is constant rate by definition */
+#else
+    return 0;
+#endif
+}
+
+/*
+ * ftimer_counter_init - pick the counter behind ftimer_counter and
+ *     return its rate in ticks per second
+ */
+double ftimer_counter_init(void)
+{
+    unsigned long long ns0, ns1, ticks0, ticks1;
+
+    if (counter_hz > 0)
+	return counter_hz; /* already calibrated */
+    ftimer_hw_counter = hw_counter_usable();
+    if (!ftimer_hw_counter) {
+	counter_hz = 1e9;
+	return counter_hz;
+    }
+
+    /* Count ticks over a stretch of FTIMER_CLOCK, bracketing each read
+       of the counter between reads of the clock */
+    ns0 = ftimer_clock_ns();
+    ticks0 = ftimer_count_start();
+    ns0 = (ns0 + ftimer_clock_ns()) / 2;
+    do {
+	ns1 = ftimer_clock_ns();
+	ticks1 = ftimer_count_stop();
+	ns1 = (ns1 + ftimer_clock_ns()) / 2;
+    } while (ns1 - ns0 < CALIBRATION_NS);
+    counter_hz = (double)(ticks1 - ticks0) * 1e9 / (double)(ns1 - ns0);
+    return counter_hz;
+}
+
+/*
+ * ftimer_counter_name - the counter behind ftimer_counter
+ */
+const char *ftimer_counter_name(void)
+{
+    if (!ftimer_hw_counter)
+	return "CLOCK_MONOTONIC_RAW";
+#if defined(__aarch64__)
+    return "cntvct_el0";
+#else
+    return "invariant TSC";
+#endif
+}
+
+/* 
+ * ftimer_counter - Use the counter picked by ftimer_counter_init to
+ * estimate the running time of f(argp). Return the average of n runs.
+ */
+double ftimer_counter(ftimer_test_funct f, void *argp, int n)
+{
+    unsigned long long start;
+    int i;
+
+    ftimer_counter_init();
+    start = ftimer_count_start();
+    for (i = 0; i < n; i++) 
+	f(argp);
+    return (double)(ftimer_count_stop() - start) / counter_hz / n;
+}
+
 /*
  * Routines for manipulating the Unix interval timer
  */
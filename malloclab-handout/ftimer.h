@@ -12,3 +12,78 @@ double ftimer_itimer(ftimer_test_funct f, void *argp, int n);
    Return the average of n runs */
 double ftimer_gettod(ftimer_test_funct f, void *argp, int n);
 
+/* Estimate the running time of f(argp) using the counter picked by
+   ftimer_counter_init. Return the average of n runs */
+double ftimer_counter(ftimer_test_funct f, void *argp, int n);
+
+/* Pick the counter: the invariant TSC on x86, cntvct_el0 on aarch64,
+   else CLOCK_MONOTONIC_RAW itself. Calibrates a hardware counter
+   against that clock, once, and returns its rate in ticks per second */
+double ftimer_counter_init(void);
+
+/* The counter's name, for reports */
+const char *ftimer_counter_name(void);
+
+#include <time.h>
+
+#ifdef CLOCK_MONOTONIC_RAW
+#define FTIMER_CLOCK CLOCK_MONOTONIC_RAW /* not slewed by NTP */
+#else
+#define FTIMER_CLOCK CLOCK_MONOTONIC
+#endif
+
+extern int ftimer_hw_counter; /* set by ftimer_counter_init */
+
+/* Nanoseconds on FTIMER_CLOCK */
+static inline unsigned long long ftimer_clock_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(FTIMER_CLOCK, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Read the counter before a timed region. The fence keeps earlier
+   instructions from drifting into the region */
+static inline unsigned long long ftimer_count_start(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    unsigned int lo, hi;
+
+    if (ftimer_hw_counter) {
+	__asm__ volatile("lfence; rdtsc" : "=a" (lo), "=d" (hi) :: "memory");
+	return ((unsigned long long)hi << 32) | lo;
+    }
+#elif defined(__aarch64__)
+    unsigned long long v;
+
+    if (ftimer_hw_counter) {
+	__asm__ volatile("isb; mrs %0, cntvct_el0" : "=r" (v) :: "memory");
+	return v;
+    }
+#endif
+    return ftimer_clock_ns();
+}
+
+/* Read the counter after a timed region, once the region is done */
+static inline unsigned long long ftimer_count_stop(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    unsigned int lo, hi;
+
+    if (ftimer_hw_counter) {
+	__asm__ volatile("rdtscp; lfence" : "=a" (lo), "=d" (hi) :: "ecx",
+			 "memory");
+	return ((unsigned long long)hi << 32) | lo;
+    }
+#elif defined(__aarch64__)
+    unsigned long long v;
+
+    if (ftimer_hw_counter) {
+	__asm__ volatile("isb; mrs %0, cntvct_el0; isb" : "=r" (v) :: "memory");
+	return v;
+    }
+#endif
+    return ftimer_clock_ns();
+}
+
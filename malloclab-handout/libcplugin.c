@@ -0,0 +1,91 @@
+/*
+ * libcplugin.c - the C library's malloc as an mmplugin.h backend
+ *
+ * mdriver links this file in for -l, and the Makefile builds it as
+ * plugin-libc.so. Built with -DPLUGIN_LIB=<name> and linked with
+ * -l<name>, as "make plugin-<name>.so" does, it wraps whichever
+ * malloc that library provides instead, e.g. jemalloc or tcmalloc.
+ *
+ * The C library cannot empty its heap, so init only hands what it can
+ * back to the system. Only glibc's own malloc reports a heap size,
+ * through mallinfo2. That counts mdriver's own blocks too, and the
+ * free space they left in the arena before the replay began. init
+ * notes both, and the heap size leaves out mdriver's blocks and as
+ * much of that free space as is still free. mdriver allocates nothing
+ * while it replays a trace.
+ */
+#include <stdlib.h>
+#include <malloc.h>
+
+#include "mmplugin.h"
+
+#define STRINGIFY(x)  #x
+#define NAME(x)       STRINGIFY(x)
+
+#if !defined(PLUGIN_LIB) && defined(__GLIBC__) && \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+#define HAVE_MALLINFO2 1
+#else
+#define HAVE_MALLINFO2 0
+#endif
+
+#if HAVE_MALLINFO2
+static size_t driver_bytes; /* in use by mdriver when the replay began */
+static size_t driver_free;  /* free in the arena then */
+#endif
+
+/*
+ * libc_init - hand free memory back to the system between replays
+ */
+static int libc_init(void)
+{
+#if HAVE_MALLINFO2
+    struct mallinfo2 mi;
+#endif
+
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+#if HAVE_MALLINFO2
+    mi = mallinfo2();
+    driver_bytes = mi.uordblks + mi.hblkhd;
+    driver_free = mi.fordblks;
+#endif
+    return 0;
+}
+
+#if HAVE_MALLINFO2
+/*
+ * libc_heapsize - bytes of the main arena and of mmapped chunks, less
+ *     those mdriver had in use before the replay and the free space it
+ *     had left that the replay has not used up since. What remains is
+ *     the replay's blocks and the free space between them
+ */
+static size_t libc_heapsize(void)
+{
+    struct mallinfo2 mi = mallinfo2();
+    size_t heap = mi.arena + mi.hblkhd;
+    size_t driver = driver_bytes +
+	((mi.fordblks < driver_free) ? mi.fordblks : driver_free);
+
+    return (heap > driver) ? heap - driver : 0;
+}
+#endif
+
+const mm_plugin_t mm_plugin = {
+    MM_PLUGIN_VERSION,
+#ifdef PLUGIN_LIB
+    NAME(PLUGIN_LIB),
+#else
+    "libc",
+#endif
+    libc_init,
+    malloc,
+    free,
+    realloc,
+#if HAVE_MALLINFO2
+    libc_heapsize,
+#else
+    NULL,
+#endif
+};
@@ -7,6 +7,7 @@
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE /* for sched_setaffinity */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -14,11 +15,23 @@
 #include <string.h>
 #include <assert.h>
 #include <float.h>
+#include <math.h>
+#include <stddef.h>
 #include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/utsname.h>
+#include <dlfcn.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "trace.h"
+#include "ftimer.h"
+#include "mmplugin.h"
 #include "config.h"
 
 /**********************
@@ -30,6 +43,39 @@
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
 
+/* Heap size samples kept per handle replay (-K) */
+#define CURVE_POINTS 8
+
+/* Timed replays per trace when measuring realloc copy rates */
+#define REALLOC_RUNS 3
+
+/* Resident set samples taken per replay (-R) */
+#define RSS_SAMPLES 256
+
+/* Timed replays per trace when comparing inline and queued frees (-Q) */
+#define ASYNC_RUNS 3
+
+/* Polls of another thread's progress before a replay thread yields (-T) */
+#define SPIN_LIMIT 64
+
+/* Most worker processes for -j */
+#define MAX_JOBS 256
+
+/* Most allocator backends for -P and -l together */
+#define MAX_PLUGINS 16
+
+/*
+ * Log-linear latency histograms (-L): values below 2^HIST_SUB_BITS get
+ * a bucket each, and every power of two above is split into
+ * 2^HIST_SUB_BITS buckets, for a relative error under 1/2^HIST_SUB_BITS
+ */
+#define HIST_SUB_BITS 5
+#define HIST_SUB      (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS  ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+/* Empty timed regions run to measure the timer's own cost (-L) */
+#define TSC_CALIBRATION 10000
+
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
 
@@ -38,29 +84,29 @@
  *****************************/
 
 /* Records the extent of each block's payload */
-typedef struct range_t {
-    char *lo;              /* low payload address */
-    char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+typedef struct {
+    char *lo;              /* low payload address, NULL in an empty slot */
+    int size;              /* payload bytes */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
+/*
+ * Every allocated payload: a shadow bitmap with one bit per ALIGNMENT
+ * bytes of the heap, set where some payload lies, and an open-addressed
+ * hash table of ranges keyed on payload address. Adding or removing a
+ * payload costs O(size / ALIGNMENT / bits per word), whatever the
+ * number of blocks.
+ */
 typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
-    int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
-} traceop_t;
+    char *base;            /* heap address of the first shadow bit */
+    unsigned long *shadow;
+    size_t shadow_bits;    /* a multiple of SHADOW_WORD_BITS */
+    range_t *table;
+    size_t slots;          /* table size, a power of two */
+    size_t count;          /* payloads in the table */
+} ranges_t;
 
-/* Holds the information for one trace file*/
-typedef struct {
-    int sugg_heapsize;   /* suggested heap size (unused) */
-    int num_ids;         /* number of alloc/realloc ids */
-    int num_ops;         /* number of distinct requests */
-    int weight;          /* weight for this trace (unused) */
-    traceop_t *ops;      /* array of requests */
-    char **blocks;       /* array of ptrs returned by malloc/realloc... */
-    size_t *block_sizes; /* ... and a corresponding array of payload sizes */
-} trace_t;
+#define SHADOW_WORD_BITS (8 * sizeof(unsigned long))
+#define RANGE_SLOTS_MIN 1024 /* initial hash table size */
 
 /* 
  * Holds the params to the xxx_speed functions, which are timed by fcyc. 
@@ -69,9 +115,67 @@ typedef struct {
  */
 typedef struct {
     trace_t *trace;  
-    range_t *ranges;
+    ranges_t *ranges;
+    const mm_plugin_t *plugin; /* for eval_plugin_speed */
 } speed_t;
 
+/* Heap size over one replay of a trace through mm_halloc (-K) */
+typedef struct {
+    double mean_heap;           /* heap size averaged over the requests */
+    double peak_heap;           /* largest heap size */
+    double max_pause;           /* longest mm_compact step, in secs */
+    double p99_pause;           /* 99th percentile mm_compact step */
+    double curve[CURVE_POINTS]; /* heap size at evenly spaced requests */
+} heapcurve_t;
+
+/* Resident heap pages over one replay of a trace (-R) */
+typedef struct {
+    double mean_rss;  /* resident heap bytes averaged over the samples */
+    double peak_rss;  /* most resident heap bytes at any sample */
+    double peak_heap; /* largest heap size, for comparison */
+} rss_t;
+
+/* What mm_free costs its caller over one replay of a trace (-Q) */
+typedef struct {
+    double free_secs;  /* time spent inside mm_free, best of several */
+    double total_secs; /* whole replay, including draining the queues */
+} freecost_t;
+
+/* One request of a replay thread's stream, and the request of another
+   thread that must have run first: the last one on the same block (-T) */
+typedef struct {
+    traceop_t op;
+    int wait_thread;   /* thread of the request waited for, or -1 */
+    int wait_pos;      /* its position in that thread's stream */
+} threadop_t;
+
+/* One thread of a multi-threaded replay (-T) */
+typedef struct {
+    int progress;       /* requests done; polled by other threads */
+    threadop_t *ops;
+    int num_ops;
+    trace_t *trace;     /* whose blocks array all the threads share */
+    void *replayers;    /* every replayer_t of the replay */
+    pthread_barrier_t *start;
+    double secs;        /* from the start to the last request */
+    double waits;       /* requests that had to wait for another thread */
+    pthread_t thread;
+} __attribute__((aligned(64))) replayer_t;
+
+/* Latency of one kind of request over a replay of a trace (-L) */
+typedef struct {
+    double count;
+    double p50, p99, p999; /* percentiles, timer overhead subtracted */
+    double max;
+} latency_t;
+
+/* What one replay thread did (-T) */
+typedef struct {
+    double ops;
+    double secs;
+    double waits;
+} threadstat_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
@@ -81,10 +185,117 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    double hint_util;/* utilization with lifetime hints (only with -H) */
+    heapcurve_t handles[2]; /* handle replay without, with compaction (-K) */
+    double reallocs;         /* number of realloc requests in the trace */
+    double realloc_bytes;    /* payload bytes realloc had to keep */
+    double realloc_secs;     /* time spent in mm_realloc, best of several */
+    double committed;        /* heap bytes committed after the timed runs */
+    double resident;         /* ... and resident then, before any -R replay */
+    rss_t rss[2];            /* first fit, page-aware placement (-R) */
+    double frees;            /* number of free requests in the trace */
+    freecost_t freecost[2];  /* inline frees, reclaimer thread (-Q) */
+    int threads;             /* replay threads (-T) */
+    threadstat_t *thread;    /* what each did, or NULL (-T) */
+    double thread_secs;      /* wall time of the threaded replay (-T) */
+    int thread_heap_ok;      /* heap consistent after it? (-T) */
+    latency_t latency[3];    /* by request type: ALLOC, FREE, REALLOC (-L) */
+    fsecs_stats_t timing;    /* how secs was measured (-A) */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
 
+/* Kinds of stats_t field */
+enum { FIELD_INT, FIELD_DOUBLE, FIELD_CURVE };
+
+/* A numeric stats_t field, as -o writes it and -B reads it back */
+typedef struct {
+    const char *name;
+    int kind;
+    size_t offset;
+} field_t;
+
+#define FIELD(kind, name, member) { name, kind, offsetof(stats_t, member) }
+#define HANDLE_FIELDS(i)						\
+    FIELD(FIELD_DOUBLE, "handles" #i "_mean_heap", handles[i].mean_heap), \
+    FIELD(FIELD_DOUBLE, "handles" #i "_peak_heap", handles[i].peak_heap), \
+    FIELD(FIELD_DOUBLE, "handles" #i "_max_pause", handles[i].max_pause), \
+    FIELD(FIELD_DOUBLE, "handles" #i "_p99_pause", handles[i].p99_pause), \
+    FIELD(FIELD_CURVE, "handles" #i "_curve", handles[i].curve)
+#define RSS_FIELDS(i)							\
+    FIELD(FIELD_DOUBLE, "rss" #i "_mean_rss", rss[i].mean_rss),		\
+    FIELD(FIELD_DOUBLE, "rss" #i "_peak_rss", rss[i].peak_rss),		\
+    FIELD(FIELD_DOUBLE, "rss" #i "_peak_heap", rss[i].peak_heap)
+#define FREECOST_FIELDS(i)						\
+    FIELD(FIELD_DOUBLE, "freecost" #i "_free_secs", freecost[i].free_secs), \
+    FIELD(FIELD_DOUBLE, "freecost" #i "_total_secs", freecost[i].total_secs)
+#define LATENCY_FIELDS(op, i)						\
+    FIELD(FIELD_DOUBLE, "latency_" op "_count", latency[i].count),	\
+    FIELD(FIELD_DOUBLE, "latency_" op "_p50", latency[i].p50),		\
+    FIELD(FIELD_DOUBLE, "latency_" op "_p99", latency[i].p99),		\
+    FIELD(FIELD_DOUBLE, "latency_" op "_p999", latency[i].p999),	\
+    FIELD(FIELD_DOUBLE, "latency_" op "_max", latency[i].max)
+
+/* Every stats_t field but the per-thread array, in output order;
+   latencies are in counter ticks */
+static const field_t stats_fields[] = {
+    FIELD(FIELD_INT, "valid", valid),
+    FIELD(FIELD_DOUBLE, "ops", ops),
+    FIELD(FIELD_DOUBLE, "secs", secs),
+    FIELD(FIELD_DOUBLE, "util", util),
+    FIELD(FIELD_DOUBLE, "hint_util", hint_util),
+    HANDLE_FIELDS(0),
+    HANDLE_FIELDS(1),
+    FIELD(FIELD_DOUBLE, "reallocs", reallocs),
+    FIELD(FIELD_DOUBLE, "realloc_bytes", realloc_bytes),
+    FIELD(FIELD_DOUBLE, "realloc_secs", realloc_secs),
+    RSS_FIELDS(0),
+    RSS_FIELDS(1),
+    FIELD(FIELD_DOUBLE, "frees", frees),
+    FREECOST_FIELDS(0),
+    FREECOST_FIELDS(1),
+    FIELD(FIELD_INT, "threads", threads),
+    FIELD(FIELD_DOUBLE, "thread_secs", thread_secs),
+    FIELD(FIELD_INT, "thread_heap_ok", thread_heap_ok),
+    LATENCY_FIELDS("malloc", ALLOC),
+    LATENCY_FIELDS("free", FREE),
+    LATENCY_FIELDS("realloc", REALLOC),
+    FIELD(FIELD_DOUBLE, "timing_median", timing.median),
+    FIELD(FIELD_DOUBLE, "timing_ci_lo", timing.ci_lo),
+    FIELD(FIELD_DOUBLE, "timing_ci_hi", timing.ci_hi),
+    FIELD(FIELD_DOUBLE, "timing_cv", timing.cv),
+    FIELD(FIELD_INT, "timing_samples", timing.samples),
+    FIELD(FIELD_INT, "timing_rejected", timing.rejected),
+    FIELD(FIELD_INT, "timing_reps", timing.reps),
+    FIELD(FIELD_INT, "timing_converged", timing.converged),
+    { NULL, 0, 0 }
+};
+
+/* One trace of a -B baseline */
+typedef struct {
+    char name[MAXLINE];
+    stats_t stats;
+} baseline_t;
+
+/* What -o records about the run beyond its stats */
+typedef struct {
+    int argc;
+    char **argv;
+    char **tracefiles;
+    int jobs;
+    int commit;
+    int correct;
+    double perfindex;
+} runinfo_t;
+
+/* What a -j worker sends back for each trace, ahead of the per-thread
+   stats of a -T replay */
+typedef struct {
+    int tracenum;
+    int errors;          /* errors found while evaluating it */
+    stats_t stats;       /* with the thread pointer meaningless */
+} result_t;
+
 /********************
  * Global variables
  *******************/
@@ -92,6 +303,62 @@ int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
+/* If set, also measure utilization with lifetime hints (set by -H) */
+static int use_hints = 0;
+
+/* If nonzero, also replay through handles, compacting this many bytes
+   after each request (set by -K) */
+static size_t compact_budget = 0;
+
+/* If set, also compare resident set size under first-fit and page-aware
+   placement (set by -R) */
+static int measure_rss = 0;
+
+/* If nonzero, also time frees handed to a reclaimer thread through
+   queues of this many slots (set by -Q) */
+static unsigned int async_depth = 0;
+
+/* If set, also time every request and report latency percentiles
+   (set by -L) */
+static int measure_latency = 0;
+
+/* Allocator backends to run the traces through as well as mm.c
+   (set by -P and -l) */
+static const mm_plugin_t *plugins[MAX_PLUGINS];
+static int num_plugins = 0;
+
+/* The C library's malloc as a backend, from libcplugin.c (-l) */
+extern const mm_plugin_t mm_plugin;
+
+/* Write the mm results here, as JSON or as CSV (set by -o) */
+static char *results_file = NULL;
+
+/* Compare the mm results with these (set by -B), and fail on a drop
+   in throughput or utilization of more than this fraction */
+static char *baseline_file = NULL;
+static double baseline_threshold = 0.05;
+
+/* If set, time each trace until the median is known to within a
+   confidence interval, rather than averaging a fixed 10 runs (set by -A) */
+static int adaptive_timing = 0;
+
+/* Cost of an empty timed region, subtracted from each sample, and
+   nanoseconds per counter tick (-L) */
+static unsigned long long tsc_overhead = 0;
+static double tick_ns = 1;
+
+/* If set, also replay each thread of a trace on a thread of its own
+   (set by -T) */
+static int replay_threads = 0;
+
+/* If set, stream this trace through mm malloc instead of loading the
+   default traces (set by -s) */
+static char *stream_file = NULL;
+
+/* Heap checking that mm.c runs after each operation (set by -C) */
+static mm_check_t check_level = MM_CHECK_OFF;
+static unsigned long check_period = 1000;
+
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
@@ -106,31 +373,72 @@ static char *default_tracefiles[] = {
  *********************/
 
 /* these functions manipulate range lists */
-static int add_range(range_t **ranges, char *lo, int size, 
+static int add_range(ranges_t *ranges, char *lo, int size, 
 		     int tracenum, int opnum);
-static void remove_range(range_t **ranges, char *lo);
-static void clear_ranges(range_t **ranges);
-
-/* These functions read, allocate, and free storage for traces */
-static trace_t *read_trace(char *tracedir, char *filename);
-static void free_trace(trace_t *trace);
-
-/* Routines for evaluating the correctness and speed of libc malloc */
-static int eval_libc_valid(trace_t *trace, int tracenum);
-static void eval_libc_speed(void *ptr);
+static void remove_range(ranges_t *ranges, char *lo);
+static void clear_ranges(ranges_t *ranges);
+
+/* Routines for evaluating the correctness, space utilization and
+   speed of an allocator backend, libc malloc among them */
+static void add_plugin(const mm_plugin_t *plugin);
+static void load_plugin(char *path);
+static void plugin_error(const mm_plugin_t *plugin, int tracenum, int opnum,
+			 char *call);
+static void free_leftovers(const mm_plugin_t *plugin, trace_t *trace);
+static void eval_plugin_trace(const mm_plugin_t *plugin, trace_t *trace,
+			      int tracenum, stats_t *stats);
+static int eval_plugin_valid(const mm_plugin_t *plugin, trace_t *trace,
+			     int tracenum, double *util);
+static void eval_plugin_speed(void *ptr);
 
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
-static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
+static void eval_mm_trace(char *tracefile, int tracenum, ranges_t *ranges,
+			  stats_t *stats);
+static void eval_mm_parallel(char **tracefiles, int n, int jobs,
+			     stats_t *stats);
+static int eval_mm_valid(trace_t *trace, int tracenum, ranges_t *ranges);
+static double eval_mm_util(trace_t *trace, int tracenum, ranges_t *ranges,
+			   mm_lifetime_t *hints);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_realloc(trace_t *trace, stats_t *stats);
+static void eval_mm_rss(trace_t *trace, mm_placement_t policy, rss_t *rss);
+static void eval_mm_async(trace_t *trace, unsigned int depth,
+			  freecost_t *cost, double *frees);
+static void eval_mm_stream(char *path);
+static void eval_mm_threads(trace_t *trace, stats_t *stats);
+static void eval_mm_latency(trace_t *trace, stats_t *stats);
+static void calibrate_tsc(void);
+
+/* Replay through the movable-handle API */
+static void eval_mm_handles(trace_t *trace, int tracenum, size_t budget,
+			    heapcurve_t *curve);
+
+/* Lifetime prediction for mm_malloc_hint */
+static mm_lifetime_t *predict_lifetimes(trace_t *trace);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printhints(int n, stats_t *stats);
+static void printhandles(int n, stats_t *stats);
+static void printrealloc(int n, stats_t *stats);
+static void printrss(int n, stats_t *stats);
+static void printheap(int n, stats_t *stats, int commit);
+static void printasync(int n, stats_t *stats);
+static void printthreads(int n, stats_t *stats);
+static void printplugins(int n, stats_t *mm_stats, stats_t **plugin_stats);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
 static void app_error(char *msg);
+static size_t parse_size(char *str);
+static void parse_check(char *str);
+static void parse_adaptive(char *str);
+static void parse_baseline(char *str);
+static void write_results(char *path, runinfo_t *run, int n, stats_t *stats);
+static int compare_baseline(char *path, double threshold, runinfo_t *run,
+			    int n, stats_t *stats);
+static double time_trace(fsecs_test_funct f, speed_t *params, stats_t *stats);
 
 /**************
  * Main routine
@@ -142,23 +450,24 @@ int main(int argc, char **argv)
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
     trace_t *trace = NULL;     /* stores a single trace file in memory */
-    range_t *ranges = NULL;    /* keeps track of block extents for one trace */
-    stats_t *libc_stats = NULL;/* libc stats for each trace */
+    ranges_t ranges;           /* keeps track of block extents for one trace */
+    stats_t **plugin_stats = NULL; /* for each backend, stats per trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
-    speed_t speed_params;      /* input parameters to the xx_speed routines */ 
+    runinfo_t run;             /* what -o records about this run */
 
     int team_check = 1;  /* If set, check team structure (reset by -a) */
-    int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int commit = MEM_COMMIT_LAZY; /* memlib commit strategy (set by -c) */
+    int jobs = 1;        /* worker processes for the mm traces (set by -j) */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
-    int numcorrect;
+    int numcorrect, p;
     
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:c:m:s:j:o:A:B:C:K:P:Q:hvVgalHLRST")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -178,11 +487,74 @@ int main(int argc, char **argv)
 	    if (tracedir[strlen(tracedir)-1] != '/') 
 		strcat(tracedir, "/"); /* path always ends with "/" */
 	    break;
+        case 'c': /* How memlib commits heap pages */
+	    if ((commit = mem_commit_parse(optarg)) < 0) {
+		usage();
+		exit(1);
+	    }
+	    mem_set_commit(commit);
+	    break;
+        case 'm': /* Maximum heap size, with an optional K/M/G suffix */
+	    mem_set_max_heap(parse_size(optarg));
+	    break;
+        case 'j': /* Evaluate the mm traces in <jobs> worker processes */
+	    jobs = atoi(optarg);
+	    if (jobs < 1 || jobs > MAX_JOBS) {
+		usage();
+		exit(1);
+	    }
+	    break;
+        case 's': /* Stream one long trace file (relative to curr dir) */
+	    stream_file = optarg;
+	    break;
+        case 'A': /* Time adaptively, to a <pct> wide interval in <secs> */
+	    parse_adaptive(optarg);
+	    break;
+        case 'o': /* Write the mm results to <file> as JSON or CSV */
+	    results_file = optarg;
+	    break;
+        case 'B': /* Compare with the results in <file> */
+	    parse_baseline(optarg);
+	    break;
+        case 'C': /* Heap checking level for mm.c */
+	    parse_check(optarg);
+	    break;
+        case 'K': /* Replay with handles, compacting <budget> bytes per op */
+	    compact_budget = parse_size(optarg);
+	    break;
+        case 'Q': /* Compare inline frees with a <depth>-slot reclaimer */
+	    if ((async_depth = parse_size(optarg)) == 0) {
+		usage();
+		exit(1);
+	    }
+	    break;
+        case 'H': /* Compare utilization with and without lifetime hints */
+	    use_hints = 1;
+	    break;
+        case 'L': /* Time every request and report latency percentiles */
+	    measure_latency = 1;
+	    break;
+        case 'R': /* Compare resident set size under both placements */
+	    measure_rss = 1;
+	    break;
+        case 'S': /* Split small blocks from the high end of free blocks */
+	    mm_setsplit(MM_SPLIT_BY_SIZE);
+	    break;
+        case 'T': /* Replay each trace thread on an OS thread */
+#ifndef MM_THREADSAFE
+	    printf("ERROR: -T needs a thread-safe mm.c; make mdriver-mt\n");
+	    exit(1);
+#endif
+	    replay_threads = 1;
+	    break;
         case 'a': /* Don't check team structure */
             team_check = 0;
             break;
         case 'l': /* Run libc malloc */
-            run_libc = 1;
+            add_plugin(&mm_plugin);
+            break;
+        case 'P': /* Run the allocator backend in shared object <file> */
+            load_plugin(optarg);
             break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
@@ -225,6 +597,13 @@ int main(int argc, char **argv)
 	    printf("Member 2 :%s:%s\n", team.name2, team.id2);
     }
 
+    /* A streamed trace is replayed once, on its own */
+    if (stream_file != NULL) {
+	mem_init();
+	eval_mm_stream(stream_file);
+	exit(0);
+    }
+
     /* 
      * If no -f command line arg, then use the entire set of tracefiles 
      * defined in default_traces[]
@@ -237,39 +616,36 @@ int main(int argc, char **argv)
 
     /* Initialize the timing package */
     init_fsecs();
+    if (measure_latency)
+	calibrate_tsc();
 
     /*
-     * Optionally run and evaluate the libc malloc package 
+     * Optionally run and evaluate other allocators, libc malloc among them
      */
-    if (run_libc) {
+    if (num_plugins > 0 &&
+	(plugin_stats = calloc(num_plugins, sizeof(stats_t *))) == NULL)
+	unix_error("plugin_stats calloc in main failed");
+    for (p = 0; p < num_plugins; p++) {
 	if (verbose > 1)
-	    printf("\nTesting libc malloc\n");
+	    printf("\nTesting %s malloc\n", plugins[p]->name);
 	
-	/* Allocate libc stats array, with one stats_t struct per tracefile */
-	libc_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
-	if (libc_stats == NULL)
-	    unix_error("libc_stats calloc in main failed");
+	/* Allocate its stats array, with one stats_t struct per tracefile */
+	plugin_stats[p] = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+	if (plugin_stats[p] == NULL)
+	    unix_error("plugin_stats calloc in main failed");
 	
-	/* Evaluate the libc malloc package using the K-best scheme */
+	/* Evaluate the backend using the K-best scheme */
 	for (i=0; i < num_tracefiles; i++) {
 	    trace = read_trace(tracedir, tracefiles[i]);
-	    libc_stats[i].ops = trace->num_ops;
-	    if (verbose > 1)
-		printf("Checking libc malloc for correctness, ");
-	    libc_stats[i].valid = eval_libc_valid(trace, i);
-	    if (libc_stats[i].valid) {
-		speed_params.trace = trace;
-		if (verbose > 1)
-		    printf("and performance.\n");
-		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
-	    }
+	    plugin_stats[p][i].ops = trace->num_ops;
+	    eval_plugin_trace(plugins[p], trace, i, &plugin_stats[p][i]);
 	    free_trace(trace);
 	}
 
-	/* Display the libc results in a compact table */
+	/* Display its results in a compact table */
 	if (verbose) {
-	    printf("\nResults for libc malloc:\n");
-	    printresults(num_tracefiles, libc_stats);
+	    printf("\nResults for %s malloc:\n", plugins[p]->name);
+	    printresults(num_tracefiles, plugin_stats[p]);
 	}
     }
 
@@ -286,31 +662,56 @@ int main(int argc, char **argv)
     
     /* Initialize the simulated memory system in memlib.c */
     mem_init(); 
+    memset(&ranges, 0, sizeof(ranges));
 
     /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
-	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-	if (mm_stats[i].valid) {
-	    if (verbose > 1)
-		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
-	    speed_params.trace = trace;
-	    speed_params.ranges = ranges;
-	    if (verbose > 1)
-		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
-	}
-	free_trace(trace);
-    }
+    if (jobs > 1)
+	eval_mm_parallel(tracefiles, num_tracefiles, jobs, mm_stats);
+    else
+	for (i=0; i < num_tracefiles; i++)
+	    eval_mm_trace(tracefiles[i], i, &ranges, &mm_stats[i]);
 
     /* Display the mm results in a compact table */
     if (verbose) {
 	printf("\nResults for mm malloc:\n");
 	printresults(num_tracefiles, mm_stats);
+	printheap(num_tracefiles, mm_stats, commit);
+	printf("\nRealloc copy rate:\n");
+	printrealloc(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /* The hinted utilization is reported, but does not count */
+    if (use_hints) {
+	printf("\nUtilization with lifetime hints profiled from the first half:\n");
+	printhints(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (compact_budget > 0) {
+	printf("\nHeap size with handles, mm_compact(%lu) after each op:\n",
+	       (unsigned long)compact_budget);
+	printhandles(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (measure_rss) {
+	printf("\nResident heap KB, first fit vs page-aware placement:\n");
+	printrss(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (async_depth > 0) {
+	printf("\nFree latency seen by the caller, inline vs %u-slot reclaimer:\n",
+	       async_depth);
+	printasync(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (replay_threads) {
+	printf("\nThroughput with each trace thread on its own thread:\n");
+	printthreads(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (num_plugins > 0) {
+	printf("\nUtilization and Kops of mm.c and each other allocator:\n");
+	printplugins(num_tracefiles, mm_stats, plugin_stats);
 	printf("\n");
     }
 
@@ -362,26 +763,188 @@ int main(int argc, char **argv)
 	printf("perfidx:%.0f\n", perfindex);
     }
 
+    /* Hand the results to other programs, or to a later -B */
+    run.argc = argc;
+    run.argv = argv;
+    run.tracefiles = tracefiles;
+    run.jobs = jobs;
+    run.commit = commit;
+    run.correct = numcorrect;
+    run.perfindex = perfindex;
+    i = (baseline_file != NULL) ?
+	compare_baseline(baseline_file, baseline_threshold, &run,
+			 num_tracefiles, mm_stats) : 0;
+    if (results_file != NULL) /* after -B, which may read the same file */
+	write_results(results_file, &run, num_tracefiles, mm_stats);
+    if (i > 0)
+	exit(2);
+
     exit(0);
 }
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps 
- * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
+ * The following routines manipulate the ranges, which keep track of
+ * the extent of every allocated block payload. We use the shadow
+ * bitmap to detect any overlapping allocated blocks, and the table
+ * to find a block's extent again when it is freed.
  ****************************************************************/
 
+/*
+ * range_hash - home slot of the payload at lo
+ */
+static size_t range_hash(ranges_t *ranges, char *lo)
+{
+    return ((size_t)(lo - ranges->base) / ALIGNMENT * 2654435761u) &
+	(ranges->slots - 1);
+}
+
+/*
+ * find_range - the table slot holding payload lo, or NULL
+ */
+static range_t *find_range(ranges_t *ranges, char *lo)
+{
+    size_t i;
+
+    if (ranges->slots == 0)
+	return NULL;
+    for (i = range_hash(ranges, lo); ranges->table[i].lo != NULL;
+	 i = (i + 1) & (ranges->slots - 1))
+	if (ranges->table[i].lo == lo)
+	    return &ranges->table[i];
+    return NULL;
+}
+
+/*
+ * insert_range - put payload lo in the table, doubling it when half full
+ */
+static void insert_range(ranges_t *ranges, char *lo, int size)
+{
+    range_t *old = ranges->table;
+    size_t old_slots = ranges->slots;
+    size_t i;
+
+    if (2 * (ranges->count + 1) > ranges->slots) {
+	ranges->slots = old_slots ? 2 * old_slots : RANGE_SLOTS_MIN;
+	if ((ranges->table = calloc(ranges->slots, sizeof(range_t))) == NULL)
+	    unix_error("calloc error in insert_range");
+	ranges->count = 0;
+	for (i = 0; i < old_slots; i++)
+	    if (old[i].lo != NULL)
+		insert_range(ranges, old[i].lo, old[i].size);
+	free(old);
+    }
+
+    for (i = range_hash(ranges, lo); ranges->table[i].lo != NULL;
+	 i = (i + 1) & (ranges->slots - 1))
+	;
+    ranges->table[i].lo = lo;
+    ranges->table[i].size = size;
+    ranges->count++;
+}
+
+/*
+ * delete_range - empty table slot p, moving later entries of its probe
+ *     run back so that every entry stays reachable from its home slot
+ */
+static void delete_range(ranges_t *ranges, range_t *p)
+{
+    size_t mask = ranges->slots - 1;
+    size_t i = p - ranges->table;
+    size_t j = i;
+    size_t home;
+
+    ranges->table[i].lo = NULL;
+    ranges->count--;
+    for (;;) {
+	j = (j + 1) & mask;
+	if (ranges->table[j].lo == NULL)
+	    return;
+	home = range_hash(ranges, ranges->table[j].lo);
+	/* j's entry may fill the hole unless its home lies in (i, j] */
+	if (((j - home) & mask) >= ((j - i) & mask)) {
+	    ranges->table[i] = ranges->table[j];
+	    ranges->table[j].lo = NULL;
+	    i = j;
+	}
+    }
+}
+
+/*
+ * shadow_first - the first set bit in [first, last], or -1 if none
+ */
+static long shadow_first(ranges_t *ranges, size_t first, size_t last)
+{
+    size_t w, bit;
+    unsigned long word;
+
+    for (w = first / SHADOW_WORD_BITS; w <= last / SHADOW_WORD_BITS; w++) {
+	word = ranges->shadow[w];
+	if (w == first / SHADOW_WORD_BITS)
+	    word &= ~0UL << (first % SHADOW_WORD_BITS);
+	if (w == last / SHADOW_WORD_BITS && last % SHADOW_WORD_BITS != SHADOW_WORD_BITS - 1)
+	    word &= (1UL << (last % SHADOW_WORD_BITS + 1)) - 1;
+	if (word != 0) {
+	    for (bit = 0; !(word & (1UL << bit)); bit++)
+		;
+	    return (long)(w * SHADOW_WORD_BITS + bit);
+	}
+    }
+    return -1;
+}
+
+/*
+ * shadow_mark - set (or, if set is 0, clear) the bits in [first, last]
+ */
+static void shadow_mark(ranges_t *ranges, size_t first, size_t last, int set)
+{
+    size_t w;
+    unsigned long mask;
+
+    for (w = first / SHADOW_WORD_BITS; w <= last / SHADOW_WORD_BITS; w++) {
+	mask = ~0UL;
+	if (w == first / SHADOW_WORD_BITS)
+	    mask &= ~0UL << (first % SHADOW_WORD_BITS);
+	if (w == last / SHADOW_WORD_BITS && last % SHADOW_WORD_BITS != SHADOW_WORD_BITS - 1)
+	    mask &= (1UL << (last % SHADOW_WORD_BITS + 1)) - 1;
+	if (set)
+	    ranges->shadow[w] |= mask;
+	else
+	    ranges->shadow[w] &= ~mask;
+    }
+}
+
+/*
+ * shadow_cover - grow the bitmap, zero filled, to hold bit last
+ */
+static void shadow_cover(ranges_t *ranges, size_t last)
+{
+    size_t bits = ranges->shadow_bits ? ranges->shadow_bits : SHADOW_WORD_BITS;
+
+    if (last < ranges->shadow_bits)
+	return;
+    while (bits <= last)
+	bits *= 2;
+    ranges->shadow = realloc(ranges->shadow, bits / 8);
+    if (ranges->shadow == NULL)
+	unix_error("realloc error in shadow_cover");
+    memset((char *)ranges->shadow + ranges->shadow_bits / 8, 0,
+	   (bits - ranges->shadow_bits) / 8);
+    ranges->shadow_bits = bits;
+}
+
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list. 
+ *     we mark it in the shadow bitmap and add it to the table.
  */
-static int add_range(range_t **ranges, char *lo, int size, 
+static int add_range(ranges_t *ranges, char *lo, int size, 
 		     int tracenum, int opnum)
 {
     char *hi = lo + size - 1;
+    size_t first, last;
+    long bit;
     range_t *p;
     char msg[MAXLINE];
 
@@ -404,178 +967,303 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
-	    malloc_error(tracenum, opnum, msg);
-	    return 0;
-        }
-    }
-
     /* 
-     * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
+     * The payload must not overlap any other payloads. Payloads are
+     * aligned, so two of them share an ALIGNMENT unit only if they
+     * overlap. The one hit starts at the nearest unit below in the table.
      */
-    if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
-	unix_error("malloc error in add_range");
-    p->next = *ranges;
-    p->lo = lo;
-    p->hi = hi;
-    *ranges = p;
+    first = (size_t)(lo - ranges->base) / ALIGNMENT;
+    last = (size_t)(hi - ranges->base) / ALIGNMENT;
+    shadow_cover(ranges, last);
+    if ((bit = shadow_first(ranges, first, last)) >= 0) {
+	while ((p = find_range(ranges, ranges->base + bit * ALIGNMENT)) == NULL)
+	    bit--;
+	sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+		lo, hi, p->lo, p->lo + p->size - 1);
+	malloc_error(tracenum, opnum, msg);
+	return 0;
+    }
+
+    /* Everything looks OK, so remember the extent of this block */
+    shadow_mark(ranges, first, last, 1);
+    insert_range(ranges, lo, size);
     return 1;
 }
 
 /* 
- * remove_range - Free the range record of block whose payload starts at lo 
+ * remove_range - Forget the block whose payload starts at lo 
  */
-static void remove_range(range_t **ranges, char *lo)
+static void remove_range(ranges_t *ranges, char *lo)
 {
     range_t *p;
-    range_t **prevpp = ranges;
-    int size;
 
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-            size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
+    if ((p = find_range(ranges, lo)) != NULL) {
+	shadow_mark(ranges, (size_t)(lo - ranges->base) / ALIGNMENT,
+		    (size_t)(lo + p->size - 1 - ranges->base) / ALIGNMENT, 0);
+	delete_range(ranges, p);
     }
 }
 
 /*
- * clear_ranges - free all of the range records for a trace 
+ * clear_ranges - forget every block of a trace, and start the shadow
+ *     bitmap at the bottom of the heap
  */
-static void clear_ranges(range_t **ranges)
+static void clear_ranges(ranges_t *ranges)
 {
-    range_t *p;
-    range_t *pnext;
-
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
-    }
-    *ranges = NULL;
+    if (ranges->shadow != NULL)
+	memset(ranges->shadow, 0, ranges->shadow_bits / 8);
+    if (ranges->table != NULL)
+	memset(ranges->table, 0, ranges->slots * sizeof(range_t));
+    ranges->count = 0;
+    ranges->base = mem_heap_lo();
 }
 
 
-/**********************************************
- * The following routines manipulate tracefiles
- *********************************************/
+/**********************************************************************
+ * The following functions evaluate the correctness, space utilization,
+ * and throughput of the libc and mm malloc packages.
+ **********************************************************************/
 
 /*
- * read_trace - read a trace file and store it in memory
+ * eval_mm_trace - Run every evaluation that is switched on for one
+ *     trace of the mm malloc package and fill in its stats
  */
-static trace_t *read_trace(char *tracedir, char *filename)
+static void eval_mm_trace(char *tracefile, int tracenum, ranges_t *ranges,
+			  stats_t *stats)
 {
-    FILE *tracefile;
     trace_t *trace;
-    char type[MAXLINE];
-    char path[MAXLINE];
-    unsigned index, size;
-    unsigned max_index = 0;
-    unsigned op_index;
+    speed_t speed_params;
+    mm_lifetime_t *hints;
 
+    trace = read_trace(tracedir, tracefile);
+    stats->ops = trace->num_ops;
     if (verbose > 1)
-	printf("Reading tracefile: %s\n", filename);
+	printf("Checking mm_malloc for correctness, ");
+    stats->valid = eval_mm_valid(trace, tracenum, ranges);
+    if (stats->valid) {
+	if (verbose > 1)
+	    printf("efficiency, ");
+	stats->util = eval_mm_util(trace, tracenum, ranges, NULL);
+	if (use_hints) {
+	    hints = predict_lifetimes(trace);
+	    stats->hint_util = eval_mm_util(trace, tracenum, ranges, hints);
+	    free(hints);
+	}
+	if (compact_budget > 0) {
+	    eval_mm_handles(trace, tracenum, 0, &stats->handles[0]);
+	    eval_mm_handles(trace, tracenum, compact_budget, &stats->handles[1]);
+	}
+	speed_params.trace = trace;
+	speed_params.ranges = ranges;
+	if (verbose > 1)
+	    printf("and performance.\n");
+	stats->secs = time_trace(eval_mm_speed, &speed_params, stats);
+	eval_mm_realloc(trace, stats);
+
+	/* -R replays on heaps of its own, and purges them */
+	stats->committed = mem_committed();
+	stats->resident = mem_rss();
+	if (measure_rss) {
+	    eval_mm_rss(trace, MM_PLACE_FIRST_FIT, &stats->rss[0]);
+	    eval_mm_rss(trace, MM_PLACE_RESIDENT, &stats->rss[1]);
+	}
+	if (async_depth > 0) {
+	    eval_mm_async(trace, 0, &stats->freecost[0], &stats->frees);
+	    eval_mm_async(trace, async_depth, &stats->freecost[1],
+			  &stats->frees);
+	}
+	if (replay_threads)
+	    eval_mm_threads(trace, stats);
+	if (measure_latency)
+	    eval_mm_latency(trace, stats);
+    }
+    free_trace(trace);
+}
 
-    /* Allocate the trace record */
-    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
-	unix_error("malloc 1 failed in read_trance");
-	
-    /* Read the trace file header */
-    strcpy(path, tracedir);
-    strcat(path, filename);
-    if ((tracefile = fopen(path, "r")) == NULL) {
-	sprintf(msg, "Could not open %s in read_trace", path);
-	unix_error(msg);
+/*
+ * write_all, read_all - move len bytes through a pipe, whatever
+ *     size of pieces it takes them in; read_all returns 0 at EOF
+ */
+static void write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    ssize_t n;
+
+    while (len > 0) {
+	if ((n = write(fd, p, len)) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    unix_error("write in a -j worker failed");
+	}
+	p += n;
+	len -= n;
     }
-    fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
-    fscanf(tracefile, "%d", &(trace->num_ids));     
-    fscanf(tracefile, "%d", &(trace->num_ops));     
-    fscanf(tracefile, "%d", &(trace->weight));        /* not used */
-    
-    /* We'll store each request line in the trace in this array */
-    if ((trace->ops = 
-	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-	unix_error("malloc 2 failed in read_trace");
-
-    /* We'll keep an array of pointers to the allocated blocks here... */
-    if ((trace->blocks = 
-	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
-	unix_error("malloc 3 failed in read_trace");
-
-    /* ... along with the corresponding byte sizes of each block */
-    if ((trace->block_sizes = 
-	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
-	unix_error("malloc 4 failed in read_trace");
-    
-    /* read every request line in the trace file */
-    index = 0;
-    op_index = 0;
-    while (fscanf(tracefile, "%s", type) != EOF) {
-	switch(type[0]) {
-	case 'a':
-	    fscanf(tracefile, "%u %u", &index, &size);
-	    trace->ops[op_index].type = ALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
-	    break;
-	case 'r':
-	    fscanf(tracefile, "%u %u", &index, &size);
-	    trace->ops[op_index].type = REALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
-	    break;
-	case 'f':
-	    fscanf(tracefile, "%ud", &index);
-	    trace->ops[op_index].type = FREE;
-	    trace->ops[op_index].index = index;
-	    break;
-	default:
-	    printf("Bogus type character (%c) in tracefile %s\n", 
-		   type[0], path);
-	    exit(1);
+}
+
+static int read_all(int fd, void *buf, size_t len)
+{
+    char *p = buf;
+    ssize_t n;
+
+    while (len > 0) {
+	if ((n = read(fd, p, len)) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    unix_error("read from a -j worker failed");
 	}
-	op_index++;
-	
+	if (n == 0) {
+	    if (p != (char *)buf)
+		app_error("a -j worker sent a truncated result");
+	    return 0;
+	}
+	p += n;
+	len -= n;
     }
-    fclose(tracefile);
-    assert(max_index == trace->num_ids - 1);
-    assert(trace->num_ops == op_index);
-    
-    return trace;
+    return 1;
 }
 
 /*
- * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
+ * allowed_cpus - how many CPUs the calling process may run on, or 0 if
+ *     that cannot be told
  */
-void free_trace(trace_t *trace)
+static int allowed_cpus(void)
 {
-    free(trace->ops);         /* free the three arrays... */
-    free(trace->blocks);      
-    free(trace->block_sizes);
-    free(trace);              /* and the trace record itself... */
+    cpu_set_t allowed;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+	return 0;
+    return CPU_COUNT(&allowed);
 }
 
-/**********************************************************************
- * The following functions evaluate the correctness, space utilization,
- * and throughput of the libc and mm malloc packages.
- **********************************************************************/
+/*
+ * pin_to_cpu - keep the calling process on the nth CPU it may run on,
+ *     so that workers do not share cores; nth must be below
+ *     allowed_cpus()
+ */
+static void pin_to_cpu(int nth)
+{
+    cpu_set_t allowed, one;
+    int cpu;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+	return;
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+	if (CPU_ISSET(cpu, &allowed) && nth-- == 0) {
+	    CPU_ZERO(&one);
+	    CPU_SET(cpu, &one);
+	    sched_setaffinity(0, sizeof(one), &one);
+	    return;
+	}
+    }
+}
+
+/*
+ * eval_mm_parallel - Evaluate the traces in jobs worker processes, each
+ *     pinned to a CPU of its own and with a heap of its own, taking
+ *     traces from a shared counter as it finishes the last one and
+ *     sending each one's stats back over its pipe. There are never more
+ *     workers than CPUs to pin them to, since two timed workers on one
+ *     CPU would each see the other's time as their own.
+ */
+static void eval_mm_parallel(char **tracefiles, int n, int jobs,
+			     stats_t *stats)
+{
+    struct pollfd fds[MAX_JOBS];
+    int *next;
+    int fd[2];
+    int w, i, open_pipes, status, cpus;
+    ranges_t ranges;
+    result_t result;
+    size_t len;
+    pid_t pid;
+
+    /* The next trace to take, shared by every worker */
+    next = mmap(NULL, sizeof(int), PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (next == MAP_FAILED)
+	unix_error("mmap in eval_mm_parallel failed");
+    *next = 0;
+    if (jobs > n)
+	jobs = n;
+    if ((cpus = allowed_cpus()) > 0 && jobs > cpus) {
+	printf("Warning: %d jobs but only %d CPU%s to run them on; "
+	       "using %d worker%s\n", jobs, cpus, (cpus == 1) ? "" : "s",
+	       cpus, (cpus == 1) ? "" : "s");
+	jobs = cpus;
+    }
+
+    fflush(stdout); /* or every worker would print it again */
+    for (w = 0; w < jobs; w++) {
+	if (pipe(fd) < 0)
+	    unix_error("pipe in eval_mm_parallel failed");
+	if ((pid = fork()) < 0)
+	    unix_error("fork in eval_mm_parallel failed");
+	if (pid == 0) {
+	    close(fd[0]);
+	    if (cpus > 0)
+		pin_to_cpu(w);
+	    mem_init();
+	    memset(&ranges, 0, sizeof(ranges));
+	    while ((i = __atomic_fetch_add(next, 1, __ATOMIC_RELAXED)) < n) {
+		memset(&result, 0, sizeof(result));
+		result.tracenum = i;
+		result.errors = errors;
+		eval_mm_trace(tracefiles[i], i, &ranges, &result.stats);
+		result.errors = errors - result.errors;
+		write_all(fd[1], &result, sizeof(result));
+		if (result.stats.thread != NULL)
+		    write_all(fd[1], result.stats.thread,
+			      result.stats.threads * sizeof(threadstat_t));
+	    }
+	    fflush(stdout);
+	    _exit(0);
+	}
+	close(fd[1]);
+	fds[w].fd = fd[0];
+	fds[w].events = POLLIN;
+    }
+
+    /* Collect results as they come, until every worker has finished */
+    for (open_pipes = jobs; open_pipes > 0; ) {
+	if (poll(fds, jobs, -1) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    unix_error("poll in eval_mm_parallel failed");
+	}
+	for (w = 0; w < jobs; w++) {
+	    if (fds[w].fd < 0 || fds[w].revents == 0)
+		continue;
+	    if (!read_all(fds[w].fd, &result, sizeof(result))) {
+		close(fds[w].fd);
+		fds[w].fd = -1;
+		open_pipes--;
+		continue;
+	    }
+	    if (result.stats.thread != NULL) {
+		len = result.stats.threads * sizeof(threadstat_t);
+		if ((result.stats.thread = malloc(len)) == NULL)
+		    unix_error("malloc in eval_mm_parallel failed");
+		if (!read_all(fds[w].fd, result.stats.thread, len))
+		    app_error("a -j worker sent a truncated result");
+	    }
+	    stats[result.tracenum] = result.stats;
+	    errors += result.errors;
+	}
+    }
+
+    while (wait(&status) > 0)
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	    app_error("a -j worker failed");
+    munmap(next, sizeof(int));
+}
 
 /*
  * eval_mm_valid - Check the mm malloc package for correctness
  */
-static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) 
+static int eval_mm_valid(trace_t *trace, int tracenum, ranges_t *ranges) 
 {
+    trace_iter_t it;
+    traceop_t op;
     int i, j;
     int index;
     int size;
@@ -587,6 +1275,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     /* Reset the heap and free any records in the range list */
     mem_reset_brk();
     clear_ranges(ranges);
+    mm_setcheck(check_level, check_period);
 
     /* Call the mm package's init function */
     if (mm_init() < 0) {
@@ -595,11 +1284,11 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     }
 
     /* Interpret each operation in the trace in order */
-    for (i = 0;  i < trace->num_ops;  i++) {
-	index = trace->ops[i].index;
-	size = trace->ops[i].size;
+    for (trace_start(trace, &it), i = 0; trace_next(&it, &op); i++) {
+	index = op.index;
+	size = op.size;
 
-        switch (trace->ops[i].type) {
+        switch (op.type) {
 
         case ALLOC: /* mm_malloc */
 
@@ -653,7 +1342,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
+	      if ((unsigned char)newp[j] != (index & 0xFF)) {
 		malloc_error(tracenum, i, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
@@ -678,6 +1367,11 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
 
+	/* The heap checker, if enabled, must agree with us */
+	if (mm_checkfailures() > 0) {
+	    malloc_error(tracenum, i, "mm_check found an inconsistent heap.");
+	    return 0;
+	}
     }
 
     /* As far as we know, this is a valid malloc package */
@@ -690,13 +1384,17 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the 
  *   size of the heap in bytes after running the student's malloc 
- *   package on the trace. Note that our implementation of mem_sbrk() 
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap. 
+ *   package on the trace. mem_sbrk() lets the brk pointer drop, so
+ *   heapsize is the brk's high water mark, not where it ended up.
  *   
+ *   If hints is not NULL, each allocation is made with mm_malloc_hint
+ *   and the lifetime predicted for its request.
  */
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
+static double eval_mm_util(trace_t *trace, int tracenum, ranges_t *ranges,
+			   mm_lifetime_t *hints)
 {   
+    trace_iter_t it;
+    traceop_t op;
     int i;
     int index;
     int size, newsize, oldsize;
@@ -710,14 +1408,15 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
     if (mm_init() < 0)
 	app_error("mm_init failed in eval_mm_util");
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+    for (trace_start(trace, &it), i = 0; trace_next(&it, &op); i++) {
+        switch (op.type) {
 
         case ALLOC: /* mm_alloc */
-	    index = trace->ops[i].index;
-	    size = trace->ops[i].size;
+	    index = op.index;
+	    size = op.size;
 
-	    if ((p = mm_malloc(size)) == NULL) 
+	    p = (hints == NULL) ? mm_malloc(size) : mm_malloc_hint(size, hints[i]);
+	    if (p == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
 	    
 	    /* Remember region and size */
@@ -734,8 +1433,8 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    break;
 
 	case REALLOC: /* mm_realloc */
-	    index = trace->ops[i].index;
-	    newsize = trace->ops[i].size;
+	    index = op.index;
+	    newsize = op.size;
 	    oldsize = trace->block_sizes[index];
 
 	    oldp = trace->blocks[index];
@@ -756,7 +1455,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    break;
 
         case FREE: /* mm_free */
-	    index = trace->ops[i].index;
+	    index = op.index;
 	    size = trace->block_sizes[index];
 	    p = trace->blocks[index];
 	    
@@ -774,140 +1473,1493 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
         }
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    return ((double)max_total_size / (double)mem_peak_heapsize());
 }
 
 
 /*
- * eval_mm_speed - This is the function that is used by fcyc()
- *    to measure the running time of the mm malloc package.
+ * payload_intact - Is every byte of a size byte payload equal to c?
  */
-static void eval_mm_speed(void *ptr)
+static int payload_intact(char *p, int size, int c)
 {
-    int i, index, size, newsize;
-    char *p, *newp, *oldp, *block;
-    trace_t *trace = ((speed_t *)ptr)->trace;
-
-    /* Reset the heap and initialize the mm package */
-    mem_reset_brk();
-    if (mm_init() < 0) 
-	app_error("mm_init failed in eval_mm_speed");
-
-    /* Interpret each trace request */
-    for (i = 0;  i < trace->num_ops;  i++)
-        switch (trace->ops[i].type) {
-
-        case ALLOC: /* mm_malloc */
-            index = trace->ops[i].index;
-            size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
-		app_error("mm_malloc error in eval_mm_speed");
-            trace->blocks[index] = p;
-            break;
+    int i;
 
-	case REALLOC: /* mm_realloc */
-	    index = trace->ops[i].index;
-            newsize = trace->ops[i].size;
-	    oldp = trace->blocks[index];
-            if ((newp = mm_realloc(oldp,newsize)) == NULL)
-		app_error("mm_realloc error in eval_mm_speed");
-            trace->blocks[index] = newp;
-            break;
+    for (i = 0; i < size; i++)
+	if (p[i] != (char)c)
+	    return 0;
+    return 1;
+}
 
-        case FREE: /* mm_free */
-            index = trace->ops[i].index;
-            block = trace->blocks[index];
-            mm_free(block);
-            break;
+static int double_cmp(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
 
-	default:
-	    app_error("Nonexistent request type in eval_mm_valid");
-        }
+    return (x > y) - (x < y);
 }
 
 /*
- * eval_libc_valid - We run this function to make sure that the
- *    libc malloc can run to completion on the set of traces.
- *    We'll be conservative and terminate if any libc malloc call fails.
- *
+ * eval_mm_handles - Replay a trace through mm_halloc and mm_hfree,
+ *     running mm_compact(budget) after each request (none if budget
+ *     is 0), and record how the heap size evolves. Realloc becomes
+ *     halloc, copy and hfree. Every payload is filled with a byte
+ *     derived from its id, which is checked before the block goes,
+ *     so a bad move by the compactor shows up as an error.
  */
-static int eval_libc_valid(trace_t *trace, int tracenum)
+static void eval_mm_handles(trace_t *trace, int tracenum, size_t budget,
+			    heapcurve_t *curve)
 {
-    int i, newsize;
-    char *p, *newp, *oldp;
+    trace_iter_t it;
+    traceop_t op;
+    mm_handle_t *handles;
+    mm_handle_t h;
+    struct timespec start, end;
+    double *pauses;
+    double heap, total = 0;
+    int i, index, size, oldsize, copy;
+    char *p;
+
+    handles = calloc(trace->num_ids, sizeof(mm_handle_t));
+    pauses = calloc(trace->num_ops, sizeof(double));
+    if (handles == NULL || pauses == NULL)
+	unix_error("calloc in eval_mm_handles failed");
+    memset(curve, 0, sizeof(heapcurve_t));
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_handles");
+
+    for (trace_start(trace, &it), i = 0; trace_next(&it, &op); i++) {
+	index = op.index;
+	switch (op.type) {
+
+	case ALLOC: /* mm_halloc */
+	case REALLOC: /* mm_halloc, copy, mm_hfree */
+	    size = op.size;
+	    if ((h = mm_halloc(size)) == 0)
+		app_error("mm_halloc failed in eval_mm_handles");
+	    p = mm_hderef(h);
+	    copy = 0;
+	    if (op.type == REALLOC) {
+		oldsize = trace->block_sizes[index];
+		copy = (oldsize < size) ? oldsize : size;
+		if (!payload_intact(mm_hderef(handles[index]), oldsize, index))
+		    malloc_error(tracenum, i, "movable block was corrupted");
+		memcpy(p, mm_hderef(handles[index]), copy);
+		mm_hfree(handles[index]);
+	    }
+	    memset(p + copy, index & 0xFF, size - copy);
+	    handles[index] = h;
+	    trace->block_sizes[index] = size;
+	    break;
+
+	case FREE: /* mm_hfree */
+	    if (!payload_intact(mm_hderef(handles[index]),
+				trace->block_sizes[index], index))
+		malloc_error(tracenum, i, "movable block was corrupted");
+	    mm_hfree(handles[index]);
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_handles");
+	}
+
+	if (budget > 0) {
+	    clock_gettime(CLOCK_MONOTONIC, &start);
+	    mm_compact(budget);
+	    clock_gettime(CLOCK_MONOTONIC, &end);
+	    pauses[i] = (end.tv_sec - start.tv_sec) +
+		(end.tv_nsec - start.tv_nsec) / 1e9;
+	}
+
+	heap = mem_heapsize();
+	total += heap;
+	if (heap > curve->peak_heap)
+	    curve->peak_heap = heap;
+	curve->curve[(long)i * CURVE_POINTS / trace->num_ops] = heap;
+    }
+    curve->mean_heap = total / trace->num_ops;
+
+    qsort(pauses, trace->num_ops, sizeof(double), double_cmp);
+    curve->max_pause = pauses[trace->num_ops - 1];
+    curve->p99_pause = pauses[(long)trace->num_ops * 99 / 100];
+
+    free(pauses);
+    free(handles);
+}
+
+/*
+ * A request's lifetime is the number of requests from the alloc or
+ * realloc that made its block to the free or realloc that ends it
+ * (or to the end of the profile). A site whose mean lifetime is below
+ * SHORT_LIFETIME of the profile's length is predicted short-lived.
+ * The profile is the first PROFILE_SHARE of the trace, so that the
+ * hints for the rest of it are predictions rather than hindsight.
+ */
+#define SHORT_LIFETIME 0.3
+#define PROFILE_SHARE 0.5
+
+typedef struct {
+    int key;   /* site tag, or request size for untagged traces */
+    int op;    /* index of the alloc/realloc request */
+    long life; /* its lifetime in requests */
+} lifetime_t;
+
+static int lifetime_cmp(const void *a, const void *b)
+{
+    const lifetime_t *x = a, *y = b;
+
+    return (x->key > y->key) - (x->key < y->key);
+}
+
+/*
+ * predict_lifetimes - Profile the start of a trace and predict, for
+ *     every request, whether the block it makes is short-lived.
+ *     Requests are grouped by their site tag, or by their size when
+ *     the trace carries no tags; a group the profile never saw is
+ *     predicted long-lived. Returns an array with one hint per request.
+ */
+static mm_lifetime_t *predict_lifetimes(trace_t *trace)
+{
+    mm_lifetime_t *hints;
+    lifetime_t *lives;
+    lifetime_t *run;
+    int *born;     /* lives[] entry of each id's live block, or -1 */
+    int profile = (int)(PROFILE_SHARE * trace->num_ops);
+    int n = 0, runs = 0;
+    int i, j;
+    double total;
+    trace_iter_t it;
+    traceop_t op;
+    lifetime_t key;
+
+    hints = calloc(trace->num_ops, sizeof(mm_lifetime_t));
+    lives = malloc((profile + 1) * sizeof(lifetime_t));
+    born = malloc(trace->num_ids * sizeof(int));
+    if (hints == NULL || lives == NULL || born == NULL)
+	unix_error("malloc in predict_lifetimes failed");
+    for (i = 0; i < trace->num_ids; i++)
+	born[i] = -1;
+
+    for (trace_start(trace, &it), i = 0; i < profile && trace_next(&it, &op); i++) {
+	if (born[op.index] >= 0)
+	    lives[born[op.index]].life = i - lives[born[op.index]].op;
+	born[op.index] = -1;
+	if (op.type == FREE)
+	    continue;
+	lives[n].key = trace->has_sites ? op.site : op.size;
+	lives[n].op = i;
+	lives[n].life = profile - i; /* until freed */
+	born[op.index] = n++;
+    }
+
+    /* Sort by key and fold each run of equal keys into its mean */
+    qsort(lives, n, sizeof(lifetime_t), lifetime_cmp);
+    for (i = 0; i < n; i = j) {
+	total = 0;
+	for (j = i; j < n && lives[j].key == lives[i].key; j++)
+	    total += lives[j].life;
+	lives[runs].key = lives[i].key;
+	lives[runs++].life = (total / (j - i) < SHORT_LIFETIME * profile);
+    }
+
+    for (trace_start(trace, &it), i = 0; trace_next(&it, &op); i++) {
+	if (op.type == FREE)
+	    continue;
+	key.key = trace->has_sites ? op.site : op.size;
+	run = bsearch(&key, lives, runs, sizeof(lifetime_t), lifetime_cmp);
+	hints[i] = (run != NULL && run->life) ?
+	    MM_LIFETIME_SHORT : MM_LIFETIME_LONG;
+    }
+
+    free(born);
+    free(lives);
+    return hints;
+}
+
+/*
+ * eval_mm_speed - This is the function that is used by fcyc()
+ *    to measure the running time of the mm malloc package.
+ */
+static void eval_mm_speed(void *ptr)
+{
+    trace_iter_t it;
+    traceop_t op;
+    int i, index, size, newsize;
+    char *p, *newp, *oldp, *block;
+    trace_t *trace = ((speed_t *)ptr)->trace;
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (mm_init() < 0) 
+	app_error("mm_init failed in eval_mm_speed");
+
+    /* Interpret each trace request */
+    for (trace_start(trace, &it), i = 0; trace_next(&it, &op); i++)
+        switch (op.type) {
+
+        case ALLOC: /* mm_malloc */
+            index = op.index;
+            size = op.size;
+            if ((p = mm_malloc(size)) == NULL)
+		app_error("mm_malloc error in eval_mm_speed");
+            trace->blocks[index] = p;
+            break;
+
+	case REALLOC: /* mm_realloc */
+	    index = op.index;
+            newsize = op.size;
+	    oldp = trace->blocks[index];
+            if ((newp = mm_realloc(oldp,newsize)) == NULL)
+		app_error("mm_realloc error in eval_mm_speed");
+            trace->blocks[index] = newp;
+            break;
+
+        case FREE: /* mm_free */
+            index = op.index;
+            block = trace->blocks[index];
+            mm_free(block);
+            break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_valid");
+        }
+}
+
+/*
+ * eval_mm_realloc - Replay the trace and time each mm_realloc call on
+ *     its own, to see how fast realloc moves payloads. The bytes counted
+ *     are the ones the caller needs kept: the smaller of the old and
+ *     new sizes.
+ */
+static void eval_mm_realloc(trace_t *trace, stats_t *stats)
+{
+    trace_iter_t it;
+    traceop_t op;
+    int i, run, index, size;
+    char *p;
+    struct timespec start, end;
+    double secs;
+
+    stats->reallocs = 0;
+    stats->realloc_bytes = 0;
+    stats->realloc_secs = DBL_MAX;
+    for (run = 0; run < REALLOC_RUNS; run++) {
+	mem_reset_brk();
+	if (mm_init() < 0)
+	    app_error("mm_init failed in eval_mm_realloc");
+
+	secs = 0;
+	for (trace_start(trace, &it), i = 0; trace_next(&it, &op); i++) {
+	    index = op.index;
+	    size = op.size;
+	    switch (op.type) {
+	    case ALLOC:
+		if ((p = mm_malloc(size)) == NULL)
+		    app_error("mm_malloc error in eval_mm_realloc");
+		trace->blocks[index] = p;
+		trace->block_sizes[index] = size;
+		break;
+
+	    case REALLOC:
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		p = mm_realloc(trace->blocks[index], size);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		if (p == NULL)
+		    app_error("mm_realloc error in eval_mm_realloc");
+		secs += (end.tv_sec - start.tv_sec) +
+		    (end.tv_nsec - start.tv_nsec) / 1e9;
+		if (run == 0) {
+		    stats->reallocs++;
+		    stats->realloc_bytes += (trace->block_sizes[index] < (size_t)size) ?
+			trace->block_sizes[index] : (size_t)size;
+		}
+		trace->blocks[index] = p;
+		trace->block_sizes[index] = size;
+		break;
+
+	    case FREE:
+		mm_free(trace->blocks[index]);
+		break;
+	    }
+	}
+	if (secs < stats->realloc_secs)
+	    stats->realloc_secs = secs;
+    }
+}
+
+/*
+ * eval_mm_rss - Replay a trace on a fresh heap under a placement policy,
+ *     writing every payload as a program would, and sample how much of
+ *     the heap is resident (by mincore) as it goes.
+ */
+static void eval_mm_rss(trace_t *trace, mm_placement_t policy, rss_t *rss)
+{
+    trace_iter_t it;
+    traceop_t op;
+    int i, index, size, samples = 0;
+    int step = trace->num_ops / RSS_SAMPLES + 1;
+    double resident;
+    char *p;
+
+    memset(rss, 0, sizeof(rss_t));
+    mem_init(); /* a new reservation, so no page starts out resident */
+    mm_setplacement(policy);
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_rss");
+
+    for (trace_start(trace, &it), i = 0; trace_next(&it, &op); i++) {
+	index = op.index;
+	size = op.size;
+	switch (op.type) {
+	case ALLOC:
+	    if ((p = mm_malloc(size)) == NULL)
+		app_error("mm_malloc error in eval_mm_rss");
+	    memset(p, index & 0xFF, size);
+	    trace->blocks[index] = p;
+	    break;
+
+	case REALLOC:
+	    if ((p = mm_realloc(trace->blocks[index], size)) == NULL)
+		app_error("mm_realloc error in eval_mm_rss");
+	    memset(p, index & 0xFF, size);
+	    trace->blocks[index] = p;
+	    break;
+
+	case FREE:
+	    mm_free(trace->blocks[index]);
+	    break;
+	}
+
+	if (i % step == 0 || i == trace->num_ops - 1) {
+	    resident = mem_rss();
+	    rss->mean_rss += resident;
+	    if (resident > rss->peak_rss)
+		rss->peak_rss = resident;
+	    samples++;
+	}
+    }
+
+    rss->mean_rss /= samples;
+    rss->peak_heap = mem_peak_heapsize();
+    mm_setplacement(MM_PLACE_FIRST_FIT);
+}
+
+/*
+ * eval_mm_async - Replay a trace, timing each mm_free call on its own
+ *     and the replay as a whole. With depth nonzero the frees go to a
+ *     reclaimer thread, which the total waits for at the end.
+ */
+static void eval_mm_async(trace_t *trace, unsigned int depth,
+			  freecost_t *cost, double *frees)
+{
+    trace_iter_t it;
+    traceop_t op;
+    int i, run, index, size;
+    char *p;
+    struct timespec start, end, op_start, op_end;
+    double free_secs, total_secs;
+
+    *frees = 0;
+    cost->free_secs = DBL_MAX;
+    cost->total_secs = DBL_MAX;
+    for (run = 0; run < ASYNC_RUNS; run++) {
+	mem_reset_brk();
+	if (mm_init() < 0)
+	    app_error("mm_init failed in eval_mm_async");
+	if (depth > 0 && mm_async_start(depth) < 0)
+	    app_error("mm_async_start failed in eval_mm_async");
+
+	free_secs = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (trace_start(trace, &it), i = 0; trace_next(&it, &op); i++) {
+	    index = op.index;
+	    size = op.size;
+	    switch (op.type) {
+	    case ALLOC:
+		if ((p = mm_malloc(size)) == NULL)
+		    app_error("mm_malloc error in eval_mm_async");
+		trace->blocks[index] = p;
+		break;
+
+	    case REALLOC:
+		if ((p = mm_realloc(trace->blocks[index], size)) == NULL)
+		    app_error("mm_realloc error in eval_mm_async");
+		trace->blocks[index] = p;
+		break;
+
+	    case FREE:
+		clock_gettime(CLOCK_MONOTONIC, &op_start);
+		mm_free(trace->blocks[index]);
+		clock_gettime(CLOCK_MONOTONIC, &op_end);
+		free_secs += (op_end.tv_sec - op_start.tv_sec) +
+		    (op_end.tv_nsec - op_start.tv_nsec) / 1e9;
+		if (run == 0)
+		    (*frees)++;
+		break;
+	    }
+	}
+	if (depth > 0)
+	    mm_async_stop();
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	total_secs = (end.tv_sec - start.tv_sec) +
+	    (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	if (free_secs < cost->free_secs)
+	    cost->free_secs = free_secs;
+	if (total_secs < cost->total_secs)
+	    cost->total_secs = total_secs;
+    }
+}
+
+/*
+ * split_threads - deal the requests of trace out to one stream per
+ *     trace thread, in trace order, noting for each request the last
+ *     request on the same block id if another thread made it
+ */
+static replayer_t *split_threads(trace_t *trace)
+{
+    replayer_t *rep;
+    trace_iter_t it;
+    traceop_t op;
+    int *last_thread, *last_pos;
+    threadop_t *t;
+    int i;
+
+    rep = aligned_alloc(64, trace->num_threads * sizeof(replayer_t));
+    last_thread = malloc(trace->num_ids * sizeof(int));
+    last_pos = malloc(trace->num_ids * sizeof(int));
+    if (rep == NULL || last_thread == NULL || last_pos == NULL)
+	unix_error("malloc in split_threads failed");
+    memset(rep, 0, trace->num_threads * sizeof(replayer_t));
+    for (i = 0; i < trace->num_ids; i++)
+	last_thread[i] = -1;
+
+    for (trace_start(trace, &it); trace_next(&it, &op); )
+	rep[op.thread].num_ops++;
+    for (i = 0; i < trace->num_threads; i++) {
+	rep[i].ops = malloc((rep[i].num_ops + 1) * sizeof(threadop_t));
+	if (rep[i].ops == NULL)
+	    unix_error("malloc in split_threads failed");
+	rep[i].num_ops = 0;
+	rep[i].trace = trace;
+	rep[i].replayers = rep;
+    }
+    for (trace_start(trace, &it); trace_next(&it, &op); ) {
+	t = &rep[op.thread].ops[rep[op.thread].num_ops];
+	t->op = op;
+	t->wait_thread = -1;
+	if (last_thread[op.index] >= 0 && last_thread[op.index] != op.thread) {
+	    t->wait_thread = last_thread[op.index];
+	    t->wait_pos = last_pos[op.index];
+	}
+	last_thread[op.index] = op.thread;
+	last_pos[op.index] = rep[op.thread].num_ops++;
+    }
+
+    free(last_thread);
+    free(last_pos);
+    return rep;
+}
+
+/*
+ * replay_thread - run one thread's stream once every replay thread has
+ *     started. Before a request that depends on another thread, spin
+ *     (then yield) until that thread's progress counter has passed the
+ *     request it waits for. Waits always point back in trace order, so
+ *     they cannot deadlock.
+ */
+static void *replay_thread(void *arg)
+{
+    replayer_t *self = arg;
+    replayer_t *rep = self->replayers;
+    trace_t *trace = self->trace;
+    struct timespec start, end;
+    threadop_t *t;
+    char *p;
+    int i, spins;
+
+    pthread_barrier_wait(self->start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < self->num_ops; i++) {
+	t = &self->ops[i];
+	if (t->wait_thread >= 0 &&
+	    __atomic_load_n(&rep[t->wait_thread].progress, __ATOMIC_ACQUIRE)
+	    <= t->wait_pos) {
+	    self->waits++;
+	    for (spins = 0;
+		 __atomic_load_n(&rep[t->wait_thread].progress,
+				 __ATOMIC_ACQUIRE) <= t->wait_pos; spins++)
+		if (spins >= SPIN_LIMIT)
+		    sched_yield();
+	}
+
+	switch (t->op.type) {
+	case ALLOC:
+	    if ((p = mm_malloc(t->op.size)) == NULL)
+		app_error("mm_malloc error in replay_thread");
+	    trace->blocks[t->op.index] = p;
+	    break;
+
+	case REALLOC:
+	    p = mm_realloc(trace->blocks[t->op.index], t->op.size);
+	    if (p == NULL)
+		app_error("mm_realloc error in replay_thread");
+	    trace->blocks[t->op.index] = p;
+	    break;
+
+	case FREE:
+	    mm_free(trace->blocks[t->op.index]);
+	    break;
+	}
+	__atomic_store_n(&self->progress, i + 1, __ATOMIC_RELEASE);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    self->secs = (end.tv_sec - start.tv_sec) +
+	(end.tv_nsec - start.tv_nsec) / 1e9;
+    return NULL;
+}
+
+/*
+ * eval_mm_threads - Replay the trace with each of its threads' requests
+ *     on an OS thread of its own, all sharing the default heap, and
+ *     record each thread's throughput and the wall time of the whole.
+ */
+static void eval_mm_threads(trace_t *trace, stats_t *stats)
+{
+    replayer_t *rep = split_threads(trace);
+    pthread_barrier_t start;
+    struct timespec begin, end;
+    int i;
+
+    stats->threads = trace->num_threads;
+    stats->thread = calloc(trace->num_threads, sizeof(threadstat_t));
+    if (stats->thread == NULL)
+	unix_error("calloc in eval_mm_threads failed");
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_threads");
+
+    pthread_barrier_init(&start, NULL, trace->num_threads + 1);
+    for (i = 0; i < trace->num_threads; i++) {
+	rep[i].start = &start;
+	if (pthread_create(&rep[i].thread, NULL, replay_thread, &rep[i]) != 0)
+	    unix_error("pthread_create in eval_mm_threads failed");
+    }
+    pthread_barrier_wait(&start);
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    for (i = 0; i < trace->num_threads; i++)
+	pthread_join(rep[i].thread, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    pthread_barrier_destroy(&start);
+
+    stats->thread_secs = (end.tv_sec - begin.tv_sec) +
+	(end.tv_nsec - begin.tv_nsec) / 1e9;
+    stats->thread_heap_ok = mm_check();
+    for (i = 0; i < trace->num_threads; i++) {
+	stats->thread[i].ops = rep[i].num_ops;
+	stats->thread[i].secs = rep[i].secs;
+	stats->thread[i].waits = rep[i].waits;
+	free(rep[i].ops);
+    }
+    free(rep);
+}
+
+/*
+ * calibrate_tsc - set tsc_overhead to the least time an empty timed
+ *     region takes, so that it can be taken off every sample, and
+ *     tick_ns to the length of a counter tick
+ */
+static void calibrate_tsc(void)
+{
+    unsigned long long start, elapsed, least = ~0ULL;
+    int i;
+
+    tick_ns = 1e9 / ftimer_counter_init();
+    for (i = 0; i < TSC_CALIBRATION; i++) {
+	start = ftimer_count_start();
+	elapsed = ftimer_count_stop() - start;
+	if (elapsed < least)
+	    least = elapsed;
+    }
+    tsc_overhead = least;
+}
+
+/*
+ * hist_bucket - the histogram bucket of value v
+ */
+static int hist_bucket(unsigned long long v)
+{
+    int msb;
+
+    if (v < HIST_SUB)
+	return (int)v;
+    msb = 63 - __builtin_clzll(v);
+    return (msb - HIST_SUB_BITS + 1) * HIST_SUB +
+	(int)(v >> (msb - HIST_SUB_BITS)) - HIST_SUB;
+}
+
+/*
+ * hist_value - the largest value that falls in bucket b
+ */
+static double hist_value(int b)
+{
+    int shift = b / HIST_SUB - 1;
+
+    if (shift <= 0)
+	return b;
+    return (double)(((unsigned long long)(b % HIST_SUB + HIST_SUB + 1)
+		     << shift) - 1);
+}
+
+/*
+ * hist_percentile - the value below or at which a share q of the
+ *     count samples in hist lie
+ */
+static double hist_percentile(unsigned int *hist, double count, double q)
+{
+    double seen = 0;
+    int b;
+
+    for (b = 0; b < HIST_BUCKETS; b++) {
+	seen += hist[b];
+	if (seen >= q * count)
+	    return hist_value(b);
+    }
+    return hist_value(HIST_BUCKETS - 1);
+}
+
+/*
+ * eval_mm_latency - Replay the trace timing each request on its own
+ *     with the time stamp counter, less the timer's own cost, and
+ *     summarize each request type's histogram by its percentiles
+ */
+static void eval_mm_latency(trace_t *trace, stats_t *stats)
+{
+    static unsigned int hist[3][HIST_BUCKETS];
+    unsigned long long start, elapsed;
+    double max[3] = {0, 0, 0};
+    latency_t *l;
+    trace_iter_t it;
+    traceop_t op;
+    char *p;
+    int t, b;
+
+    memset(hist, 0, sizeof(hist));
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_latency");
+
+    for (trace_start(trace, &it); trace_next(&it, &op); ) {
+	switch (op.type) {
+	case ALLOC:
+	    start = ftimer_count_start();
+	    p = mm_malloc(op.size);
+	    elapsed = ftimer_count_stop() - start;
+	    if (p == NULL)
+		app_error("mm_malloc error in eval_mm_latency");
+	    trace->blocks[op.index] = p;
+	    break;
+
+	case REALLOC:
+	    start = ftimer_count_start();
+	    p = mm_realloc(trace->blocks[op.index], op.size);
+	    elapsed = ftimer_count_stop() - start;
+	    if (p == NULL)
+		app_error("mm_realloc error in eval_mm_latency");
+	    trace->blocks[op.index] = p;
+	    break;
+
+	case FREE:
+	    p = trace->blocks[op.index];
+	    start = ftimer_count_start();
+	    mm_free(p);
+	    elapsed = ftimer_count_stop() - start;
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_latency");
+	    return;
+	}
+	elapsed = (elapsed > tsc_overhead) ? elapsed - tsc_overhead : 0;
+	hist[op.type][hist_bucket(elapsed)]++;
+	if (elapsed > max[op.type])
+	    max[op.type] = elapsed;
+    }
+
+    for (t = 0; t < 3; t++) {
+	l = &stats->latency[t];
+	l->count = 0;
+	for (b = 0; b < HIST_BUCKETS; b++)
+	    l->count += hist[t][b];
+	l->p50 = hist_percentile(hist[t], l->count, 0.50);
+	l->p99 = hist_percentile(hist[t], l->count, 0.99);
+	l->p999 = hist_percentile(hist[t], l->count, 0.999);
+	l->max = max[t];
+    }
+}
+
+/*
+ * eval_mm_stream - Replay a trace through mm malloc while a reader
+ *     thread decodes it, for traces too long to load, and report the
+ *     throughput and utilization. Only the replay of each chunk is
+ *     timed, so waiting for the reader does not count against mm.c.
+ */
+static void eval_mm_stream(char *path)
+{
+    trace_stream_t *stream;
+    const trace_chunk_t *chunk;
+    const traceop_t *op;
+    char **blocks = NULL;
+    size_t *sizes = NULL;
+    int slots = 0, used = 0;
+    struct timespec start, end, chunk_start, chunk_end;
+    double secs = 0, total_secs, ops = 0, live = 0, peak_live = 0;
+    char *p;
+    int i;
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_stream");
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    stream = trace_stream_open(path);
+    while ((chunk = trace_stream_next(stream)) != NULL) {
+	if (chunk->slots > slots) {
+	    slots = 2 * chunk->slots;
+	    blocks = realloc(blocks, slots * sizeof(char *));
+	    sizes = realloc(sizes, slots * sizeof(size_t));
+	    if (blocks == NULL || sizes == NULL)
+		unix_error("realloc in eval_mm_stream failed");
+	}
+	used = chunk->slots;
+
+	clock_gettime(CLOCK_MONOTONIC, &chunk_start);
+	for (i = 0; i < chunk->count; i++) {
+	    op = &chunk->ops[i];
+	    switch (op->type) {
+	    case ALLOC:
+		if ((p = mm_malloc(op->size)) == NULL)
+		    app_error("mm_malloc error in eval_mm_stream");
+		blocks[op->index] = p;
+		sizes[op->index] = op->size;
+		live += op->size;
+		break;
+
+	    case REALLOC:
+		if ((p = mm_realloc(blocks[op->index], op->size)) == NULL)
+		    app_error("mm_realloc error in eval_mm_stream");
+		blocks[op->index] = p;
+		live += (double)op->size - sizes[op->index];
+		sizes[op->index] = op->size;
+		break;
+
+	    case FREE:
+		mm_free(blocks[op->index]);
+		live -= sizes[op->index];
+		break;
+	    }
+	    if (live > peak_live)
+		peak_live = live;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &chunk_end);
+	secs += (chunk_end.tv_sec - chunk_start.tv_sec) +
+	    (chunk_end.tv_nsec - chunk_start.tv_nsec) / 1e9;
+	ops += chunk->count;
+    }
+    trace_stream_close(stream);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    total_secs = (end.tv_sec - start.tv_sec) +
+	(end.tv_nsec - start.tv_nsec) / 1e9;
+
+    printf("Streamed %s\n", path);
+    printf("%.0f ops in %.3f secs of replay, %.0f Kops/sec\n",
+	   ops, secs, secs > 0 ? ops / secs / 1e3 : 0);
+    printf("util %.0f%%, peak heap %lu KB, %d block slots for the live set\n",
+	   mem_peak_heapsize() ? 100 * peak_live / mem_peak_heapsize() : 0,
+	   (unsigned long)(mem_peak_heapsize() >> 10), used);
+    printf("%.3f secs waiting for the reader, %.3f secs in all\n",
+	   total_secs - secs, total_secs);
+    free(blocks);
+    free(sizes);
+}
+
+/*
+ * add_plugin - run the traces through plugin too
+ */
+static void add_plugin(const mm_plugin_t *plugin)
+{
+    if (num_plugins == MAX_PLUGINS) {
+	sprintf(msg, "At most %d allocators besides mm.c", MAX_PLUGINS);
+	app_error(msg);
+    }
+    plugins[num_plugins++] = plugin;
+}
+
+/*
+ * load_plugin - open the allocator backend in the shared object at
+ *     path, as mmplugin.h describes, and add it
+ */
+static void load_plugin(char *path)
+{
+    const mm_plugin_t *plugin;
+    char file[MAXLINE];
+    void *handle;
+
+    /* dlopen looks for a bare name on the library path, not here */
+    snprintf(file, MAXLINE, "%s%s", strchr(path, '/') ? "" : "./", path);
+    if ((handle = dlopen(file, RTLD_NOW | RTLD_LOCAL | RTLD_DEEPBIND))
+	== NULL) {
+	sprintf(msg, "Could not load %s: %s", path, dlerror());
+	app_error(msg);
+    }
+    if ((plugin = dlsym(handle, MM_PLUGIN_SYMBOL)) == NULL) {
+	sprintf(msg, "%s has no %s", path, MM_PLUGIN_SYMBOL);
+	app_error(msg);
+    }
+    if (plugin->version != MM_PLUGIN_VERSION || plugin->init == NULL ||
+	plugin->malloc == NULL || plugin->free == NULL ||
+	plugin->realloc == NULL) {
+	sprintf(msg, "%s is not a version %d allocator backend", path,
+		MM_PLUGIN_VERSION);
+	app_error(msg);
+    }
+    add_plugin(plugin);
+}
+
+/*
+ * plugin_error - report a failed call into a backend; unlike
+ *     malloc_error, it leaves the mm error count alone
+ */
+static void plugin_error(const mm_plugin_t *plugin, int tracenum, int opnum,
+			 char *call)
+{
+    printf("ERROR [trace %d, line %d]: %s %s failed\n", tracenum,
+	   LINENUM(opnum), plugin->name, call);
+}
+
+/*
+ * free_leftovers - free the blocks a replay left allocated. mm_init
+ *     empties mm.c's heap before each replay, but a backend such as
+ *     libc's may have no way to, and would otherwise carry every
+ *     earlier replay's blocks into the next one.
+ */
+static void free_leftovers(const mm_plugin_t *plugin, trace_t *trace)
+{
+    int i;
+
+    for (i = 0; i < trace->num_ids; i++) {
+	if (trace->blocks[i] != NULL) {
+	    plugin->free(trace->blocks[i]);
+	    trace->blocks[i] = NULL;
+	}
+    }
+}
+
+/*
+ * eval_plugin_trace - Evaluate a backend on one trace, in a child
+ *    process. A backend such as libc's cannot empty its heap, and the
+ *    heap of a process that ran other traces, or other backends, is
+ *    full of their leftovers; the child starts from mdriver's own heap.
+ */
+static void eval_plugin_trace(const mm_plugin_t *plugin, trace_t *trace,
+			      int tracenum, stats_t *stats)
+{
+    speed_t speed_params;
+    int fds[2], status;
+    pid_t pid;
+
+    fflush(stdout);
+    if (pipe(fds) < 0)
+	unix_error("pipe in eval_plugin_trace failed");
+    if ((pid = fork()) < 0)
+	unix_error("fork in eval_plugin_trace failed");
+    if (pid == 0) {
+	close(fds[0]);
+	if (verbose > 1)
+	    printf("Checking %s malloc for correctness, ", plugin->name);
+	stats->valid = eval_plugin_valid(plugin, trace, tracenum, &stats->util);
+	if (stats->valid) {
+	    speed_params.trace = trace;
+	    speed_params.plugin = plugin;
+	    if (verbose > 1)
+		printf("and performance.\n");
+	    stats->secs = time_trace(eval_plugin_speed, &speed_params, stats);
+	}
+	write_all(fds[1], stats, sizeof(stats_t));
+	fflush(stdout);
+	_exit(0);
+    }
+    close(fds[1]);
+    if (!read_all(fds[0], stats, sizeof(stats_t)) ||
+	waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+	WEXITSTATUS(status) != 0) {
+	sprintf(msg, "%s failed on trace %d", plugin->name, tracenum);
+	app_error(msg);
+    }
+    close(fds[0]);
+}
+
+/*
+ * eval_plugin_valid - We run this function to make sure that the
+ *    backend can run to completion on the set of traces, and to find
+ *    its space utilization, if it reports its heap size; else *util
+ *    is 0. We'll be conservative and fail the trace if any call fails.
+ */
+static int eval_plugin_valid(const mm_plugin_t *plugin, trace_t *trace,
+			     int tracenum, double *util)
+{
+    trace_iter_t it;
+    traceop_t op;
+    int i;
+    size_t total_size = 0, max_total_size = 0, heap, max_heap = 0;
+    char *p, *newp, *oldp;
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+    if (plugin->init() < 0) {
+	sprintf(msg, "%s init failed in eval_plugin_valid", plugin->name);
+	app_error(msg);
+    }
+    memset(trace->blocks, 0, trace->num_ids * sizeof(char *));
+    for (trace_start(trace, &it), i = 0; trace_next(&it, &op); i++) {
+        switch (op.type) {
 
         case ALLOC: /* malloc */
-	    if ((p = malloc(trace->ops[i].size)) == NULL) {
-		malloc_error(tracenum, i, "libc malloc failed");
-		unix_error("System message");
+	    if ((p = plugin->malloc(op.size)) == NULL) {
+		plugin_error(plugin, tracenum, i, "malloc");
+		return 0;
 	    }
-	    trace->blocks[trace->ops[i].index] = p;
+	    trace->blocks[op.index] = p;
+	    trace->block_sizes[op.index] = op.size;
+	    total_size += op.size;
 	    break;
 
 	case REALLOC: /* realloc */
-            newsize = trace->ops[i].size;
-	    oldp = trace->blocks[trace->ops[i].index];
-	    if ((newp = realloc(oldp, newsize)) == NULL) {
-		malloc_error(tracenum, i, "libc realloc failed");
-		unix_error("System message");
+	    oldp = trace->blocks[op.index];
+	    if ((newp = plugin->realloc(oldp, op.size)) == NULL) {
+		plugin_error(plugin, tracenum, i, "realloc");
+		return 0;
 	    }
-	    trace->blocks[trace->ops[i].index] = newp;
+	    trace->blocks[op.index] = newp;
+	    total_size += op.size - trace->block_sizes[op.index];
+	    trace->block_sizes[op.index] = op.size;
 	    break;
 	    
         case FREE: /* free */
-	    free(trace->blocks[trace->ops[i].index]);
+	    plugin->free(trace->blocks[op.index]);
+	    trace->blocks[op.index] = NULL;
+	    total_size -= trace->block_sizes[op.index];
 	    break;
 
 	default:
-	    app_error("invalid operation type  in eval_libc_valid");
+	    app_error("invalid operation type  in eval_plugin_valid");
 	}
+
+	/* Heap size is taken at every request, since a backend may
+	   give memory back as blocks are freed */
+	if (total_size > max_total_size)
+	    max_total_size = total_size;
+	if (plugin->heapsize != NULL && (heap = plugin->heapsize()) > max_heap)
+	    max_heap = heap;
     }
 
+    *util = (max_heap > 0) ? (double)max_total_size / max_heap : 0;
+    free_leftovers(plugin, trace);
     return 1;
 }
 
 /* 
- * eval_libc_speed - This is the function that is used by fcyc() to
- *    measure the running time of the libc malloc package on the set
+ * eval_plugin_speed - This is the function that is used by fcyc() to
+ *    measure the running time of an allocator backend on the set
  *    of traces.
  */
-static void eval_libc_speed(void *ptr)
+static void eval_plugin_speed(void *ptr)
 {
-    int i;
-    int index, size, newsize;
-    char *p, *newp, *oldp, *block;
+    trace_iter_t it;
+    traceop_t op;
+    char *p, *newp;
     trace_t *trace = ((speed_t *)ptr)->trace;
+    const mm_plugin_t *plugin = ((speed_t *)ptr)->plugin;
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+    if (plugin->init() < 0)
+	app_error("init failed in eval_plugin_speed");
+    for (trace_start(trace, &it); trace_next(&it, &op); ) {
+        switch (op.type) {
         case ALLOC: /* malloc */
-	    index = trace->ops[i].index;
-	    size = trace->ops[i].size;
-	    if ((p = malloc(size)) == NULL)
-		unix_error("malloc failed in eval_libc_speed");
-	    trace->blocks[index] = p;
+	    if ((p = plugin->malloc(op.size)) == NULL)
+		app_error("malloc failed in eval_plugin_speed");
+	    trace->blocks[op.index] = p;
 	    break;
 
 	case REALLOC: /* realloc */
-	    index = trace->ops[i].index;
-	    newsize = trace->ops[i].size;
-	    oldp = trace->blocks[index];
-	    if ((newp = realloc(oldp, newsize)) == NULL)
-		unix_error("realloc failed in eval_libc_speed\n");
-	    
-	    trace->blocks[index] = newp;
+	    if ((newp = plugin->realloc(trace->blocks[op.index], op.size))
+		== NULL)
+		app_error("realloc failed in eval_plugin_speed");
+	    trace->blocks[op.index] = newp;
 	    break;
 	    
         case FREE: /* free */
-	    index = trace->ops[i].index;
-	    block = trace->blocks[index];
-	    free(block);
+	    plugin->free(trace->blocks[op.index]);
+	    trace->blocks[op.index] = NULL;
+	    break;
+	}
+    }
+    free_leftovers(plugin, trace);
+}
+
+/*****************************************************************
+ * The following routines write the results in a form other programs
+ * can read (-o), and compare them with results written earlier (-B)
+ ****************************************************************/
+
+/*
+ * field_value, set_field_value - one numeric field of stats, as a double
+ */
+static double field_value(const stats_t *stats, const field_t *f, int i)
+{
+    const char *p = (const char *)stats + f->offset;
+
+    if (f->kind == FIELD_INT)
+	return *(const int *)p;
+    return ((const double *)p)[i];
+}
+
+static void set_field_value(stats_t *stats, const field_t *f, double v)
+{
+    char *p = (char *)stats + f->offset;
+
+    if (f->kind == FIELD_INT)
+	*(int *)p = (int)v;
+    else if (f->kind == FIELD_DOUBLE)
+	*(double *)p = v;
+}
+
+/*
+ * json_string - write s as a JSON string
+ */
+static void json_string(FILE *fp, const char *s)
+{
+    fputc('"', fp);
+    for (; *s; s++) {
+	if (*s == '"' || *s == '\\')
+	    fprintf(fp, "\\%c", *s);
+	else if ((unsigned char)*s < 0x20)
+	    fprintf(fp, "\\u%04x", *s);
+	else
+	    fputc(*s, fp);
+    }
+    fputc('"', fp);
+}
+
+/*
+ * json_number - write v as a JSON number; JSON has no infinities or NaNs
+ */
+static void json_number(FILE *fp, double v)
+{
+    if (isfinite(v))
+	fprintf(fp, "%.9g", v);
+    else
+	fprintf(fp, "null");
+}
+
+/*
+ * cpu_model - the processor's name, as /proc/cpuinfo gives it
+ */
+static void cpu_model(char *buf, size_t len)
+{
+    char line[MAXLINE], *colon;
+    FILE *fp;
+
+    snprintf(buf, len, "unknown");
+    if ((fp = fopen("/proc/cpuinfo", "r")) == NULL)
+	return;
+    while (fgets(line, MAXLINE, fp) != NULL) {
+	if (strncmp(line, "model name", 10) != 0 || 
+	    (colon = strchr(line, ':')) == NULL)
+	    continue;
+	colon += strspn(colon + 1, " \t") + 1;
+	colon[strcspn(colon, "\n")] = '\0';
+	snprintf(buf, len, "%s", colon);
+	break;
+    }
+    fclose(fp);
+}
+
+/*
+ * metadata - describe the build, the machine and the run as key/value
+ *     pairs, handing each to emit
+ */
+static void metadata(runinfo_t *run, FILE *fp,
+		     void (*emit)(FILE *, const char *, const char *, int))
+{
+    char buf[MAXLINE], args[MAXLINE];
+    struct utsname u;
+    time_t now;
+    int i;
+
+    emit(fp, "compiler", __VERSION__, 0);
+    snprintf(buf, MAXLINE, "%d", (int)sizeof(void *) * 8);
+    emit(fp, "bits", buf, 1);
+#ifdef __OPTIMIZE__
+    emit(fp, "optimized", "1", 1);
+#else
+    emit(fp, "optimized", "0", 1);
+#endif
+#ifdef MM_THREADSAFE
+    emit(fp, "threadsafe", "1", 1);
+#else
+    emit(fp, "threadsafe", "0", 1);
+#endif
+    emit(fp, "built", __DATE__ " " __TIME__, 0);
+
+    if (uname(&u) == 0) {
+	emit(fp, "host", u.nodename, 0);
+	snprintf(buf, MAXLINE, "%s %s", u.sysname, u.release);
+	emit(fp, "os", buf, 0);
+	emit(fp, "arch", u.machine, 0);
+    }
+    cpu_model(buf, MAXLINE);
+    emit(fp, "cpu", buf, 0);
+    snprintf(buf, MAXLINE, "%ld", sysconf(_SC_NPROCESSORS_ONLN));
+    emit(fp, "cpus", buf, 1);
+    emit(fp, "counter", ftimer_counter_name(), 0);
+    snprintf(buf, MAXLINE, "%.1f", ftimer_counter_init() / 1e6);
+    emit(fp, "counter_mhz", buf, 1);
+
+    now = time(NULL);
+    strftime(buf, MAXLINE, "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+    emit(fp, "date", buf, 0);
+    args[0] = '\0';
+    for (i = 0; i < run->argc; i++)
+	snprintf(args + strlen(args), MAXLINE - strlen(args), "%s%s",
+		 i ? " " : "", run->argv[i]);
+    emit(fp, "args", args, 0);
+    emit(fp, "tracedir", tracedir, 0);
+    snprintf(buf, MAXLINE, "%d", run->jobs);
+    emit(fp, "jobs", buf, 1);
+    emit(fp, "commit", mem_commit_name(run->commit), 0);
+    snprintf(buf, MAXLINE, "%d", errors);
+    emit(fp, "errors", buf, 1);
+    snprintf(buf, MAXLINE, "%d", run->correct);
+    emit(fp, "correct", buf, 1);
+    snprintf(buf, MAXLINE, "%.0f", run->perfindex);
+    emit(fp, "perfidx", buf, 1);
+}
+
+static void emit_json(FILE *fp, const char *key, const char *value, int number)
+{
+    fprintf(fp, "  ");
+    json_string(fp, key);
+    fprintf(fp, ": ");
+    if (number)
+	fprintf(fp, "%s", value);
+    else
+	json_string(fp, value);
+    fprintf(fp, ",\n");
+}
+
+/* Strings are quoted as CSV quotes a field, doubling any '"' */
+static void emit_csv(FILE *fp, const char *key, const char *value, int number)
+{
+    fprintf(fp, "# %s: ", key);
+    if (number) {
+	fprintf(fp, "%s\n", value);
+	return;
+    }
+    putc('"', fp);
+    for (; *value; value++) {
+	if (*value == '"')
+	    putc('"', fp);
+	putc(*value, fp);
+    }
+    fprintf(fp, "\"\n");
+}
+
+/*
+ * write_json - the results as one JSON object, each trace on a line
+ */
+static void write_json(FILE *fp, runinfo_t *run, int n, stats_t *stats)
+{
+    const field_t *f;
+    int i, j, t;
+
+    fprintf(fp, "{\n");
+    metadata(run, fp, emit_json);
+    fprintf(fp, "  \"traces\": [\n");
+    for (i = 0; i < n; i++) {
+	fprintf(fp, "    {\"name\": ");
+	json_string(fp, run->tracefiles[i]);
+	for (f = stats_fields; f->name != NULL; f++) {
+	    fprintf(fp, ", \"%s\": ", f->name);
+	    if (f->kind != FIELD_CURVE) {
+		json_number(fp, field_value(&stats[i], f, 0));
+		continue;
+	    }
+	    for (j = 0; j < CURVE_POINTS; j++) {
+		fprintf(fp, j ? ", " : "[");
+		json_number(fp, field_value(&stats[i], f, j));
+	    }
+	    fprintf(fp, "]");
+	}
+	if (stats[i].thread != NULL) {
+	    fprintf(fp, ", \"thread\": [");
+	    for (t = 0; t < stats[i].threads; t++)
+		fprintf(fp, "%s{\"ops\": %.0f, \"secs\": %.9g, \"waits\": %.0f}",
+			t ? ", " : "", stats[i].thread[t].ops,
+			stats[i].thread[t].secs, stats[i].thread[t].waits);
+	    fprintf(fp, "]");
+	}
+	fprintf(fp, "}%s\n", (i < n - 1) ? "," : "");
+    }
+    fprintf(fp, "  ]\n}\n");
+}
+
+/*
+ * write_csv - the results as '#' metadata lines, a header and a row
+ *     per trace; a curve takes a column per point
+ */
+static void write_csv(FILE *fp, runinfo_t *run, int n, stats_t *stats)
+{
+    const field_t *f;
+    int i, j;
+
+    metadata(run, fp, emit_csv);
+    fprintf(fp, "name");
+    for (f = stats_fields; f->name != NULL; f++) {
+	if (f->kind != FIELD_CURVE)
+	    fprintf(fp, ",%s", f->name);
+	else
+	    for (j = 0; j < CURVE_POINTS; j++)
+		fprintf(fp, ",%s%d", f->name, j);
+    }
+    fprintf(fp, "\n");
+    for (i = 0; i < n; i++) {
+	fprintf(fp, "%s", run->tracefiles[i]);
+	for (f = stats_fields; f->name != NULL; f++)
+	    for (j = 0; j < (f->kind == FIELD_CURVE ? CURVE_POINTS : 1); j++)
+		fprintf(fp, ",%.9g", field_value(&stats[i], f, j));
+	fprintf(fp, "\n");
+    }
+}
+
+/*
+ * write_results - write the mm results to path, as CSV if its name
+ *     ends in .csv and as JSON otherwise
+ */
+static void write_results(char *path, runinfo_t *run, int n, stats_t *stats)
+{
+    size_t len = strlen(path);
+    FILE *fp;
+
+    if ((fp = fopen(path, "w")) == NULL) {
+	sprintf(msg, "Could not open %s for the results", path);
+	unix_error(msg);
+    }
+    if (len > 4 && !strcmp(path + len - 4, ".csv"))
+	write_csv(fp, run, n, stats);
+    else
+	write_json(fp, run, n, stats);
+    if (fclose(fp) != 0) {
+	sprintf(msg, "Could not write the results to %s", path);
+	unix_error(msg);
+    }
+}
+
+/*
+ * find_field - the stats_fields entry called name, or NULL
+ */
+static const field_t *find_field(const char *name)
+{
+    const field_t *f;
+
+    for (f = stats_fields; f->name != NULL; f++)
+	if (!strcmp(f->name, name))
+	    return f;
+    return NULL;
+}
+
+/*
+ * parse_json_trace - fill in b from one trace line of a write_json
+ *     file; returns 0 if the line holds no trace
+ */
+static int parse_json_trace(char *line, baseline_t *b)
+{
+    const field_t *f;
+    char *p, *key, *end;
+
+    if ((p = strstr(line, "{\"name\": \"")) == NULL)
+	return 0;
+    if ((end = strstr(p, ", \"thread\": [")) != NULL)
+	*end = '\0'; /* its keys are not stats_t's */
+    p += strlen("{\"name\": \"");
+    if ((end = strchr(p, '"')) == NULL)
+	return 0;
+    *end = '\0';
+    snprintf(b->name, MAXLINE, "%s", p);
+    p = end + 1;
+
+    /* Then ", "key": value" pairs */
+    while ((key = strstr(p, ", \"")) != NULL) {
+	key += 3;
+	if ((end = strchr(key, '"')) == NULL)
 	    break;
+	*end = '\0';
+	p = end + 1;
+	if (strncmp(p, ": ", 2) == 0 && (f = find_field(key)) != NULL)
+	    set_field_value(&b->stats, f, strtod(p + 2, NULL));
+    }
+    return 1;
+}
+
+/*
+ * parse_csv_trace - fill in b from one row of a write_csv file, whose
+ *     header line was header
+ */
+static void parse_csv_trace(char *header, char *line, baseline_t *b)
+{
+    char *name, *value, *hsave, *lsave;
+    const field_t *f;
+
+    name = strtok_r(header, ",\n", &hsave);
+    value = strtok_r(line, ",\n", &lsave);
+    if (name == NULL || value == NULL)
+	return;
+    snprintf(b->name, MAXLINE, "%s", value);
+    while ((name = strtok_r(NULL, ",\n", &hsave)) != NULL &&
+	   (value = strtok_r(NULL, ",\n", &lsave)) != NULL)
+	if ((f = find_field(name)) != NULL)
+	    set_field_value(&b->stats, f, strtod(value, NULL));
+}
+
+/*
+ * read_baseline - the traces of a results file written by -o, in
+ *     either format; sets *np to their number
+ */
+static baseline_t *read_baseline(char *path, int *np)
+{
+    char line[4 * MAXLINE], header[4 * MAXLINE], copy[4 * MAXLINE];
+    baseline_t *base = NULL;
+    int n = 0, csv = 0;
+    FILE *fp;
+
+    if ((fp = fopen(path, "r")) == NULL) {
+	sprintf(msg, "Could not open baseline %s", path);
+	unix_error(msg);
+    }
+    header[0] = '\0';
+    while (fgets(line, sizeof(line), fp) != NULL) {
+	if (line[0] == '#')
+	    continue;
+	if (!strncmp(line, "name,", 5)) {
+	    snprintf(header, sizeof(header), "%s", line);
+	    csv = 1;
+	    continue;
+	}
+	if ((base = realloc(base, (n + 1) * sizeof(baseline_t))) == NULL)
+	    unix_error("realloc in read_baseline failed");
+	memset(&base[n], 0, sizeof(baseline_t));
+	if (csv) {
+	    strcpy(copy, header); /* strtok_r takes it apart */
+	    parse_csv_trace(copy, line, &base[n]);
+	    n++;
+	}
+	else if (parse_json_trace(line, &base[n]))
+	    n++;
+    }
+    fclose(fp);
+    *np = n;
+    return base;
+}
+
+/*
+ * throughput_range - Kops of a trace, and the range its 95% interval
+ *     of the median time allows; returns 0 if there is no interval
+ */
+static int throughput_range(stats_t *s, double *kops, double *lo, double *hi)
+{
+    *kops = (s->secs > 0) ? s->ops / 1e3 / s->secs : 0;
+    if (s->timing.samples == 0 || s->timing.ci_lo <= 0)
+	return 0;
+    *lo = s->ops / 1e3 / s->timing.ci_hi;
+    *hi = s->ops / 1e3 / s->timing.ci_lo;
+    return 1;
+}
+
+/*
+ * compare_baseline - print how each trace's throughput and utilization
+ *     moved against the baseline, and return the number of traces that
+ *     fell by more than threshold (a fraction of the baseline Kops, or
+ *     of 100% util) or stopped being valid. A Kops drop only counts
+ *     when the confidence intervals show it is no noise; without them
+ *     (either run lacks -A) it is flagged but does not fail
+ */
+static int compare_baseline(char *path, double threshold, runinfo_t *run,
+			    int n, stats_t *stats)
+{
+    baseline_t *base;
+    stats_t *b;
+    double kops, lo, hi, base_kops, base_lo, base_hi, dkops, dutil;
+    int num_base, i, j, ranges, regressed = 0, unconfirmed = 0;
+    const char *sig, *verdict;
+
+    base = read_baseline(path, &num_base);
+    printf("\nAgainst baseline %s, failing on a %.1f%% drop\n"
+	   "(sig: yes if the 95%% intervals of the median times are apart;\n"
+	   "- if either run lacks them, see -A, and Kops drops only warn):\n",
+	   path, threshold * 100);
+    printf("%5s%10s%10s%8s%4s%7s%7s%7s\n", "trace", "Kops", "base",
+	   "delta", "sig", "util", "base", "delta");
+    for (i = 0; i < n; i++) {
+	for (j = 0; j < num_base; j++)
+	    if (!strcmp(base[j].name, run->tracefiles[i]))
+		break;
+	if (j == num_base) {
+	    printf("%2d  %s is not in the baseline\n", i, run->tracefiles[i]);
+	    continue;
 	}
+	b = &base[j].stats;
+	if (!stats[i].valid || !b->valid) {
+	    verdict = (b->valid && !stats[i].valid) ? "REGRESSED" : "";
+	    printf("%2d  valid %s, baseline %s%s%s\n", i,
+		   stats[i].valid ? "yes" : "no", b->valid ? "yes" : "no",
+		   *verdict ? "  " : "", verdict);
+	    regressed += (*verdict != '\0');
+	    continue;
+	}
+
+	ranges = throughput_range(&stats[i], &kops, &lo, &hi);
+	ranges &= throughput_range(b, &base_kops, &base_lo, &base_hi);
+	if (!ranges)
+	    sig = "-";
+	else if (lo > base_hi || hi < base_lo)
+	    sig = "yes";
+	else
+	    sig = "no";
+	dkops = (base_kops > 0) ? kops / base_kops - 1 : 0;
+	dutil = stats[i].util - b->util; /* deterministic: no noise */
+
+	/* A drop inside the noise is no regression, however large, and
+	   one of unknown noise is only reported */
+	verdict = "";
+	if ((dkops < -threshold && !strcmp(sig, "yes")) ||
+	    dutil < -threshold)
+	    verdict = "REGRESSED";
+	else if (dkops < -threshold && !strcmp(sig, "-"))
+	    verdict = "slower?";
+	regressed += !strcmp(verdict, "REGRESSED");
+	unconfirmed += !strcmp(verdict, "slower?");
+	printf("%2d%13.0f%10.0f%+7.1f%%%4s%6.1f%%%6.1f%%%+6.1f%%%s%s\n", i,
+	       kops, base_kops, dkops * 100, sig, stats[i].util * 100,
+	       b->util * 100, dutil * 100, *verdict ? "  " : "", verdict);
     }
+    free(base);
+    if (unconfirmed)
+	printf("%d trace%s slower than %s, unconfirmed without -A; "
+	       "not failing\n", unconfirmed, (unconfirmed == 1) ? "" : "s",
+	       path);
+    if (regressed)
+	printf("%d trace%s regressed against %s\n", regressed,
+	       (regressed == 1) ? "" : "s", path);
+    return regressed;
 }
 
 /*************************************
@@ -920,7 +2972,9 @@ static void eval_libc_speed(void *ptr)
  */
 static void printresults(int n, stats_t *stats) 
 {
-    int i;
+    static const char *op_names[3] = {"malloc", "free", "realloc"};
+    latency_t *l;
+    int i, t;
     double secs = 0;
     double ops = 0;
     double util = 0;
@@ -970,6 +3024,292 @@ static void printresults(int n, stats_t *stats)
 	       "-");
     }
 
+    /* Then how the times were measured, if adaptively */
+    if (adaptive_timing) {
+	printf("\nMedian time per run in usecs, with its 95%% confidence "
+	       "interval\n(* = time budget ran out first):\n");
+	printf("%5s%11s%11s%11s%7s%8s%6s%8s\n", "trace", "median", "ci low",
+	       "ci high", "cv", "samples", "runs", "dropped");
+	for (i = 0; i < n; i++) {
+	    if (!stats[i].valid)
+		continue;
+	    printf("%2d%14.3f%11.3f%11.3f%6.1f%%%8d%6d%8d%s\n", i,
+		   stats[i].timing.median * 1e6, stats[i].timing.ci_lo * 1e6,
+		   stats[i].timing.ci_hi * 1e6, stats[i].timing.cv * 100,
+		   stats[i].timing.samples, stats[i].timing.reps,
+		   stats[i].timing.rejected,
+		   stats[i].timing.converged ? "" : " *");
+	}
+    }
+
+    /* Then the latency of each request type, where it was measured */
+    for (i = 0; i < n; i++)
+	if (stats[i].latency[ALLOC].count + stats[i].latency[FREE].count +
+	    stats[i].latency[REALLOC].count > 0)
+	    break;
+    if (i == n)
+	return;
+    printf("\nLatency in ns on the %s, less %.0f for the timer:\n",
+	   ftimer_counter_name(), tsc_overhead * tick_ns);
+    printf("%5s%9s%9s%8s%8s%8s%10s\n", "trace", "op", "count", "p50",
+	   "p99", "p99.9", "max");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid)
+	    continue;
+	for (t = 0; t < 3; t++) {
+	    l = &stats[i].latency[t];
+	    if (l->count == 0)
+		continue;
+	    printf("%2d%12s%9.0f%8.0f%8.0f%8.0f%10.0f\n", i, op_names[t],
+		   l->count, l->p50 * tick_ns, l->p99 * tick_ns,
+		   l->p999 * tick_ns, l->max * tick_ns);
+	}
+    }
+}
+
+/* 
+ * printhints - prints mm utilization without and with lifetime hints
+ */
+static void printhints(int n, stats_t *stats)
+{
+    int i;
+    double util = 0, hint_util = 0;
+
+    printf("%5s%7s%7s%7s\n", "trace", "util", "hinted", "gain");
+    for (i = 0; i < n; i++) {
+	if (stats[i].valid) {
+	    printf("%2d%9.0f%%%6.0f%%%+6.1f%%\n",
+		   i,
+		   stats[i].util*100.0,
+		   stats[i].hint_util*100.0,
+		   (stats[i].hint_util - stats[i].util)*100.0);
+	    util += stats[i].util;
+	    hint_util += stats[i].hint_util;
+	}
+	else
+	    printf("%2d%10s%7s%7s\n", i, "-", "-", "-");
+    }
+    printf("%5s%6.0f%%%6.0f%%%+6.1f%%\n", "Total",
+	   (util/n)*100.0, (hint_util/n)*100.0, (hint_util - util)/n*100.0);
+}
+
+/* 
+ * printhandles - prints mean and peak heap size of the handle replays
+ *     without and with compaction, and with -v how the heap evolved
+ */
+static void printhandles(int n, stats_t *stats)
+{
+    int i, j, k;
+    heapcurve_t *c;
+
+    printf("%5s%9s%9s%9s%9s%9s%9s\n", "trace", "mean KB", "compact",
+	   "peak KB", "compact", "p99 us", "max us");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid) {
+	    printf("%2d%12s%9s%9s%9s%9s%9s\n", i, "-", "-", "-", "-", "-", "-");
+	    continue;
+	}
+	c = stats[i].handles;
+	printf("%2d%12.0f%9.0f%9.0f%9.0f%9.1f%9.1f\n", i,
+	       c[0].mean_heap / 1024, c[1].mean_heap / 1024,
+	       c[0].peak_heap / 1024, c[1].peak_heap / 1024,
+	       c[1].p99_pause * 1e6, c[1].max_pause * 1e6);
+	for (k = 0; verbose && k < 2; k++) {
+	    printf("%14s", k ? "compact KB:" : "heap KB:");
+	    for (j = 0; j < CURVE_POINTS; j++)
+		printf("%7.0f", c[k].curve[j] / 1024);
+	    printf("\n");
+	}
+    }
+}
+
+/* 
+ * printrealloc - prints how fast mm_realloc moved payloads, for the
+ *     traces that realloc at all
+ */
+static void printrealloc(int n, stats_t *stats)
+{
+    int i;
+    double reallocs = 0, bytes = 0, secs = 0;
+
+    printf("%5s%10s%10s%10s\n", "trace", "reallocs", "MB kept", "MB/sec");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid || stats[i].reallocs == 0)
+	    continue;
+	printf("%2d%13.0f%10.1f%10.0f\n", i, stats[i].reallocs,
+	       stats[i].realloc_bytes / 1e6,
+	       stats[i].realloc_bytes / 1e6 / stats[i].realloc_secs);
+	reallocs += stats[i].reallocs;
+	bytes += stats[i].realloc_bytes;
+	secs += stats[i].realloc_secs;
+    }
+    if (reallocs > 0)
+	printf("%5s%10.0f%10.1f%10.0f\n", "Total", reallocs, bytes / 1e6,
+	       bytes / 1e6 / secs);
+}
+
+/* 
+ * printheap - the most heap any trace had committed, and resident,
+ *     once its timed runs were over
+ */
+static void printheap(int n, stats_t *stats, int commit)
+{
+    double committed = 0, resident = 0;
+    int i;
+
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid)
+	    continue;
+	if (stats[i].committed > committed)
+	    committed = stats[i].committed;
+	if (stats[i].resident > resident)
+	    resident = stats[i].resident;
+    }
+    printf("Heap: %.0f KB committed, %.0f KB resident (%s)\n",
+	   committed / 1024, resident / 1024, mem_commit_name(commit));
+}
+
+/*
+ * printrss - prints peak and mean resident heap size under first-fit
+ *     and page-aware placement, next to the peak heap size
+ */
+static void printrss(int n, stats_t *stats)
+{
+    int i;
+    rss_t *r;
+    double total[5] = {0, 0, 0, 0, 0};
+
+    printf("%5s%9s%9s%9s%9s%9s\n", "trace", "heap", "peak", "aware",
+	   "mean", "aware");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid) {
+	    printf("%2d%12s%9s%9s%9s%9s\n", i, "-", "-", "-", "-", "-");
+	    continue;
+	}
+	r = stats[i].rss;
+	printf("%2d%12.0f%9.0f%9.0f%9.0f%9.0f\n", i, r[0].peak_heap / 1024,
+	       r[0].peak_rss / 1024, r[1].peak_rss / 1024,
+	       r[0].mean_rss / 1024, r[1].mean_rss / 1024);
+	total[0] += r[0].peak_heap;
+	total[1] += r[0].peak_rss;
+	total[2] += r[1].peak_rss;
+	total[3] += r[0].mean_rss;
+	total[4] += r[1].mean_rss;
+    }
+    printf("%5s%9.0f%9.0f%9.0f%9.0f%9.0f\n", "Total", total[0] / 1024,
+	   total[1] / 1024, total[2] / 1024, total[3] / 1024, total[4] / 1024);
+}
+
+/* 
+ * printasync - prints the mean time the caller spends in mm_free and the
+ *     replay throughput, with frees inline and through the reclaimer
+ */
+static void printasync(int n, stats_t *stats)
+{
+    int i;
+    freecost_t *c;
+    double frees = 0, ops = 0;
+    double total[4] = {0, 0, 0, 0};
+
+    printf("%5s%9s%10s%10s%10s%10s\n", "trace", "frees", "free ns",
+	   "queued", "Kops", "queued");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid || stats[i].frees == 0)
+	    continue;
+	c = stats[i].freecost;
+	printf("%2d%12.0f%10.1f%10.1f%10.0f%10.0f\n", i, stats[i].frees,
+	       c[0].free_secs / stats[i].frees * 1e9,
+	       c[1].free_secs / stats[i].frees * 1e9,
+	       stats[i].ops / c[0].total_secs / 1e3,
+	       stats[i].ops / c[1].total_secs / 1e3);
+	frees += stats[i].frees;
+	ops += stats[i].ops;
+	total[0] += c[0].free_secs;
+	total[1] += c[1].free_secs;
+	total[2] += c[0].total_secs;
+	total[3] += c[1].total_secs;
+    }
+    if (frees > 0)
+	printf("%5s%9.0f%10.1f%10.1f%10.0f%10.0f\n", "Total", frees,
+	       total[0] / frees * 1e9, total[1] / frees * 1e9,
+	       ops / total[2] / 1e3, ops / total[3] / 1e3);
+}
+
+/* 
+ * printthreads - prints each replay thread's throughput and how often
+ *     it waited for another, then the aggregate over the wall time
+ */
+static void printthreads(int n, stats_t *stats)
+{
+    int i, t;
+    threadstat_t *s;
+
+    printf("%5s%7s%10s%10s%10s%9s\n", "trace", "thread", "ops", "secs",
+	   "Kops", "waits");
+    for (i = 0; i < n; i++) {
+	if (!stats[i].valid || stats[i].thread == NULL)
+	    continue;
+	for (t = 0; t < stats[i].threads; t++) {
+	    s = &stats[i].thread[t];
+	    printf("%2d%10d%10.0f%10.6f%10.0f%9.0f\n", i, t, s->ops, s->secs,
+		   s->secs > 0 ? s->ops / s->secs / 1e3 : 0, s->waits);
+	}
+	printf("%2d%10s%10.0f%10.6f%10.0f  heap %s\n", i, "all",
+	       stats[i].ops, stats[i].thread_secs,
+	       stats[i].ops / stats[i].thread_secs / 1e3,
+	       stats[i].thread_heap_ok ? "ok" : "CORRUPT");
+    }
+}
+
+/* 
+ * printplugins - prints the util and Kops of mm.c and of each other
+ *     allocator side by side, with - for a util the allocator can't give
+ */
+static void printplugins(int n, stats_t *mm_stats, stats_t **plugin_stats)
+{
+    int i, p, has_util;
+    stats_t *s;
+    double util[MAX_PLUGINS + 1], ops[MAX_PLUGINS + 1], secs[MAX_PLUGINS + 1];
+
+    printf("%5s%16s", "trace", "mm.c");
+    for (p = 0; p < num_plugins; p++)
+	printf("%16.15s", plugins[p]->name);
+    printf("\n");
+    memset(util, 0, sizeof(util));
+    memset(ops, 0, sizeof(ops));
+    memset(secs, 0, sizeof(secs));
+    for (i = 0; i < n; i++) {
+	printf("%2d   ", i);
+	for (p = 0; p <= num_plugins; p++) {
+	    s = (p == 0) ? &mm_stats[i] : &plugin_stats[p - 1][i];
+	    has_util = (p == 0) || plugins[p - 1]->heapsize != NULL;
+	    if (!s->valid) {
+		printf("%7s%9s", "-", "-");
+		continue;
+	    }
+	    if (has_util)
+		printf("%6.0f%%", s->util * 100);
+	    else
+		printf("%7s", "-");
+	    printf("%9.0f", (s->ops / 1e3) / s->secs);
+	    util[p] += s->util;
+	    ops[p] += s->ops;
+	    secs[p] += s->secs;
+	}
+	printf("\n");
+    }
+
+    /* The aggregate results, over the valid traces */
+    printf("Total");
+    for (p = 0; p <= num_plugins; p++) {
+	has_util = (p == 0) || plugins[p - 1]->heapsize != NULL;
+	if (has_util)
+	    printf("%6.0f%%", util[p] / n * 100);
+	else
+	    printf("%7s", "-");
+	printf("%9.0f", secs[p] > 0 ? (ops[p] / 1e3) / secs[p] : 0);
+    }
+    printf("\n");
 }
 
 /* 
@@ -999,19 +3339,163 @@ void malloc_error(int tracenum, int opnum, char *msg)
     printf("ERROR [trace %d, line %d]: %s\n", tracenum, LINENUM(opnum), msg);
 }
 
+/* 
+ * parse_size - Convert a byte count with an optional K, M or G suffix,
+ *     and nothing after it
+ */
+static size_t parse_size(char *str)
+{
+    char *end;
+    size_t size;
+    int shift = 0;
+
+    errno = 0;
+    size = strtoul(str, &end, 0);
+    switch (*end) {
+    case 'G': case 'g':
+	shift += 10;
+	/* fall through */
+    case 'M': case 'm':
+	shift += 10;
+	/* fall through */
+    case 'K': case 'k':
+	shift += 10;
+	end++;
+    }
+    if (end == str || *end != '\0' || strchr(str, '-') != NULL ||
+	errno == ERANGE || size > (SIZE_MAX >> shift) || size == 0) {
+	fprintf(stderr, "Bad size %s: want a positive byte count with an "
+		"optional K, M or G\n", str);
+	exit(1);
+    }
+    return size << shift;
+}
+
+/* 
+ * parse_check - Interpret the -C argument: off, sampled, or
+ *     periodic/parallel with an optional ",N" period in operations
+ */
+static void parse_check(char *str)
+{
+    char *comma = strchr(str, ',');
+
+    if (comma != NULL) {
+	*comma = '\0';
+	if ((check_period = strtoul(comma + 1, NULL, 0)) == 0)
+	    app_error("Heap check period must be positive");
+    }
+    if (!strcmp(str, "off"))
+	check_level = MM_CHECK_OFF;
+    else if (!strcmp(str, "sampled"))
+	check_level = MM_CHECK_SAMPLED;
+    else if (!strcmp(str, "periodic"))
+	check_level = MM_CHECK_PERIODIC;
+    else if (!strcmp(str, "parallel"))
+	check_level = MM_CHECK_PARALLEL;
+    else {
+	usage();
+	exit(1);
+    }
+}
+
+/* 
+ * parse_adaptive - the -A argument: <pct>[,<secs>], the target width
+ *     of the confidence interval as a percentage of the median, and
+ *     optionally the time budget per trace
+ */
+static void parse_adaptive(char *str)
+{
+    char *comma = strchr(str, ',');
+    double width, budget = 2.0;
+
+    if (comma != NULL) {
+	*comma = '\0';
+	if ((budget = atof(comma + 1)) <= 0)
+	    app_error("Timing budget must be positive");
+    }
+    if ((width = atof(str)) <= 0)
+	app_error("Confidence interval width must be positive");
+    set_fsecs_adaptive(width / 100, budget);
+    adaptive_timing = 1;
+}
+
+/*
+ * parse_baseline - the -B argument: <file>[,<pct>], the results to
+ *     compare with and the drop, in percent, that fails the run
+ */
+static void parse_baseline(char *str)
+{
+    char *comma = strrchr(str, ','), *end;
+    double pct;
+
+    baseline_file = str;
+    if (comma == NULL)
+	return;
+    pct = strtod(comma + 1, &end);
+    if (end == comma + 1 || *end != '\0')
+	return; /* a comma in the file name */
+    if (pct <= 0)
+	app_error("Baseline threshold must be positive");
+    *comma = '\0';
+    baseline_threshold = pct / 100;
+}
+
+/*
+ * time_trace - the running time of f on a trace, in seconds, measured
+ *     as -A asks
+ */
+static double time_trace(fsecs_test_funct f, speed_t *params, stats_t *stats)
+{
+    if (adaptive_timing)
+	return fsecs_adaptive(f, params, &stats->timing);
+    return fsecs(f, params);
+}
+
 /* 
  * usage - Explain the command line arguments
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValHLRST] [-f <file>] [-t <dir>] "
+	    "[-j <jobs>] [-s <file>] [-c <commit>] [-m <size>] [-C <level>[,N]] "
+	    "[-K <bytes>] [-Q <depth>] [-A <pct>[,<secs>]] [-o <file>]\n"
+	    "\t[-B <file>[,<pct>]] [-P <file>]...\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-A <pct>   Time each trace until the 95%% confidence interval\n"
+	    "\t           of its median is <pct>%% wide, or [,<secs>] (default 2)\n"
+	    "\t           have gone by.\n");
+    fprintf(stderr, "\t-B <file>  Compare with results from -o; exit 2 if a trace's\n"
+	    "\t           Kops or util drops more than [,<pct>] (default 5).\n"
+	    "\t           Kops drops fail only if both runs used -A.\n");
+    fprintf(stderr, "\t-c <mode>  Heap commit: lazy, populate, thp or hugetlb.\n");
+    fprintf(stderr, "\t-C <level> Heap check after each op: off, sampled,\n"
+	    "\t           periodic[,N] or parallel[,N] (every N ops).\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H         Also report util with lifetime hints, profiled\n");
+    fprintf(stderr, "\t           from the first half of each trace.\n");
+    fprintf(stderr, "\t-K <bytes> Also replay through handles, compacting\n"
+	    "\t           <bytes> after each op, and report heap size.\n");
+    fprintf(stderr, "\t-j <jobs>  Evaluate the traces in <jobs> worker processes,\n"
+	    "\t           at most one per CPU.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-P <file>  Run the allocator in shared object <file> as\n"
+	    "\t           well, e.g. plugin-libc.so (repeatable).\n");
+    fprintf(stderr, "\t-L         Also report per-request latency percentiles.\n");
+    fprintf(stderr, "\t-m <size>  Maximum heap size, e.g. 64M (default %dM).\n",
+	    MAX_HEAP >> 20);
+    fprintf(stderr, "\t-o <file>  Write the mm results to <file>, as CSV if it ends\n"
+	    "\t           in .csv and as JSON otherwise.\n");
+    fprintf(stderr, "\t-Q <depth> Also time frees queued to a reclaimer thread.\n");
+    fprintf(stderr, "\t-R         Also report resident heap size with first-fit\n"
+	    "\t           and page-aware placement.\n");
+    fprintf(stderr, "\t-s <file>  Stream <file> through mm malloc without loading it.\n");
+    fprintf(stderr, "\t-S         Split small blocks from the high end of free blocks.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T         Also replay each trace thread on its own thread\n"
+	    "\t           (needs mdriver-mt).\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
 }
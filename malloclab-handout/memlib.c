@@ -2,44 +2,597 @@
  * memlib.c - a module that simulates the memory system.  Needed because it 
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
+ *
+ *            Each heap is a single virtual range reserved once with
+ *            mmap(PROT_NONE). mem_sbrk commits it in granules as the brk
+ *            advances, using the strategy chosen with mem_set_commit.
+ *            All of a heap's state lives in a mem_ctx_t; the plain mem_
+ *            functions use a default context.
+ *
+ *            A shared heap instead maps a file or memfd MAP_SHARED,
+ *            all of it read/write from the start. The first page of the
+ *            mapping holds the brk as an offset, so processes that map
+ *            it at different addresses still agree on where it is.
+ *
+ *            Private heaps also keep a bitmap of the pages the allocator
+ *            says it may have dirtied, so that it can favour pages that
+ *            are already resident and give back ones it no longer needs.
  */
+#define _GNU_SOURCE /* for mremap */
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <assert.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <string.h>
 #include <errno.h>
 
 #include "memlib.h"
 #include "config.h"
 
+#define MEM_COMMIT_CHUNK (1<<16)   /* commit granule for 4K-page strategies */
+#define MEM_HUGE_PAGE    (1<<21)   /* commit granule for huge-page strategies */
+#define MEM_SHARED_MAGIC 0x6d6d7368 /* marks an initialized shared mapping */
+
+/* The first page of a shared mapping; offsets are from the heap start */
+struct mem_shared {
+    unsigned int magic;  /* MEM_SHARED_MAGIC once set up */
+    size_t max_heap;     /* bytes of heap after this page */
+    size_t brk;          /* current brk */
+    size_t peak;         /* highest brk since the last reset */
+};
+
 /* private variables */
-static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */ 
+static mem_ctx_t mem_ctx;    /* the default context */
+
+static size_t mem_max_heap = MAX_HEAP;         /* set by mem_set_max_heap */
+static mem_commit_t mem_commit = MEM_COMMIT_LAZY; /* set by mem_set_commit */
+
+static const char *commit_names[] = {"lazy", "populate", "thp", "hugetlb"};
+
+/*
+ * mem_set_max_heap - set the size of the range reserved by mem_init
+ */
+void mem_set_max_heap(size_t bytes)
+{
+    mem_max_heap = bytes;
+}
+
+/*
+ * mem_set_commit - choose how mem_init's heap commits its range
+ */
+void mem_set_commit(mem_commit_t commit)
+{
+    mem_commit = commit;
+}
+
+/*
+ * mem_commit_name - printable name of a commit strategy
+ */
+const char *mem_commit_name(mem_commit_t commit)
+{
+    return commit_names[commit];
+}
+
+/*
+ * mem_commit_parse - map a name accepted by mem_commit_name back to
+ *    its strategy. Returns -1 for an unknown name.
+ */
+int mem_commit_parse(const char *name)
+{
+    int i;
+
+    for (i = 0; i < (int)(sizeof(commit_names) / sizeof(char *)); i++)
+	if (!strcmp(name, commit_names[i]))
+	    return i;
+    return -1;
+}
 
 /* 
- * mem_init - initialize the memory system model
+ * mem_ctx_init - reserve the range for a heap of up to max_heap bytes,
+ *    rounded up to the commit granule. Returns 0 on success and -1 if
+ *    it could not be reserved.
  */
-void mem_init(void)
+int mem_ctx_init(mem_ctx_t *ctx, size_t max_heap, mem_commit_t commit)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-    fprintf(stderr, "mem_init_vm: malloc error\n");
-    exit(1);
+    size_t align = (commit >= MEM_COMMIT_THP) ? MEM_HUGE_PAGE
+	: mem_pagesize();
+    size_t pages;
+    char *addr;
+
+    /*
+     * Commits come in whole granules, and the kernel rounds a hugetlb
+     * mapping up to a huge page anyway, so the last one must not reach
+     * past the reservation
+     */
+    max_heap = (max_heap + align - 1) & ~(align - 1);
+
+    /* reserve (but do not commit) the VM we will use to model the heap */
+    addr = mmap(NULL, max_heap + align, PROT_NONE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (addr == MAP_FAILED)
+	return -1;
+    ctx->map_addr = addr;
+    ctx->map_len = max_heap + align;
+    ctx->commit = commit;
+    ctx->shared = NULL;
+    pages = (max_heap + mem_pagesize() - 1) / mem_pagesize();
+    ctx->resident = calloc((pages + 7) / 8, 1);
+    if (ctx->resident == NULL) {
+	munmap(addr, max_heap + align);
+	return -1;
     }
 
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
+    /* huge pages need a 2MB aligned start; 4K strategies get it for free */
+    ctx->start_brk = (char *)(((size_t)addr + align - 1) & ~(align - 1));
+
+#ifdef MADV_HUGEPAGE
+    if (commit >= MEM_COMMIT_THP)
+	madvise(ctx->start_brk, max_heap, MADV_HUGEPAGE);
+#endif
+
+    ctx->max_addr = ctx->start_brk + max_heap;  /* max legal heap address */
+    ctx->brk = ctx->start_brk;                  /* heap is empty initially */
+    ctx->peak_brk = ctx->start_brk;
+    ctx->commit_brk = ctx->start_brk;           /* nothing committed yet */
+    return 0;
 }
 
 /* 
+ * map_shared - map fd, whose first page is the header, into ctx
+ */
+static int map_shared(mem_ctx_t *ctx, int fd, size_t max_heap)
+{
+    size_t header = mem_pagesize();
+    char *addr;
+
+    addr = mmap(NULL, header + max_heap, PROT_READ | PROT_WRITE, MAP_SHARED,
+		fd, 0);
+    if (addr == MAP_FAILED)
+	return -1;
+    ctx->map_addr = addr;
+    ctx->map_len = header + max_heap;
+    ctx->commit = MEM_COMMIT_LAZY;
+    ctx->shared = (struct mem_shared *)addr;
+    ctx->resident = NULL;                       /* pages are per process */
+    ctx->start_brk = addr + header;
+    ctx->max_addr = ctx->start_brk + max_heap;
+    ctx->commit_brk = ctx->max_addr;            /* the file is all mapped */
+    ctx->brk = ctx->start_brk + ctx->shared->brk;
+    ctx->peak_brk = ctx->start_brk + ctx->shared->peak;
+    return 0;
+}
+
+/*
+ * mem_ctx_init_shared - size fd (a file or memfd) for a heap of up to
+ *    max_heap bytes, map it and start it empty. Other processes can
+ *    then mem_ctx_attach_shared the same file. Returns 0 on success
+ *    and -1 on failure.
+ */
+int mem_ctx_init_shared(mem_ctx_t *ctx, int fd, size_t max_heap)
+{
+    struct mem_shared *shared;
+
+    max_heap = (max_heap + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+    if (ftruncate(fd, 0) < 0 || ftruncate(fd, mem_pagesize() + max_heap) < 0)
+	return -1;
+    if (map_shared(ctx, fd, max_heap) < 0)
+	return -1;
+
+    shared = ctx->shared;
+    shared->max_heap = max_heap;
+    shared->brk = 0;
+    shared->peak = 0;
+    shared->magic = MEM_SHARED_MAGIC;
+    return 0;
+}
+
+/*
+ * mem_ctx_attach_shared - map a heap set up by mem_ctx_init_shared,
+ *    wherever the kernel puts it. Returns 0 on success and -1 if fd
+ *    does not hold one.
+ */
+int mem_ctx_attach_shared(mem_ctx_t *ctx, int fd)
+{
+    struct mem_shared header;
+    struct stat st;
+
+    if (fstat(fd, &st) < 0 ||
+	pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header))
+	return -1;
+    if (header.magic != MEM_SHARED_MAGIC ||
+	(size_t)st.st_size != mem_pagesize() + header.max_heap) {
+	errno = EINVAL;
+	return -1;
+    }
+    return map_shared(ctx, fd, header.max_heap);
+}
+
+/*
+ * load_brk - pick up the brk another process may have moved
+ */
+static void load_brk(mem_ctx_t *ctx)
+{
+    if (ctx->shared != NULL) {
+	ctx->brk = ctx->start_brk + ctx->shared->brk;
+	ctx->peak_brk = ctx->start_brk + ctx->shared->peak;
+    }
+}
+
+/*
+ * store_brk - publish this process's brk to a shared heap
+ */
+static void store_brk(mem_ctx_t *ctx)
+{
+    if (ctx->shared != NULL) {
+	ctx->shared->brk = (size_t)(ctx->brk - ctx->start_brk);
+	ctx->shared->peak = (size_t)(ctx->peak_brk - ctx->start_brk);
+    }
+}
+
+/*
+ * mem_ctx_deinit - free the storage used by a heap. A shared heap is
+ *    only unmapped; the file and the other processes' mappings stay.
+ */
+void mem_ctx_deinit(mem_ctx_t *ctx)
+{
+    if (ctx->map_addr != NULL)
+	munmap(ctx->map_addr, ctx->map_len);
+    free(ctx->resident);
+    memset(ctx, 0, sizeof(mem_ctx_t));
+}
+
+/*
+ * mem_ctx_reset_brk - reset the simulated brk pointer to make an empty
+ *    heap. Committed pages are kept, so later runs do not fault them
+ *    in again.
+ */
+void mem_ctx_reset_brk(mem_ctx_t *ctx)
+{
+    ctx->brk = ctx->start_brk;
+    ctx->peak_brk = ctx->start_brk;
+    store_brk(ctx);
+}
+
+/*
+ * commit - make [commit_brk, end) readable and writable. Returns
+ *    0 on success and -1 if the kernel refused.
+ */
+static int commit(mem_ctx_t *ctx, char *end)
+{
+    size_t granule = (ctx->commit >= MEM_COMMIT_THP) ? MEM_HUGE_PAGE
+	: MEM_COMMIT_CHUNK;
+    char *lo = ctx->commit_brk;
+    char *hi = ctx->start_brk +
+	(((size_t)(end - ctx->start_brk) + granule - 1) & ~(granule - 1));
+    size_t len;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED;
+
+    if (hi > ctx->max_addr)
+	hi = ctx->max_addr;
+    len = (size_t)(hi - lo);
+
+    switch (ctx->commit) {
+    case MEM_COMMIT_POPULATE:
+	/* replace the reservation with prefaulted pages */
+	if (mmap(lo, len, PROT_READ | PROT_WRITE, flags | MAP_POPULATE,
+		 -1, 0) == MAP_FAILED)
+	    return -1;
+	break;
+
+    case MEM_COMMIT_HUGETLB:
+#ifdef MAP_HUGETLB
+	if (mmap(lo, len, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB,
+		 -1, 0) != MAP_FAILED)
+	    break;
+#endif
+	/*
+	 * No reserved hugetlbfs pages: fall back to transparent huge
+	 * pages. The failed MAP_FIXED may have dropped the reservation
+	 * under [lo, hi), so map that part afresh rather than mprotect it.
+	 */
+	fprintf(stderr, "mem_sbrk: no hugetlb pages, using thp instead\n");
+	ctx->commit = MEM_COMMIT_THP;
+	if (mmap(lo, len, PROT_READ | PROT_WRITE, flags, -1, 0) == MAP_FAILED)
+	    return -1;
+#ifdef MADV_HUGEPAGE
+	madvise(lo, (size_t)(ctx->max_addr - lo), MADV_HUGEPAGE);
+#endif
+	break;
+
+    case MEM_COMMIT_LAZY:
+    case MEM_COMMIT_THP:
+	if (mprotect(lo, len, PROT_READ | PROT_WRITE) < 0)
+	    return -1;
+	break;
+    }
+
+    ctx->commit_brk = hi;
+    return 0;
+}
+
+/* 
+ * mark - set or clear the resident bits of pages [first, last)
+ */
+static void mark(mem_ctx_t *ctx, size_t first, size_t last, int dirty)
+{
+    size_t i;
+
+    if (ctx->resident == NULL)
+	return;
+    for (i = first; i < last; i++) {
+	if (dirty)
+	    ctx->resident[i >> 3] |= 1 << (i & 7);
+	else
+	    ctx->resident[i >> 3] &= ~(1 << (i & 7));
+    }
+}
+
+/*
+ * page_of - index of the heap page holding p
+ */
+static size_t page_of(mem_ctx_t *ctx, void *p)
+{
+    return (size_t)((char *)p - ctx->start_brk) / mem_pagesize();
+}
+
+/*
+ * release - hand the whole pages above the brk back to the kernel.
+ *    They stay mapped read/write and fault in again as zeros. A shared
+ *    heap punches them out of its file, for every process at once.
+ */
+static void release(mem_ctx_t *ctx)
+{
+    size_t granule = (ctx->commit >= MEM_COMMIT_THP) ? MEM_HUGE_PAGE
+	: mem_pagesize();
+    char *lo = ctx->start_brk +
+	(((size_t)(ctx->brk - ctx->start_brk) + granule - 1) & ~(granule - 1));
+
+    if (lo < ctx->commit_brk) {
+	madvise(lo, (size_t)(ctx->commit_brk - lo),
+		(ctx->shared != NULL) ? MADV_REMOVE : MADV_DONTNEED);
+	mark(ctx, page_of(ctx, lo), page_of(ctx, ctx->commit_brk), 0);
+    }
+}
+
+/* 
+ * mem_ctx_sbrk - simple model of the sbrk function. Extends the heap
+ *    by incr bytes and returns the start address of the new area.
+ *    A negative incr shrinks the heap and returns its old end; the
+ *    pages given up are released but stay committed. The bounds are
+ *    checked as distances from the brk, so no incr can wrap it.
+ */
+void *mem_ctx_sbrk(mem_ctx_t *ctx, intptr_t incr)
+{
+    char *old_brk;
+
+    load_brk(ctx);
+    old_brk = ctx->brk;
+    if (incr < 0) {
+	if (ctx->start_brk - ctx->brk > incr) {
+	    errno = EINVAL;
+	    fprintf(stderr, "ERROR: mem_sbrk failed. Shrank below the heap...\n");
+	    return (void *)-1;
+	}
+	ctx->brk += incr;
+	store_brk(ctx);
+	release(ctx);
+	return (void *)old_brk;
+    }
+    if ((uintptr_t)incr > (uintptr_t)(ctx->max_addr - ctx->brk)) {
+	errno = ENOMEM;
+	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+	return (void *)-1;
+    }
+    if ((ctx->brk + incr) > ctx->commit_brk && commit(ctx, ctx->brk + incr) < 0) {
+	fprintf(stderr, "ERROR: mem_sbrk failed. Could not commit memory...\n");
+	return (void *)-1;
+    }
+    ctx->brk += incr;
+    if (ctx->brk > ctx->peak_brk)
+	ctx->peak_brk = ctx->brk;
+    store_brk(ctx);
+    return (void *)old_brk;
+}
+
+#ifdef MREMAP_FIXED
+/*
+ * refill - map fresh zero pages over [addr, addr+len) of the heap
+ */
+static void refill(void *addr, size_t len)
+{
+    if (mmap(addr, len, PROT_READ | PROT_WRITE,
+	     MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED) {
+	fprintf(stderr, "mem_remap: could not refill %p\n", addr);
+	exit(1);
+    }
+}
+#endif
+
+/*
+ * mem_ctx_remap - move the pages under [src, src+len) to [dst, dst+len)
+ *    without copying them. Both ranges must be page aligned, must not
+ *    overlap, and must lie inside the committed heap. The source range
+ *    is left mapped with fresh zero pages. Returns 0 on success and -1 if
+ *    the pages could not be moved, in which case the source range
+ *    is intact but the destination may have been zeroed. Pages of a
+ *    shared heap belong to its file and are never moved.
+ */
+int mem_ctx_remap(mem_ctx_t *ctx, void *dst, void *src, size_t len)
+{
+#ifdef MREMAP_FIXED
+    char *lo = (char *)src;
+    char *hi = (char *)dst;
+    size_t mask = mem_pagesize() - 1;
+
+    if (lo > hi) {
+	lo = (char *)dst;
+	hi = (char *)src;
+    }
+    if ((((size_t)src | (size_t)dst | len) & mask) != 0 || lo + len > hi ||
+	lo < ctx->start_brk || hi + len > ctx->commit_brk ||
+	ctx->commit == MEM_COMMIT_HUGETLB || ctx->shared != NULL)
+	return -1;
+
+    if (mremap(src, len, len, MREMAP_MAYMOVE | MREMAP_FIXED, dst) == MAP_FAILED) {
+	/* the kernel may already have dropped the target; map it again */
+	refill(dst, len);
+	return -1;
+    }
+
+    /* refill the hole mremap left behind */
+    refill(src, len);
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+/*
+ * mem_ctx_heap_lo - return address of the first heap byte
+ */
+void *mem_ctx_heap_lo(mem_ctx_t *ctx)
+{
+    return (void *)ctx->start_brk;
+}
+
+/*
+ * mem_ctx_heap_hi - return address of last heap byte
+ */
+void *mem_ctx_heap_hi(mem_ctx_t *ctx)
+{
+    load_brk(ctx);
+    return (void *)(ctx->brk - 1);
+}
+
+/*
+ * mem_ctx_heapsize() - returns the heap size in bytes
+ */
+size_t mem_ctx_heapsize(mem_ctx_t *ctx)
+{
+    load_brk(ctx);
+    return (size_t)(ctx->brk - ctx->start_brk);
+}
+
+/*
+ * mem_ctx_peak_heapsize() - returns the largest heap size since the
+ *    last reset, which can exceed the heap size once it has shrunk
+ */
+size_t mem_ctx_peak_heapsize(mem_ctx_t *ctx)
+{
+    load_brk(ctx);
+    return (size_t)(ctx->peak_brk - ctx->start_brk);
+}
+
+/*
+ * mem_ctx_committed() - returns the number of committed (mapped) heap bytes
+ */
+size_t mem_ctx_committed(mem_ctx_t *ctx)
+{
+    return (size_t)(ctx->commit_brk - ctx->start_brk);
+}
+
+/*
+ * mem_ctx_touch - note that [lo, lo+len) may have been written, so
+ *    that its pages count as resident
+ */
+void mem_ctx_touch(mem_ctx_t *ctx, void *lo, size_t len)
+{
+    if (len > 0)
+	mark(ctx, page_of(ctx, lo), page_of(ctx, (char *)lo + len - 1) + 1, 1);
+}
+
+/*
+ * mem_ctx_resident - are all the pages under [lo, lo+len) marked as
+ *    resident? Always true for a heap without a bitmap.
+ */
+int mem_ctx_resident(mem_ctx_t *ctx, void *lo, size_t len)
+{
+    size_t i, last;
+
+    if (ctx->resident == NULL || len == 0)
+	return 1;
+    last = page_of(ctx, (char *)lo + len - 1);
+    for (i = page_of(ctx, lo); i <= last; i++)
+	if (!(ctx->resident[i >> 3] & (1 << (i & 7))))
+	    return 0;
+    return 1;
+}
+
+/*
+ * mem_ctx_purge - give back the whole pages inside [lo, lo+len), which
+ *    read as zeros afterwards. Does nothing unless one of them is
+ *    marked resident, or on a heap without a bitmap.
+ */
+void mem_ctx_purge(mem_ctx_t *ctx, void *lo, size_t len)
+{
+    size_t page = mem_pagesize();
+    size_t first = page_of(ctx, (char *)lo + page - 1);
+    size_t last = page_of(ctx, (char *)lo + len);
+    size_t i;
+
+    if (ctx->resident == NULL || (char *)lo + len > ctx->brk)
+	return;
+    for (i = first; i < last; i++) {
+	if (ctx->resident[i >> 3] & (1 << (i & 7))) {
+	    madvise(ctx->start_brk + first * page, (last - first) * page,
+		    MADV_DONTNEED);
+	    mark(ctx, first, last, 0);
+	    return;
+	}
+    }
+}
+
+/*
+ * mem_ctx_rss - bytes of the heap resident in memory, from mincore
+ */
+size_t mem_ctx_rss(mem_ctx_t *ctx)
+{
+    size_t page = mem_pagesize();
+    size_t pages, i, rss = 0;
+    unsigned char *vec;
+
+    load_brk(ctx);
+    pages = ((size_t)(ctx->brk - ctx->start_brk) + page - 1) / page;
+    if (pages == 0 || (vec = malloc(pages)) == NULL)
+	return 0;
+    if (mincore(ctx->start_brk, pages * page, vec) == 0)
+	for (i = 0; i < pages; i++)
+	    if (vec[i] & 1)
+		rss += page;
+    free(vec);
+    return rss;
+}
+
+/*
+ * mem_default - the context behind the plain mem_ functions
+ */
+mem_ctx_t *mem_default(void)
+{
+    return &mem_ctx;
+}
+
+/*
+ * mem_init - initialize the memory system model
+ */
+void mem_init(void)
+{
+    /* a second call simply starts over with a fresh reservation */
+    mem_ctx_deinit(&mem_ctx);
+    if (mem_ctx_init(&mem_ctx, mem_max_heap, mem_commit) < 0) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
+	exit(1);
+    }
+}
+
+/*
  * mem_deinit - free the storage used by the memory system model
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    mem_ctx_deinit(&mem_ctx);
 }
 
 /*
@@ -47,25 +600,23 @@ void mem_deinit(void)
  */
 void mem_reset_brk()
 {
-    mem_brk = mem_start_brk;
+    mem_ctx_reset_brk(&mem_ctx);
 }
 
-/* 
- * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+/*
+ * mem_sbrk - mem_ctx_sbrk on the default heap
  */
-void *mem_sbrk(int incr) 
+void *mem_sbrk(intptr_t incr)
 {
-    char *old_brk = mem_brk;
+    return mem_ctx_sbrk(&mem_ctx, incr);
+}
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
-    errno = ENOMEM;
-    fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
-    return (void *)-1;
-    }
-    mem_brk += incr;
-    return (void *)old_brk;
+/*
+ * mem_remap - mem_ctx_remap on the default heap
+ */
+int mem_remap(void *dst, void *src, size_t len)
+{
+    return mem_ctx_remap(&mem_ctx, dst, src, len);
 }
 
 /*
@@ -73,7 +624,7 @@ void *mem_sbrk(int incr)
  */
 void *mem_heap_lo()
 {
-    return (void *)mem_start_brk;
+    return mem_ctx_heap_lo(&mem_ctx);
 }
 
 /* 
@@ -81,7 +632,7 @@ void *mem_heap_lo()
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    return mem_ctx_heap_hi(&mem_ctx);
 }
 
 /*
@@ -89,7 +640,32 @@ void *mem_heap_hi()
  */
 size_t mem_heapsize() 
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    return mem_ctx_heapsize(&mem_ctx);
+}
+
+/*
+ * mem_peak_heapsize() - returns the largest heap size since the last
+ *    reset, which can exceed mem_heapsize once the heap has shrunk
+ */
+size_t mem_peak_heapsize()
+{
+    return mem_ctx_peak_heapsize(&mem_ctx);
+}
+
+/*
+ * mem_committed() - returns the number of committed (mapped) heap bytes
+ */
+size_t mem_committed()
+{
+    return mem_ctx_committed(&mem_ctx);
+}
+
+/*
+ * mem_rss() - returns the number of resident heap bytes
+ */
+size_t mem_rss()
+{
+    return mem_ctx_rss(&mem_ctx);
 }
 
 /*
@@ -1,11 +1,69 @@
+#include <stdint.h>
 #include <unistd.h>
 
+/* How mem_sbrk turns reserved address space into usable heap */
+typedef enum {
+    MEM_COMMIT_LAZY,     /* mprotect; pages fault in on first touch */
+    MEM_COMMIT_POPULATE, /* MAP_POPULATE; prefault as the brk advances */
+    MEM_COMMIT_THP,      /* madvise(MADV_HUGEPAGE); transparent huge pages */
+    MEM_COMMIT_HUGETLB   /* MAP_HUGETLB; explicit huge pages, else THP */
+} mem_commit_t;
+
+/* Header of a shared heap's mapping, holding what every process must agree on */
+struct mem_shared;
+
+/*
+ * One simulated heap. The plain mem_ functions work on a default
+ * context; the mem_ctx_ ones let a process keep several heaps.
+ * A shared heap is a file or memfd mapping that other processes can
+ * attach at their own addresses; its brk lives in the mapping.
+ */
+typedef struct mem_ctx {
+    char *start_brk;     /* points to first byte of heap */
+    char *brk;           /* points to last byte of heap */
+    char *max_addr;      /* largest legal heap address */
+    char *commit_brk;    /* end of the committed (read/write) prefix */
+    char *peak_brk;      /* highest brk since the last reset */
+    char *map_addr;      /* start of the whole reservation */
+    size_t map_len;      /* length of the whole reservation */
+    mem_commit_t commit; /* how the reservation is committed */
+    struct mem_shared *shared; /* header of a shared mapping, else NULL */
+    unsigned char *resident; /* bit per page the allocator may have
+				dirtied; NULL for shared heaps */
+} mem_ctx_t;
+
+int mem_ctx_init(mem_ctx_t *ctx, size_t max_heap, mem_commit_t commit);
+int mem_ctx_init_shared(mem_ctx_t *ctx, int fd, size_t max_heap);
+int mem_ctx_attach_shared(mem_ctx_t *ctx, int fd);
+void mem_ctx_deinit(mem_ctx_t *ctx);
+void *mem_ctx_sbrk(mem_ctx_t *ctx, intptr_t incr);
+int mem_ctx_remap(mem_ctx_t *ctx, void *dst, void *src, size_t len);
+void mem_ctx_reset_brk(mem_ctx_t *ctx);
+void *mem_ctx_heap_lo(mem_ctx_t *ctx);
+void *mem_ctx_heap_hi(mem_ctx_t *ctx);
+size_t mem_ctx_heapsize(mem_ctx_t *ctx);
+size_t mem_ctx_peak_heapsize(mem_ctx_t *ctx);
+size_t mem_ctx_committed(mem_ctx_t *ctx);
+void mem_ctx_touch(mem_ctx_t *ctx, void *lo, size_t len);
+int mem_ctx_resident(mem_ctx_t *ctx, void *lo, size_t len);
+void mem_ctx_purge(mem_ctx_t *ctx, void *lo, size_t len);
+size_t mem_ctx_rss(mem_ctx_t *ctx);
+
+mem_ctx_t *mem_default(void);
+void mem_set_max_heap(size_t bytes);
+void mem_set_commit(mem_commit_t commit);
+const char *mem_commit_name(mem_commit_t commit);
+int mem_commit_parse(const char *name);
+
 void mem_init(void);               
 void mem_deinit(void);
-void *mem_sbrk(int incr);
+void *mem_sbrk(intptr_t incr);
+int mem_remap(void *dst, void *src, size_t len);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+size_t mem_peak_heapsize(void);
+size_t mem_committed(void);
+size_t mem_rss(void);
 size_t mem_pagesize(void);
-
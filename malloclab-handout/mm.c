@@ -4,8 +4,8 @@ large, double-word aligned array of bytes. The bytes between mem_heap and mem_
 brk represent allocated virtual memory. The bytes following mem_brk represent
 unallocated virtual memory. The allocator requests additional heap memory by
 calling the mem_sbrk function, which has the same interface as the system’s sbrk
-function, as well as the same semantics, except that it rejects requests to shrink
-the heap.░░░░░
+function, as well as the same semantics. The handle API's compactor shrinks the
+heap this way after sliding movable blocks down.░░░░░
 */
 
 #include <stdio.h>
@@ -13,9 +13,17 @@ the heap.░░░░░
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "mm.h"
 #include "memlib.h"
+#include "sizeclasses.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_X86_COPY 1
+#endif
 
 /*********************************************************
 * NOTE TO STUDENTS: Before you do anything else, please
@@ -39,12 +47,36 @@ team_t team = {
 #define DOUBLE_WORD_SIZE 8 /* Double word size (bytes) */
 #define CHUNK_SIZE (1<<12) /* Initial useable heap size (4096 bytes) */
 #define HEAP_BASE_OFFSET (2 * WORD_SIZE) /* The offset off of mem_heap_lo where the real heap starts */
+#define REMAP_THRESHOLD (1<<22) /* Blocks this large are page aligned so realloc can remap them */
+
+/* Realloc copies are picked by length. Ones that would not fit in the
+   last-level cache use AVX2 non-temporal stores, so that they do not
+   flush it; the rest go to memcpy, which already uses the widest
+   vector moves the CPU has */
+#define COPY_STREAM_DEFAULT (8<<20) /* Cache size assumed when sysconf cannot tell */
+
+/* Page-aware placement (MM_PLACE_RESIDENT) looks a little past the first
+   fit for a block whose pages are already resident, and hands the middle
+   pages of large free blocks back to the kernel, so that the resident set
+   tracks the live data rather than the heap's high-water mark */
+#define PLACE_PROBES 16 /* Fits examined after the first one */
+#define PURGE_MIN (1<<16) /* Free blocks this large give back their pages */
+
+/* Splitting by size (MM_SPLIT_BY_SIZE) carves blocks smaller than the
+   recent mean request from the high end of a free block and the rest
+   from the low end. Small and large blocks then gather at opposite ends
+   of each free area, so freeing all of one kind leaves whole runs that
+   coalesce, instead of holes between blocks of the other kind */
+#define SIZE_MEAN_SHIFT 4 /* The mean moves 1/16 of the way to each request */
 
 #define MAX(x, y) ((x) > (y)? (x) : (y))
 
 /* Pack a size and allocated bit into a word */
 #define PACK(size, alloc) ((size) | (alloc))
 
+/* Pack a size, region and allocated bit into a word */
+#define PACK_REGION(size, region, alloc) ((size) | ((region) << 1) | (alloc))
+
 /* Read and write a word at address p */
 #define GET_AS_WORD_POINTER(p) (*(unsigned int *)(p))
 #define PUT_IN_WORD_POINTER(p, val) (*(unsigned int *)(p) = (val))
@@ -52,6 +84,25 @@ team_t team = {
 /* Read the size and allocated fields from address p */
 #define GET_SIZE(p) (GET_AS_WORD_POINTER(p) & ~0x7)
 #define IS_ALLOCATED(p) (GET_AS_WORD_POINTER(p) & 0x1)
+#define GET_REGION(p) ((GET_AS_WORD_POINTER(p) >> 1) & 0x1)
+#define IS_HANDLE(p) (GET_AS_WORD_POINTER(p) & HANDLE_BIT)
+
+/* Blocks predicted to die soon are kept apart from the rest, so that their
+   holes do not break up the long-lived part of the heap. A block's region
+   is where its memory sits, not what it was asked for, and it keeps it
+   while allocated */
+#define LONG_REGION 0
+#define SHORT_REGION 1
+#define REGIONS 2
+
+/* Blocks allocated through mm_halloc may be moved by the compactor. They
+   are marked in their boundary tags, and the first word of their payload
+   names the handle table slot that points at them */
+#define HANDLE_BIT 0x4
+#define HANDLE_OF(bp) (*(unsigned int *)(bp))
+#define HANDLE_TABLE_MIN 64 /* Slots in the first handle table */
+#define COMPACT_VISIT_COST 64 /* Budget charged for walking past a block */
+#define COMPACT_TRIM_RATIO 64 /* Heap bytes trimmed per byte of budget */
 
 /* single word (4) or double word (8) alignment */
 #define ALIGNMENT 8
@@ -61,14 +112,141 @@ team_t team = {
 
 #define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
 
+/* Read and write the free list links of free block bp. Links are word
+   offsets from the heap base so that a minimum block stays 16 bytes on
+   any pointer size; offset 0 (the alignment padding) means none */
+#define NEXT_FREE(bp) (*(unsigned int *)(bp))
+#define PREV_FREE(bp) (*((unsigned int *)(bp) + 1))
+#define TO_OFFSET(ctx, bp) ((unsigned int)((char *)(bp) - (ctx)->heap_base))
+#define FROM_OFFSET(ctx, off) ((ctx)->heap_base + (off))
+
+/* Everything one heap needs. It sits at the bottom of the memlib heap it
+   manages, so that heaps are independent and mm_ctx_init on a used heap
+   resets it without touching the rest. It holds offsets rather than
+   pointers, so a shared heap works wherever each process maps it; the
+   mm_ctx_t views are per process */
+struct mm_heap {
+    unsigned int free_lists[REGIONS][SIZE_CLASSES]; /* Head of each class's free list */
+
+    /* The handle table lives in the heap as an ordinary block. A used slot
+       holds its block's offset, a free one (next free slot + 1) << 1 | 1 */
+    unsigned int handle_table; /* Offset of the table, 0 if none yet */
+    unsigned int handle_slots; /* Slots in handle_table */
+    unsigned int handle_free; /* First free slot + 1, 0 if none */
+    unsigned int compact_cursor; /* Blocks below it are packed; 0 between passes */
+    unsigned int size_mean; /* Running mean of block sizes, for MM_SPLIT_BY_SIZE */
+    unsigned long check_ops; /* Ops since the checker last walked this heap */
+    int check_failures; /* Failed checks since mm_ctx_init */
+    pthread_mutex_t lock; /* Held for each operation on a shared heap */
+};
+
+#define HEAP_HEADER_SIZE ALIGN(sizeof(struct mm_heap))
+#define HANDLE_TABLE(ctx) ((unsigned int *)FROM_OFFSET(ctx, (ctx)->heap->handle_table))
+
+/* Built with -DMM_THREADSAFE, every heap can be used by several threads */
+#ifdef MM_THREADSAFE
+#define THREADSAFE 1
+#else
+#define THREADSAFE 0
+#endif
+
+/* A heap shared between processes or threads, or freed into by a
+   reclaimer thread, runs one operation at a time */
+#define LOCKED(ctx) (THREADSAFE || (ctx)->shared || (ctx)->async)
+#define LOCK(ctx) \
+    do { if (LOCKED(ctx)) pthread_mutex_lock(&(ctx)->heap->lock); } while (0)
+#define UNLOCK(ctx) \
+    do { if (LOCKED(ctx)) pthread_mutex_unlock(&(ctx)->heap->lock); } while (0)
+
+static mm_ctx_t default_ctx; /* The heap behind the plain mm_ functions */
+__thread mm_fast_t mm_fast; /* Lists behind mm_malloc_small, for default_ctx */
+
+static mm_placement_t placement = MM_PLACE_FIRST_FIT; /* Set by mm_setplacement */
+static mm_split_t split = MM_SPLIT_LOW; /* Set by mm_setsplit */
+static int copy_streams = -1; /* Whether AVX2 streaming works; -1 until copy_init */
+static size_t copy_stream_min; /* Copies this long bypass the cache */
+
+/* Heap checker tuning */
+#define CHECK_WINDOW 2 /* Blocks examined on each side of a touched block */
+#define CHECK_MAX_THREADS 8 /* Upper bound on parallel walk threads */
+#define CHECK_PARALLEL_MIN (1<<20) /* Smaller heaps are walked by one thread */
+
+/* Asynchronous free (mm_ctx_async_start). Each thread that frees gets a
+   queue that only it pushes to and only the reclaimer thread pops from.
+   A full queue makes the caller free the block itself, which bounds the
+   memory waiting to be reclaimed */
+#define ASYNC_DEPTH_DEFAULT 1024 /* Queue slots per thread */
+#define ASYNC_IDLE_NS 1000000 /* Reclaimer sleep when every queue is empty */
+
+/* One thread's blocks waiting for the reclaimer */
+struct free_queue {
+    void** slots; /* depth of them, a power of two */
+    unsigned int depth;
+    unsigned int head; /* Next slot to fill; the owner's */
+    unsigned int tail; /* Next slot to drain; the reclaimer's */
+    pthread_t owner;
+    struct free_queue* next; /* Every queue of one reclaimer */
+};
+
+/* A reclaimer thread and the queues it drains */
+struct mm_async {
+    mm_ctx_t* ctx;
+    pthread_t thread;
+    pthread_mutex_t wake_lock; /* Guards adding queues, and wake */
+    pthread_cond_t wake; /* Signalled when a queue fills up halfway */
+    int sleeping; /* The reclaimer is waiting on wake */
+    struct free_queue* queues;
+    unsigned int depth;
+    unsigned long generation; /* Tells a thread its cached queue is stale */
+    int stop;
+};
+
+static unsigned long async_generation; /* Bumped by each mm_ctx_async_start */
+static __thread struct free_queue* my_queue; /* The calling thread's queue */
+static __thread unsigned long my_generation; /* ...and whose it is */
+
+/* Only the checker hook itself is on the fast path */
+#define CHECK_AFTER(ctx, bp) \
+    do { if (check_level != MM_CHECK_OFF) check_after(ctx, bp); } while (0)
+
+static mm_check_t check_level = MM_CHECK_OFF; /* Set by mm_setcheck */
+static unsigned long check_period = 1; /* Ops between full walks */
+
 static void* getHeaderPointer(char* blockPointer);
 static void* getFooterPointer(char* blockPointer);
 static void* getNextBlockPointer(char* blockPointer);
 static void* getPreviousBlockPointer(char* blockPointer);
-static void* extend_heap(size_t words);
-static void* place(void* bp, size_t asize);
-static void* find_fit(size_t asize);
-static void* coalesce(void* bp);
+static void* extend_heap(mm_ctx_t* ctx, size_t words, int region);
+static void* place(mm_ctx_t* ctx, void* bp, size_t asize, int high);
+static int place_high(mm_ctx_t* ctx, size_t asize);
+static void* find_fit(mm_ctx_t* ctx, size_t asize, int region);
+static void* coalesce(mm_ctx_t* ctx, void* bp);
+static int size_class(size_t asize);
+static void insert_free_block(mm_ctx_t* ctx, char* bp);
+static void remove_free_block(mm_ctx_t* ctx, char* bp);
+static void absorb(mm_ctx_t* ctx, char* bp, char* fp);
+static void* fit_aligned(char* bp, size_t asize, size_t align);
+static void* malloc_aligned(mm_ctx_t* ctx, size_t asize, size_t align, int region);
+static size_t adjust_size(size_t size);
+static void* heap_malloc(mm_ctx_t* ctx, size_t size, mm_lifetime_t lifetime, int resize);
+static void heap_free(mm_ctx_t* ctx, void* ptr);
+static void* resize_in_place(mm_ctx_t* ctx, char* bp, size_t asize);
+static void async_free(mm_ctx_t* ctx, void* ptr);
+static struct free_queue* find_queue(struct mm_async* async);
+static int drain_queues(mm_ctx_t* ctx);
+static void* reclaim(void* arg);
+static int grow_handles(mm_ctx_t* ctx);
+static void slide(mm_ctx_t* ctx, char* fp);
+static void trim_heap(mm_ctx_t* ctx, size_t limit);
+static void copy_init(void);
+static void copy_bytes(char* dst, char* src, size_t len);
+static void copy_payload(mm_ctx_t* ctx, char* dst, char* src, size_t len);
+static int check_block(mm_ctx_t* ctx, char* bp);
+static int check_handle(mm_ctx_t* ctx, char* bp);
+static int check_range(mm_ctx_t* ctx, char* bp, char* end, char** stop, unsigned long* nfree);
+static int check_links(mm_ctx_t* ctx, char* bp);
+static int check_free_lists(mm_ctx_t* ctx, unsigned long nfree);
+static void check_after(mm_ctx_t* ctx, void* bp);
 
 /*Converted function - return the header of the pointer*/
 static void* getHeaderPointer(char* blockPointer)
@@ -96,8 +274,71 @@ static void* getPreviousBlockPointer(char* blockPointer)
     return blockPointer - GET_SIZE(blockPointer - DOUBLE_WORD_SIZE);
 }
 
-/*Adds onto the current heap size by the necessary word size*/
-static void* extend_heap(size_t words)
+/*Returns the free list that holds blocks of asize bytes*/
+static int size_class(size_t asize)
+{
+    int i;
+
+    if (asize <= SIZE_CLASS_LOOKUP_MAX)
+    {
+        return size_class_lookup[asize / DOUBLE_WORD_SIZE];
+    }
+    for (i = size_class_lookup[SIZE_CLASS_LOOKUP_MAX / DOUBLE_WORD_SIZE]; asize > size_class_max[i]; i++)
+        ;
+
+    return i;
+}
+
+/*Pushes free block bp onto the front of its class's list*/
+static void insert_free_block(mm_ctx_t* ctx, char* bp)
+{
+    int class = size_class(GET_SIZE(getHeaderPointer(bp)));
+    int region = GET_REGION(getHeaderPointer(bp));
+    unsigned int head = ctx->heap->free_lists[region][class];
+
+    NEXT_FREE(bp) = head;
+    PREV_FREE(bp) = 0;
+    if (head != 0)
+    {
+        PREV_FREE(FROM_OFFSET(ctx, head)) = TO_OFFSET(ctx, bp);
+    }
+    ctx->heap->free_lists[region][class] = TO_OFFSET(ctx, bp);
+}
+
+/*Unlinks free block bp from its class's list*/
+static void remove_free_block(mm_ctx_t* ctx, char* bp)
+{
+    unsigned int next = NEXT_FREE(bp);
+    unsigned int prev = PREV_FREE(bp);
+
+    if (prev != 0)
+    {
+        NEXT_FREE(FROM_OFFSET(ctx, prev)) = next;
+    }
+    else
+    {
+        ctx->heap->free_lists[GET_REGION(getHeaderPointer(bp))][size_class(GET_SIZE(getHeaderPointer(bp)))] = next;
+    }
+    if (next != 0)
+    {
+        PREV_FREE(FROM_OFFSET(ctx, next)) = prev;
+    }
+}
+
+/*Notes that the block at bp has taken over free block fp, which is off
+    its free list by now. A compactor cursor left on fp would point into
+    the middle of bp, so it moves back to bp*/
+static void absorb(mm_ctx_t* ctx, char* bp, char* fp)
+{
+    if (ctx->heap->compact_cursor == TO_OFFSET(ctx, fp))
+    {
+        ctx->heap->compact_cursor = TO_OFFSET(ctx, bp);
+    }
+}
+
+/*Adds onto the current heap size by the necessary word size, giving the
+    new space to region*/
+static void* extend_heap(mm_ctx_t* ctx, size_t words, int region)
 {
     char* bp;
     size_t size;
@@ -109,119 +350,435 @@ static void* extend_heap(size_t words)
     }
 
     size = words * WORD_SIZE;
+    if (size > (size_t)INTPTR_MAX)
+    {
+        return NULL;
+    }
 
-    bp = mem_sbrk(size);
+    bp = mem_ctx_sbrk(ctx->mem, (intptr_t)size);
 
-    if ((int)bp == -1)
+    if (bp == (void *)-1)
     {
         return NULL;
     }
 
     /* Initialize free block header/footer and the epilogue header */
-    PUT_IN_WORD_POINTER(getHeaderPointer(bp), PACK(size, 0)); /* Free block header */
-    PUT_IN_WORD_POINTER(getFooterPointer(bp), PACK(size, 0)); /* Free block footer */
+    PUT_IN_WORD_POINTER(getHeaderPointer(bp), PACK_REGION(size, region, 0)); /* Free block header */
+    PUT_IN_WORD_POINTER(getFooterPointer(bp), PACK_REGION(size, region, 0)); /* Free block footer */
     PUT_IN_WORD_POINTER(getHeaderPointer(getNextBlockPointer(bp)), PACK(0, 1)); /* New epilogue header */
 
     /* Coalesce if the previous block was free */
-    //return coalesce(bp);
-    return bp;
+    return coalesce(ctx, bp);
 }
 
-/*Searches for free blocks to increase the available size*/
-static void* coalesce(void *bp)
+/*Merges free block bp with free neighbours in its region and puts the
+    result on its free list. Free blocks of different regions are left
+    side by side so that the regions do not bleed into each other*/
+static void* coalesce(mm_ctx_t* ctx, void *bp)
 {
-    size_t prev_alloc = IS_ALLOCATED(getFooterPointer(getPreviousBlockPointer(bp)));
-    size_t next_alloc = IS_ALLOCATED(getHeaderPointer(getNextBlockPointer(bp)));
+    int region = GET_REGION(getHeaderPointer(bp));
+    size_t prev_alloc = IS_ALLOCATED(getFooterPointer(getPreviousBlockPointer(bp))) ||
+        GET_REGION(getFooterPointer(getPreviousBlockPointer(bp))) != region;
+    size_t next_alloc = IS_ALLOCATED(getHeaderPointer(getNextBlockPointer(bp))) ||
+        GET_REGION(getHeaderPointer(getNextBlockPointer(bp))) != region;
     size_t size = GET_SIZE(getHeaderPointer(bp));
 
     if (prev_alloc && next_alloc) { /* Case 1 */
+        insert_free_block(ctx, bp);
         return bp;
     }
     else if (prev_alloc && !next_alloc) { /* Case 2 */
+        remove_free_block(ctx, getNextBlockPointer(bp));
+        absorb(ctx, bp, getNextBlockPointer(bp));
         size += GET_SIZE(getHeaderPointer(getNextBlockPointer(bp)));
-        PUT_IN_WORD_POINTER(getHeaderPointer(bp), PACK(size, 0));
-        PUT_IN_WORD_POINTER(getFooterPointer(bp), PACK(size,0));
+        PUT_IN_WORD_POINTER(getHeaderPointer(bp), PACK_REGION(size, region, 0));
+        PUT_IN_WORD_POINTER(getFooterPointer(bp), PACK_REGION(size, region, 0));
     }
     else if (!prev_alloc && next_alloc) { /* Case 3 */
+        remove_free_block(ctx, getPreviousBlockPointer(bp));
+        absorb(ctx, getPreviousBlockPointer(bp), bp);
         size += GET_SIZE(getHeaderPointer(getPreviousBlockPointer(bp)));
-        PUT_IN_WORD_POINTER(getFooterPointer(bp), PACK(size, 0));
-        PUT_IN_WORD_POINTER(getHeaderPointer(getPreviousBlockPointer(bp)), PACK(size, 0));
+        PUT_IN_WORD_POINTER(getFooterPointer(bp), PACK_REGION(size, region, 0));
+        PUT_IN_WORD_POINTER(getHeaderPointer(getPreviousBlockPointer(bp)), PACK_REGION(size, region, 0));
         bp = getPreviousBlockPointer(bp);
     }
     else { /* Case 4 */
+        remove_free_block(ctx, getPreviousBlockPointer(bp));
+        remove_free_block(ctx, getNextBlockPointer(bp));
+        absorb(ctx, getPreviousBlockPointer(bp), bp);
+        absorb(ctx, getPreviousBlockPointer(bp), getNextBlockPointer(bp));
         size += GET_SIZE(getHeaderPointer(getPreviousBlockPointer(bp))) +
         GET_SIZE(getFooterPointer(getNextBlockPointer(bp)));
-        PUT_IN_WORD_POINTER(getHeaderPointer(getPreviousBlockPointer(bp)), PACK(size, 0));
-        PUT_IN_WORD_POINTER(getFooterPointer(getNextBlockPointer(bp)), PACK(size, 0));
+        PUT_IN_WORD_POINTER(getHeaderPointer(getPreviousBlockPointer(bp)), PACK_REGION(size, region, 0));
+        PUT_IN_WORD_POINTER(getFooterPointer(getNextBlockPointer(bp)), PACK_REGION(size, region, 0));
         bp = getPreviousBlockPointer(bp);
     }
 
+    insert_free_block(ctx, bp);
     return bp;
 }
 
-/*searches for a valid placement and returns the pointer to its position*/
-static void* find_fit(size_t adjustedSize)
+/*searches for a valid placement and returns the pointer to its position.
+    The size's own class gives its best fit, since its blocks span a
+    range of sizes; a larger class gives its first fit. Short-lived
+    blocks only go in their own region; others may spill into the short
+    region once their own has no fit. Page-aware placement takes the
+    first fit whose pages are resident, if one turns up soon*/
+static void* find_fit(mm_ctx_t* ctx, size_t adjustedSize, int region)
 {
-    void* bp =  mem_heap_lo() + HEAP_BASE_OFFSET;
+    int class;
+    int pass;
+    int probes = 0;
+    int own = size_class(adjustedSize);
+    unsigned int off;
+    char* bp;
+    char* best = NULL;
+    char* first = NULL;
 
-    /* first fit search */
-    while (GET_SIZE(getHeaderPointer(bp)) > 0)
+    /* best fit within the size's class, then any block of a larger class */
+    for (pass = 0; pass < (region == SHORT_REGION ? 1 : REGIONS); pass++)
     {
-        if (!IS_ALLOCATED(getHeaderPointer(bp)) && (adjustedSize <= GET_SIZE(getHeaderPointer(bp))))
+        for (class = own; class < SIZE_CLASSES; class++)
         {
-            return bp;
+            for (off = ctx->heap->free_lists[region ^ pass][class]; off != 0; off = NEXT_FREE(bp))
+            {
+                bp = FROM_OFFSET(ctx, off);
+                if (adjustedSize > GET_SIZE(getHeaderPointer(bp)))
+                {
+                    continue;
+                }
+                if (placement == MM_PLACE_FIRST_FIT && class == own)
+                {
+                    if (best == NULL || GET_SIZE(getHeaderPointer(bp)) < GET_SIZE(getHeaderPointer(best)))
+                    {
+                        best = bp;
+                    }
+                    continue;
+                }
+                if (placement == MM_PLACE_FIRST_FIT ||
+                    mem_ctx_resident(ctx->mem, getHeaderPointer(bp), adjustedSize + WORD_SIZE))
+                {
+                    return bp;
+                }
+                if (first == NULL)
+                {
+                    first = bp;
+                }
+                if (++probes > PLACE_PROBES)
+                {
+                    return first;
+                }
+            }
+            if (best != NULL)
+            {
+                return best;
+            }
         }
-
-        bp = getNextBlockPointer(bp);
     }
 
-    return NULL; /* no fit */
+    return first; /* NULL if no fit */
 }
 
-/*responsible for placing the payload into the heap*/
-static void *place(void *bp, size_t asize)
+/*responsible for placing the payload into the heap, at the low end of
+    free block bp or, if high is set, at its high end. Both halves of a
+    split stay in the free block's region. Returns the placed block*/
+static void *place(mm_ctx_t* ctx, void *bp, size_t asize, int high)
 {
     size_t csize = GET_SIZE(getHeaderPointer(bp));
-    if ((csize - asize) >= (2*DOUBLE_WORD_SIZE))
+    int region = GET_REGION(getHeaderPointer(bp));
+    char* abp;
+
+    remove_free_block(ctx, bp);
+    if ((csize - asize) < (2*DOUBLE_WORD_SIZE))
     {
-        PUT_IN_WORD_POINTER(getHeaderPointer(bp), PACK(asize, 1));
-        PUT_IN_WORD_POINTER(getFooterPointer(bp), PACK(asize, 1));
-        bp = getNextBlockPointer(bp);
-        PUT_IN_WORD_POINTER(getHeaderPointer(bp), PACK(csize-asize, 0));
-        PUT_IN_WORD_POINTER(getFooterPointer(bp), PACK(csize-asize, 0));
+        if (placement == MM_PLACE_RESIDENT)
+        {
+            mem_ctx_touch(ctx->mem, getHeaderPointer(bp), csize);
+        }
+        PUT_IN_WORD_POINTER(getHeaderPointer(bp), PACK_REGION(csize, region, 1));
+        PUT_IN_WORD_POINTER(getFooterPointer(bp), PACK_REGION(csize, region, 1));
 
         return bp;
     }
-    else
+
+    /* The block, and the tags and links of the remainder, get written */
+    abp = high ? (char*)bp + (csize - asize) : bp;
+    if (placement == MM_PLACE_RESIDENT)
+    {
+        mem_ctx_touch(ctx->mem, getHeaderPointer(bp), 3*WORD_SIZE);
+        mem_ctx_touch(ctx->mem, (char*)getHeaderPointer(abp) - WORD_SIZE, asize + 3*WORD_SIZE);
+    }
+
+    PUT_IN_WORD_POINTER(getHeaderPointer(abp), PACK_REGION(asize, region, 1));
+    PUT_IN_WORD_POINTER(getFooterPointer(abp), PACK_REGION(asize, region, 1));
+    bp = high ? bp : getNextBlockPointer(abp);
+    PUT_IN_WORD_POINTER(getHeaderPointer(bp), PACK_REGION(csize-asize, region, 0));
+    PUT_IN_WORD_POINTER(getFooterPointer(bp), PACK_REGION(csize-asize, region, 0));
+    insert_free_block(ctx, bp);
+
+    return abp;
+}
+
+/*Whether an asize block goes at the high end of the free block it is
+    split from. Also folds asize into the heap's running mean*/
+static int place_high(mm_ctx_t* ctx, size_t asize)
+{
+    unsigned int mean = ctx->heap->size_mean;
+
+    if (split == MM_SPLIT_LOW)
     {
-        PUT_IN_WORD_POINTER(getHeaderPointer(bp), PACK(csize, 1));
-        PUT_IN_WORD_POINTER(getFooterPointer(bp), PACK(csize, 1));
+        return 0;
+    }
+    ctx->heap->size_mean = mean + (((int)asize - (int)mean) >> SIZE_MEAN_SHIFT);
+    return asize < mean;
+}
+
+/*Selects how mm_malloc chooses among free blocks that fit*/
+void mm_setplacement(mm_placement_t policy)
+{
+    placement = policy;
+}
+
+/*Selects which end of a free block mm_malloc splits blocks from*/
+void mm_setsplit(mm_split_t policy)
+{
+    split = policy;
+}
+
+/*returns the first payload address in free block bp that is a multiple of
+    align and can hold asize, leaving room for a free block in front of it*/
+static void* fit_aligned(char* bp, size_t asize, size_t align)
+{
+    char* abp = (char*)(((size_t)bp + align - 1) & ~(align - 1));
 
+    if (abp != bp && (size_t)(abp - bp) < 2*DOUBLE_WORD_SIZE)
+    {
+        abp += align;
+    }
+    if (abp + asize > bp + GET_SIZE(getHeaderPointer(bp)))
+    {
         return NULL;
     }
+
+    return abp;
+}
+
+/*places an asize block with an align-aligned payload, splitting off the
+    space in front of it as a free block*/
+static void* malloc_aligned(mm_ctx_t* ctx, size_t asize, size_t align, int region)
+{
+    char* bp = NULL;
+    char* abp = NULL;
+    size_t csize;
+    int class;
+    int pass;
+    unsigned int off;
+
+    /* first fit search over the classes that can hold asize, as in find_fit */
+    for (pass = 0; pass < (region == SHORT_REGION ? 1 : REGIONS) && abp == NULL; pass++)
+    {
+        for (class = size_class(asize); class < SIZE_CLASSES && abp == NULL; class++)
+        {
+            for (off = ctx->heap->free_lists[region ^ pass][class]; off != 0; off = NEXT_FREE(bp))
+            {
+                bp = FROM_OFFSET(ctx, off);
+                if ((abp = fit_aligned(bp, asize, align)) != NULL)
+                {
+                    break;
+                }
+            }
+        }
+    }
+    /* No fit found. Get enough memory to align within */
+    if (abp == NULL)
+    {
+        if ((bp = extend_heap(ctx, (asize + align + 2*DOUBLE_WORD_SIZE) / WORD_SIZE, region)) == NULL)
+        {
+            return NULL;
+        }
+        abp = fit_aligned(bp, asize, align);
+    }
+
+    if (abp != bp)
+    {
+        csize = GET_SIZE(getHeaderPointer(bp));
+        region = GET_REGION(getHeaderPointer(bp));
+        remove_free_block(ctx, bp);
+        PUT_IN_WORD_POINTER(getHeaderPointer(bp), PACK_REGION(abp - bp, region, 0));
+        PUT_IN_WORD_POINTER(getFooterPointer(bp), PACK_REGION(abp - bp, region, 0));
+        PUT_IN_WORD_POINTER(getHeaderPointer(abp), PACK_REGION(csize - (abp - bp), region, 0));
+        PUT_IN_WORD_POINTER(getFooterPointer(abp), PACK_REGION(csize - (abp - bp), region, 0));
+        insert_free_block(ctx, bp);
+        insert_free_block(ctx, abp);
+    }
+
+    return place(ctx, abp, asize, 0);
+}
+
+/*Picks the copy routines for this CPU and cache, once*/
+static void copy_init(void)
+{
+    long llc = -1;
+
+    if (copy_streams >= 0)
+    {
+        return;
+    }
+#ifdef _SC_LEVEL3_CACHE_SIZE
+    if ((llc = sysconf(_SC_LEVEL3_CACHE_SIZE)) <= 0)
+    {
+        llc = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    }
+#endif
+    copy_stream_min = (llc > 0) ? (size_t)llc : COPY_STREAM_DEFAULT;
+#ifdef HAVE_X86_COPY
+    copy_streams = __builtin_cpu_supports("avx2") != 0;
+#else
+    copy_streams = 0;
+#endif
+}
+
+#ifdef HAVE_X86_COPY
+/*Copies len bytes 128 at a time with non-temporal stores, which go
+    around the cache. They need an aligned destination, so the head is
+    copied plainly*/
+__attribute__((target("avx2")))
+static void copy_stream(char* dst, char* src, size_t len)
+{
+    size_t head = (32 - ((size_t)dst & 31)) & 31;
+    __m256i a, b, c, d;
+    size_t i;
+
+    memcpy(dst, src, head);
+    for (i = head; i + 128 <= len; i += 128)
+    {
+        a = _mm256_loadu_si256((__m256i*)(src + i));
+        b = _mm256_loadu_si256((__m256i*)(src + i + 32));
+        c = _mm256_loadu_si256((__m256i*)(src + i + 64));
+        d = _mm256_loadu_si256((__m256i*)(src + i + 96));
+        _mm256_stream_si256((__m256i*)(dst + i), a);
+        _mm256_stream_si256((__m256i*)(dst + i + 32), b);
+        _mm256_stream_si256((__m256i*)(dst + i + 64), c);
+        _mm256_stream_si256((__m256i*)(dst + i + 96), d);
+    }
+    _mm_sfence(); /* Order the streamed stores before the block is handed out */
+    memcpy(dst + i, src + i, len - i);
+}
+#endif
+
+/*Copies len bytes between payloads that do not overlap, with the
+    routine that suits the length*/
+static void copy_bytes(char* dst, char* src, size_t len)
+{
+#ifdef HAVE_X86_COPY
+    if (len >= copy_stream_min && copy_streams)
+    {
+        copy_stream(dst, src, len);
+        return;
+    }
+#endif
+    memcpy(dst, src, len);
+}
+
+/*copies a payload for realloc. When both payloads sit at the same page
+    offset the whole pages are moved with mem_remap, leaving memcpy only
+    the unaligned head and tail*/
+static void copy_payload(mm_ctx_t* ctx, char* dst, char* src, size_t len)
+{
+    size_t page = mem_pagesize();
+    size_t head = (page - ((size_t)src & (page - 1))) & (page - 1);
+    size_t pages;
+
+    if (len >= REMAP_THRESHOLD && ((size_t)(dst - src) & (page - 1)) == 0)
+    {
+        pages = (len - head) & ~(page - 1);
+        if (mem_ctx_remap(ctx->mem, dst + head, src + head, pages) == 0)
+        {
+            copy_bytes(dst, src, head);
+            copy_bytes(dst + head + pages, src + head + pages, len - head - pages);
+            return;
+        }
+    }
+
+    copy_bytes(dst, src, len);
+}
+
+/*Returns the block size for a size byte payload: room for the header
+    and footer, rounded up to the alignment*/
+static size_t adjust_size(size_t size)
+{
+    if (size <= DOUBLE_WORD_SIZE)
+    {
+        return 2*DOUBLE_WORD_SIZE;
+    }
+
+    /* MM_FAST_CLASS in mm.h relies on this rounding */
+    return ALIGN(size + DOUBLE_WORD_SIZE);
+}
+
+/*Points ctx at the heap kept at the bottom of mem*/
+static void set_view(mm_ctx_t* ctx, mem_ctx_t* mem)
+{
+    ctx->mem = mem;
+    ctx->heap = mem_ctx_heap_lo(mem);
+    ctx->heap_base = (char*)ctx->heap + HEAP_HEADER_SIZE;
+    ctx->shared = (mem->shared != NULL);
+    ctx->async = NULL;
+    copy_init();
 }
 
 /* 
-* mm_init - initialize the malloc package.
+* mm_ctx_init - Start an empty heap on mem, discarding anything it held,
+*     with ctx as this process's view of it. No other process may be
+*     using a shared heap while it is started. Returns 0 on success,
+*     -1 if mem is too small.
 */
-int mm_init(void)
+int mm_ctx_init(mm_ctx_t *ctx, mem_ctx_t *mem)
 {
-    mem_init();
-    void* base = mem_heap_lo();
+    pthread_mutexattr_t attr;
+    char* base;
 
-    /* Create the initial empty heap */
-    if ((base = mem_sbrk(4*WORD_SIZE)) == (void *)-1)
+    /* The shared state, then the initial empty heap */
+    mem_ctx_reset_brk(mem);
+    if (mem_ctx_sbrk(mem, HEAP_HEADER_SIZE + 4*WORD_SIZE) == (void *)-1)
     {
         return -1;
     }
+    set_view(ctx, mem);
+    base = ctx->heap_base;
 
     PUT_IN_WORD_POINTER(base, 0); /* Alignment padding */
     PUT_IN_WORD_POINTER(base + (1*WORD_SIZE), PACK(DOUBLE_WORD_SIZE, 1)); /* Prologue header */
     PUT_IN_WORD_POINTER(base + (2*WORD_SIZE), PACK(DOUBLE_WORD_SIZE, 1)); /* Prologue footer */
     PUT_IN_WORD_POINTER(base + (3*WORD_SIZE), PACK(0, 1)); /* Epilogue header */
 
+    memset(ctx->heap->free_lists, 0, sizeof(ctx->heap->free_lists));
+    ctx->heap->handle_table = 0;
+    ctx->heap->handle_slots = 0;
+    ctx->heap->handle_free = 0;
+    ctx->heap->compact_cursor = 0;
+    ctx->heap->size_mean = 0;
+    ctx->heap->check_ops = 0;
+    ctx->heap->check_failures = 0;
+    if (ctx == &default_ctx)
+    {
+        /* Blocks on the fast lists belonged to the old heap */
+        memset(&mm_fast, 0, sizeof(mm_fast));
+    }
+    if (ctx->shared)
+    {
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutex_init(&ctx->heap->lock, &attr);
+        pthread_mutexattr_destroy(&attr);
+    }
+    else if (THREADSAFE)
+    {
+        pthread_mutex_init(&ctx->heap->lock, NULL);
+    }
+
     /* Extend the empty heap with a free block of CHUNKSIZE bytes */
-    if (extend_heap(CHUNK_SIZE / WORD_SIZE) == NULL)
+    if (extend_heap(ctx, CHUNK_SIZE / WORD_SIZE, LONG_REGION) == NULL)
     {
         return -1;
     }
@@ -229,15 +786,55 @@ int mm_init(void)
     return 0;
 }
 
+/*
+* mm_ctx_attach - Make ctx this process's view of the heap another
+*     process started with mm_ctx_init on a shared memlib heap, which
+*     may be mapped at a different address here. Returns 0 on success,
+*     -1 if mem holds no heap.
+*/
+int mm_ctx_attach(mm_ctx_t *ctx, mem_ctx_t *mem)
+{
+    if (mem_ctx_heapsize(mem) < HEAP_HEADER_SIZE + 4*WORD_SIZE)
+    {
+        return -1;
+    }
+    set_view(ctx, mem);
+    return 0;
+}
+
 
 /* 
-* mm_malloc - Allocate a block by incrementing the brk pointer.
+* mm_ctx_malloc - Allocate a block by incrementing the brk pointer.
 *     Always allocate a block whose size is a multiple of the alignment.
 */
-void *mm_malloc(size_t size)
+void *mm_ctx_malloc(mm_ctx_t *ctx, size_t size)
+{
+    return mm_ctx_malloc_hint(ctx, size, MM_LIFETIME_UNKNOWN);
+}
+
+/*
+* mm_ctx_malloc_hint - mm_malloc for a block the caller expects to live for
+*     lifetime. Short-lived blocks are placed in their own region of the heap.
+*/
+void *mm_ctx_malloc_hint(mm_ctx_t *ctx, size_t size, mm_lifetime_t lifetime)
+{
+    void* bp;
+
+    LOCK(ctx);
+    bp = heap_malloc(ctx, size, lifetime, 0);
+    UNLOCK(ctx);
+    return bp;
+}
+
+/*The unlocked body of mm_ctx_malloc_hint. A block that realloc is
+    resizing is split from the low end and kept out of the mean, since
+    it is likely to grow again*/
+static void* heap_malloc(mm_ctx_t* ctx, size_t size, mm_lifetime_t lifetime, int resize)
 {
     size_t adjustedSize; /* Adjusted block size */
     size_t extendSize; /* Amount to extend heap if no fit */
+    int region = (lifetime == MM_LIFETIME_SHORT) ? SHORT_REGION : LONG_REGION;
+    int high; /* Split from the high end */
     char *bp;
 
     /* Ignore spurious requests */
@@ -247,112 +844,1076 @@ void *mm_malloc(size_t size)
     }
 
     /* Adjust block size to include overhead and alignment reqs. */
-    if (size <= DOUBLE_WORD_SIZE)
+    adjustedSize = adjust_size(size);
+
+    /* Large blocks start on a page so that realloc can remap them */
+    if (adjustedSize >= REMAP_THRESHOLD)
     {
-        adjustedSize = 2*DOUBLE_WORD_SIZE;
+        if ((bp = malloc_aligned(ctx, adjustedSize, mem_pagesize(), region)) != NULL)
+        {
+            CHECK_AFTER(ctx, bp);
+        }
+        return bp;
     }
-    else
+
+    /* Search the free list for a fit. Blocks still waiting for the
+       reclaimer may make one, so they are freed before the heap grows */
+    high = !resize && place_high(ctx, adjustedSize);
+    bp = find_fit(ctx, adjustedSize, region);
+    if (bp == NULL && ctx->async != NULL && drain_queues(ctx) > 0)
     {
-        adjustedSize = DOUBLE_WORD_SIZE * ((size + (DOUBLE_WORD_SIZE) + (DOUBLE_WORD_SIZE-1)) / DOUBLE_WORD_SIZE);
+        bp = find_fit(ctx, adjustedSize, region);
     }
-
-    /* Search the free list for a fit */
-    if ((bp = find_fit(adjustedSize)) != NULL)
+    if (bp != NULL)
     {
-        place(bp, adjustedSize);
+        bp = place(ctx, bp, adjustedSize, high);
+        CHECK_AFTER(ctx, bp);
         return bp;
     }
 
     /* No fit found. Get more memory and place the block */
     extendSize = MAX(adjustedSize,CHUNK_SIZE);
-    if ((bp = extend_heap(extendSize / WORD_SIZE)) == NULL)
+    if ((bp = extend_heap(ctx, extendSize / WORD_SIZE, region)) == NULL)
     {
         return NULL;
     }
     
-    place(bp, adjustedSize);
+    bp = place(ctx, bp, adjustedSize, high);
+    CHECK_AFTER(ctx, bp);
     return bp;
 }
 
 /*
-* mm_free - Freeing a block does nothing.
+* mm_ctx_memalign - Allocate a block whose payload is a multiple of align,
+*     which must be a power of two.
 */
-void mm_free(void *ptr)
+void *mm_ctx_memalign(mm_ctx_t *ctx, size_t align, size_t size)
 {
-    size_t size = GET_SIZE(getHeaderPointer(ptr));
-    PUT_IN_WORD_POINTER(getHeaderPointer(ptr), PACK(size, 0));
-    PUT_IN_WORD_POINTER(getFooterPointer(ptr), PACK(size, 0));
-    coalesce(ptr);
+    char *bp;
+
+    if (align <= ALIGNMENT)
+    {
+        return mm_ctx_malloc(ctx, size);
+    }
+    if (size == 0 || (align & (align - 1)) != 0)
+    {
+        return NULL;
+    }
+
+    LOCK(ctx);
+    if ((bp = malloc_aligned(ctx, adjust_size(size), align, LONG_REGION)) != NULL)
+    {
+        CHECK_AFTER(ctx, bp);
+    }
+    UNLOCK(ctx);
+    return bp;
 }
 
 /*
-* mm_realloc - Implemented simply in terms of mm_malloc and mm_free
+* mm_ctx_free - Freeing a block does nothing. With a reclaimer running
+*     the block is queued for it instead.
 */
-void *mm_realloc(void *ptr, size_t size)
+void mm_ctx_free(mm_ctx_t *ctx, void *ptr)
+{
+    if (ctx->async != NULL)
+    {
+        async_free(ctx, ptr);
+        return;
+    }
+    LOCK(ctx);
+    heap_free(ctx, ptr);
+    UNLOCK(ctx);
+}
+
+/*The unlocked body of mm_ctx_free*/
+static void heap_free(mm_ctx_t* ctx, void* ptr)
+{
+    unsigned int tag = GET_AS_WORD_POINTER(getHeaderPointer(ptr)) & ~(HANDLE_BIT | 0x1); /* size and region */
+    PUT_IN_WORD_POINTER(getHeaderPointer(ptr), tag);
+    PUT_IN_WORD_POINTER(getFooterPointer(ptr), tag);
+    ptr = coalesce(ctx, ptr);
+
+    /* Keep the tags and links; the pages between them can go */
+    if (placement == MM_PLACE_RESIDENT && GET_SIZE(getHeaderPointer(ptr)) >= PURGE_MIN)
+    {
+        mem_ctx_purge(ctx->mem, (char*)ptr + DOUBLE_WORD_SIZE,
+                      GET_SIZE(getHeaderPointer(ptr)) - 2*DOUBLE_WORD_SIZE);
+    }
+    CHECK_AFTER(ctx, ptr);
+}
+
+/*Resizes allocated block bp to asize without moving it. Growing takes
+    the free block above it, extending the heap first if bp is the last
+    block; the excess is split off as place does and merged with its
+    free neighbour by coalesce. A grown block counts toward the running
+    mean, so that small blocks keep to the high end of the free space
+    it grows into. Returns bp, or NULL if the free space above is too
+    small, in which case bp is unchanged*/
+static void* resize_in_place(mm_ctx_t* ctx, char* bp, size_t asize)
+{
+    size_t csize = GET_SIZE(getHeaderPointer(bp));
+    int region = GET_REGION(getHeaderPointer(bp));
+    char* next = getNextBlockPointer(bp);
+
+    if (asize > csize)
+    {
+        if (GET_SIZE(getHeaderPointer(next)) == 0 &&
+            extend_heap(ctx, MAX(asize - csize, 2*DOUBLE_WORD_SIZE) / WORD_SIZE, region) == NULL)
+        {
+            return NULL;
+        }
+        if (IS_ALLOCATED(getHeaderPointer(next)) || GET_REGION(getHeaderPointer(next)) != region ||
+            csize + GET_SIZE(getHeaderPointer(next)) < asize)
+        {
+            return NULL;
+        }
+        remove_free_block(ctx, next);
+        absorb(ctx, bp, next);
+        csize += GET_SIZE(getHeaderPointer(next));
+        place_high(ctx, asize);
+    }
+
+    if (placement == MM_PLACE_RESIDENT)
+    {
+        mem_ctx_touch(ctx->mem, getHeaderPointer(bp), csize + 2*WORD_SIZE);
+    }
+    if ((csize - asize) < (2*DOUBLE_WORD_SIZE))
+    {
+        PUT_IN_WORD_POINTER(getHeaderPointer(bp), PACK_REGION(csize, region, 1));
+        PUT_IN_WORD_POINTER(getFooterPointer(bp), PACK_REGION(csize, region, 1));
+        return bp;
+    }
+    PUT_IN_WORD_POINTER(getHeaderPointer(bp), PACK_REGION(asize, region, 1));
+    PUT_IN_WORD_POINTER(getFooterPointer(bp), PACK_REGION(asize, region, 1));
+    next = getNextBlockPointer(bp);
+    PUT_IN_WORD_POINTER(getHeaderPointer(next), PACK_REGION(csize - asize, region, 0));
+    PUT_IN_WORD_POINTER(getFooterPointer(next), PACK_REGION(csize - asize, region, 0));
+    coalesce(ctx, next);
+    return bp;
+}
+
+/*
+* mm_ctx_malloc_at_least - Allocate at least size bytes and store in
+*     *actual how many the block can really hold, counting the rounding
+*     and any slack too small to split off.
+*/
+void *mm_ctx_malloc_at_least(mm_ctx_t *ctx, size_t size, size_t *actual)
+{
+    char* bp;
+
+    LOCK(ctx);
+    bp = heap_malloc(ctx, size, MM_LIFETIME_UNKNOWN, 0);
+    if (bp != NULL)
+    {
+        *actual = GET_SIZE(getHeaderPointer(bp)) - DOUBLE_WORD_SIZE;
+    }
+    UNLOCK(ctx);
+    return bp;
+}
+
+/*
+* mm_ctx_try_expand - Grow the block at ptr to hold at least new_size
+*     bytes without moving it. Returns how many bytes it now holds, or 0
+*     if there is no room above it, in which case it is left as it was.
+*     A block never shrinks here.
+*/
+size_t mm_ctx_try_expand(mm_ctx_t *ctx, void *ptr, size_t new_size)
+{
+    size_t asize = adjust_size(new_size);
+    size_t actual = 0;
+
+    LOCK(ctx);
+    if (asize <= GET_SIZE(getHeaderPointer(ptr)) || resize_in_place(ctx, ptr, asize) != NULL)
+    {
+        actual = GET_SIZE(getHeaderPointer(ptr)) - DOUBLE_WORD_SIZE;
+        CHECK_AFTER(ctx, ptr);
+    }
+    UNLOCK(ctx);
+    return actual;
+}
+
+/*
+* mm_ctx_realloc - Resizes the block in place when its neighbour above
+*     has room, and otherwise is implemented simply in terms of mm_malloc
+*     and mm_free, which also run the heap checker for it. Large payloads
+*     are moved by remapping their pages rather than copying them. The
+*     new block is placed in the old one's region.
+*/
+void *mm_ctx_realloc(mm_ctx_t *ctx, void *ptr, size_t size)
 {
     void *oldptr = ptr;
     void *newptr;
     size_t copySize;
 
-    newptr = mm_malloc(size);
+    LOCK(ctx);
+    if (size > 0 && resize_in_place(ctx, oldptr, adjust_size(size)) != NULL)
+    {
+        CHECK_AFTER(ctx, oldptr);
+        UNLOCK(ctx);
+        return oldptr;
+    }
+    newptr = heap_malloc(ctx, size, GET_REGION(getHeaderPointer(oldptr)) == SHORT_REGION ?
+                            MM_LIFETIME_SHORT : MM_LIFETIME_LONG, 1);
     if (newptr == NULL)
     {
+        UNLOCK(ctx);
         return NULL;
     }
-    copySize = GET_SIZE(getHeaderPointer(oldptr));
+    copySize = GET_SIZE(getHeaderPointer(oldptr)) - DOUBLE_WORD_SIZE;
     if (size < copySize)
     {
         copySize = size;
     }
-    memcpy(newptr, oldptr, copySize);
-    mm_free(oldptr);
+    copy_payload(ctx, newptr, oldptr, copySize);
+    heap_free(ctx, oldptr);
+    UNLOCK(ctx);
     return newptr;
 }
 
-/*Checks consistency of heap
-    -Checks invariants
-    -Prints error messages
-    -Returns non-zero value if heap is consistent
-*/
-static int mm_check(void)
+/*Queues ptr for the reclaimer on the calling thread's queue, or frees it
+    here if the queue is full*/
+static void async_free(mm_ctx_t* ctx, void* ptr)
 {
-    void* ptr;
-    size_t* heap_top =  mem_heap_hi();
-    size_t* heap_bot =  mem_heap_lo();
-    size_t* heap_size = mem_heapsize();
+    struct free_queue* q = my_queue;
+    unsigned int head;
+    unsigned int tail;
 
-    assert(heap_bot < (heap_top + heap_size));
-    
-    for(ptr = heap_top; GET_SIZE(getHeaderPointer(ptr)) > 0; ptr = getNextBlockPointer(ptr)) 
-    {      
-        if ((int)ptr > (int)heap_top)
-        {
-            printf("ERROR: Top of heap exceeded by pointer\n top: %p,\n pointer: %p\n", heap_top, ptr);
-        }
-        if ((int)ptr > (int)heap_bot || (int)ptr < (int)heap_top)
-        {        
-            printf("Error: pointer %p out of heap bounds\n", ptr);
-        }
-        if (IS_ALLOCATED(getHeaderPointer(ptr)) == 0 && IS_ALLOCATED(getHeaderPointer(getNextBlockPointer(ptr))) == 0)
+    if (q == NULL || my_generation != ctx->async->generation)
+    {
+        q = find_queue(ctx->async);
+    }
+    if (q != NULL)
+    {
+        head = q->head;
+        tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+        if (head - tail < q->depth)
         {
-            printf("Error: Empty stacked blocks %p and %p not coalesced\n", ptr, getNextBlockPointer(ptr));
+            q->slots[head & (q->depth - 1)] = ptr;
+            __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+            if (head - tail == q->depth / 2 &&
+                __atomic_load_n(&ctx->async->sleeping, __ATOMIC_RELAXED))
+            {
+                pthread_cond_signal(&ctx->async->wake);
+            }
+            return;
         }
-        if ((size_t)ptr % 8)
-        {
-            printf("Error: %p misaligned our headers and payload\n", ptr);
+    }
+
+    /* Backpressure: the caller pays for the free */
+    LOCK(ctx);
+    heap_free(ctx, ptr);
+    UNLOCK(ctx);
+}
+
+/*Returns the calling thread's queue on async, creating it on first use;
+    NULL if there is no memory for one*/
+static struct free_queue* find_queue(struct mm_async* async)
+{
+    struct free_queue* q;
+    pthread_t self = pthread_self();
+
+    pthread_mutex_lock(&async->wake_lock);
+    q = async->queues;
+    while (q != NULL && !pthread_equal(q->owner, self))
+    {
+        q = q->next;
+    }
+    if (q == NULL && (q = calloc(1, sizeof(struct free_queue))) != NULL)
+    {
+        if ((q->slots = malloc(async->depth * sizeof(void*))) == NULL)
+        {
+            free(q);
+            q = NULL;
+        }
+        else
+        {
+            q->depth = async->depth;
+            q->owner = self;
+            q->next = async->queues;
+            __atomic_store_n(&async->queues, q, __ATOMIC_RELEASE);
         }
     }
+    pthread_mutex_unlock(&async->wake_lock);
 
-    int i;
-    for (i = 0; i < 100; i++) 
+    if (q != NULL)
+    {
+        my_queue = q;
+        my_generation = async->generation;
+    }
+    return q;
+}
+
+/*Frees everything waiting on ctx's queues. The caller holds the heap
+    lock, which makes it the queues' only consumer. Returns the number of
+    blocks freed*/
+static int drain_queues(mm_ctx_t* ctx)
+{
+    struct free_queue* q;
+    unsigned int head;
+    unsigned int tail;
+    int freed = 0;
+
+    for (q = __atomic_load_n(&ctx->async->queues, __ATOMIC_ACQUIRE); q != NULL; q = q->next)
+    {
+        tail = q->tail;
+        head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+        for (; tail != head; tail++)
+        {
+            heap_free(ctx, q->slots[tail & (q->depth - 1)]);
+            freed++;
+        }
+        __atomic_store_n(&q->tail, tail, __ATOMIC_RELEASE);
+    }
+    return freed;
+}
+
+/*The reclaimer thread: drains the queues until told to stop, sleeping
+    while they are empty*/
+static void* reclaim(void* arg)
+{
+    struct mm_async* async = arg;
+    mm_ctx_t* ctx = async->ctx;
+    struct timespec until;
+    int stopping;
+    int freed;
+
+    for (;;)
     {
-        ptr = (char*)GET_AS_WORD_POINTER(heap_bot + (i * WSIZE));
-        while (ptr != NULL) 
+        stopping = __atomic_load_n(&async->stop, __ATOMIC_ACQUIRE);
+        LOCK(ctx);
+        freed = drain_queues(ctx);
+        UNLOCK(ctx);
+        if (freed > 0)
+        {
+            continue;
+        }
+        if (stopping)
+        {
+            return NULL;
+        }
+
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += ASYNC_IDLE_NS;
+        if (until.tv_nsec >= 1000000000)
         {
-            assert(!IS_ALLOCATED(ptr));
-            ptr = (char*)GET_AS_WORD_POINTER(ptr);
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000;
         }
+        pthread_mutex_lock(&async->wake_lock);
+        if (!async->stop)
+        {
+            __atomic_store_n(&async->sleeping, 1, __ATOMIC_RELAXED);
+            pthread_cond_timedwait(&async->wake, &async->wake_lock, &until);
+            __atomic_store_n(&async->sleeping, 0, __ATOMIC_RELAXED);
+        }
+        pthread_mutex_unlock(&async->wake_lock);
+    }
+}
+
+/*
+* mm_ctx_async_start - Hand frees on ctx to a background thread, which
+*     does the coalescing and purging. Each freeing thread queues up to
+*     depth blocks (rounded up to a power of two; 0 for the default)
+*     before it has to free them itself. Returns 0 on success, -1 if
+*     the thread could not be started or one is already running.
+*/
+int mm_ctx_async_start(mm_ctx_t *ctx, unsigned int depth)
+{
+    struct mm_async* async;
+    unsigned int slots = 1;
+
+    if (ctx->async != NULL || (async = calloc(1, sizeof(struct mm_async))) == NULL)
+    {
+        return -1;
+    }
+    while (slots < (depth > 0 ? depth : ASYNC_DEPTH_DEFAULT))
+    {
+        slots <<= 1;
+    }
+    async->ctx = ctx;
+    async->depth = slots;
+    async->generation = __atomic_add_fetch(&async_generation, 1, __ATOMIC_RELAXED);
+    pthread_mutex_init(&async->wake_lock, NULL);
+    pthread_cond_init(&async->wake, NULL);
+
+    /* A private heap has not needed its lock until now */
+    if (!ctx->shared && !THREADSAFE)
+    {
+        pthread_mutex_init(&ctx->heap->lock, NULL);
+    }
+    ctx->async = async;
+    if (pthread_create(&async->thread, NULL, reclaim, async) != 0)
+    {
+        ctx->async = NULL;
+        pthread_cond_destroy(&async->wake);
+        pthread_mutex_destroy(&async->wake_lock);
+        free(async);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+* mm_ctx_async_stop - Wait for the reclaimer to free everything queued,
+*     and go back to freeing in the caller. No other thread may be
+*     freeing on ctx while it runs.
+*/
+void mm_ctx_async_stop(mm_ctx_t *ctx)
+{
+    struct mm_async* async = ctx->async;
+    struct free_queue* q;
+
+    if (async == NULL)
+    {
+        return;
+    }
+    pthread_mutex_lock(&async->wake_lock);
+    async->stop = 1;
+    pthread_cond_signal(&async->wake);
+    pthread_mutex_unlock(&async->wake_lock);
+    pthread_join(async->thread, NULL);
+
+    ctx->async = NULL;
+    while ((q = async->queues) != NULL)
+    {
+        async->queues = q->next;
+        free(q->slots);
+        free(q);
+    }
+    pthread_cond_destroy(&async->wake);
+    pthread_mutex_destroy(&async->wake_lock);
+    free(async);
+}
+
+/*Doubles the handle table, chaining the new slots onto the free list.
+    Only called when no slot is free*/
+static int grow_handles(mm_ctx_t* ctx)
+{
+    unsigned int slots = (ctx->heap->handle_slots > 0) ? 2*ctx->heap->handle_slots : HANDLE_TABLE_MIN;
+    unsigned int* table = heap_malloc(ctx, slots * sizeof(unsigned int), MM_LIFETIME_LONG, 0);
+    unsigned int i;
+
+    if (table == NULL)
+    {
+        return -1;
+    }
+    if (ctx->heap->handle_table != 0)
+    {
+        memcpy(table, HANDLE_TABLE(ctx), ctx->heap->handle_slots * sizeof(unsigned int));
+        heap_free(ctx, HANDLE_TABLE(ctx));
+    }
+    for (i = ctx->heap->handle_slots; i < slots; i++)
+    {
+        table[i] = ((i + 1 < slots ? i + 2 : 0) << 1) | 1;
     }
 
+    ctx->heap->handle_free = ctx->heap->handle_slots + 1;
+    ctx->heap->handle_table = TO_OFFSET(ctx, table);
+    ctx->heap->handle_slots = slots;
     return 0;
-}
\ No newline at end of file
+}
+
+/*
+* mm_ctx_halloc - Allocate a movable block and return its handle, or 0.
+*     The block's address, from mm_hderef, is only good until the next
+*     call to mm_compact.
+*/
+mm_handle_t mm_ctx_halloc(mm_ctx_t *ctx, size_t size)
+{
+    unsigned int slot;
+    char* bp = NULL;
+
+    LOCK(ctx);
+    if (size > 0 && (ctx->heap->handle_free > 0 || grow_handles(ctx) == 0))
+    {
+        bp = heap_malloc(ctx, size + DOUBLE_WORD_SIZE, MM_LIFETIME_UNKNOWN, 0);
+    }
+    if (bp == NULL)
+    {
+        UNLOCK(ctx);
+        return 0;
+    }
+
+    slot = ctx->heap->handle_free - 1;
+    ctx->heap->handle_free = HANDLE_TABLE(ctx)[slot] >> 1;
+    HANDLE_TABLE(ctx)[slot] = TO_OFFSET(ctx, bp);
+    HANDLE_OF(bp) = slot + 1;
+    PUT_IN_WORD_POINTER(getHeaderPointer(bp), GET_AS_WORD_POINTER(getHeaderPointer(bp)) | HANDLE_BIT);
+    PUT_IN_WORD_POINTER(getFooterPointer(bp), GET_AS_WORD_POINTER(getFooterPointer(bp)) | HANDLE_BIT);
+    UNLOCK(ctx);
+    return slot + 1;
+}
+
+/*
+* mm_ctx_hderef - Current address of handle h's payload
+*/
+void *mm_ctx_hderef(mm_ctx_t *ctx, mm_handle_t h)
+{
+    char* bp;
+
+    LOCK(ctx);
+    bp = FROM_OFFSET(ctx, HANDLE_TABLE(ctx)[h - 1]);
+    UNLOCK(ctx);
+    return bp + DOUBLE_WORD_SIZE;
+}
+
+/*
+* mm_ctx_hfree - Free handle h and its block
+*/
+void mm_ctx_hfree(mm_ctx_t *ctx, mm_handle_t h)
+{
+    char* bp;
+
+    LOCK(ctx);
+    bp = FROM_OFFSET(ctx, HANDLE_TABLE(ctx)[h - 1]);
+    HANDLE_TABLE(ctx)[h - 1] = (ctx->heap->handle_free << 1) | 1;
+    ctx->heap->handle_free = h;
+    heap_free(ctx, bp);
+    UNLOCK(ctx);
+}
+
+/*Moves the movable block after free block fp down to fp's address,
+    leaving the free space after it. The block takes on fp's region,
+    as the free space does*/
+static void slide(mm_ctx_t* ctx, char* fp)
+{
+    char* hp = getNextBlockPointer(fp);
+    unsigned int tag = GET_AS_WORD_POINTER(getHeaderPointer(fp)); /* size and region */
+    unsigned int moved;
+    size_t hsize = GET_SIZE(getHeaderPointer(hp));
+
+    remove_free_block(ctx, fp);
+    memmove(getHeaderPointer(fp), getHeaderPointer(hp), hsize);
+    HANDLE_TABLE(ctx)[HANDLE_OF(fp) - 1] = TO_OFFSET(ctx, fp);
+    moved = (GET_AS_WORD_POINTER(getHeaderPointer(fp)) & ~PACK_REGION(0, 1, 0)) |
+        (tag & PACK_REGION(0, 1, 0));
+    PUT_IN_WORD_POINTER(getHeaderPointer(fp), moved);
+    PUT_IN_WORD_POINTER(getFooterPointer(fp), moved);
+
+    hp = fp + hsize;
+    PUT_IN_WORD_POINTER(getHeaderPointer(hp), tag);
+    PUT_IN_WORD_POINTER(getFooterPointer(hp), tag);
+    coalesce(ctx, hp);
+}
+
+/*Gives up to limit bytes of a free block at the top of the heap back to
+    memlib. The limit bounds the time spent releasing pages*/
+static void trim_heap(mm_ctx_t* ctx, size_t limit)
+{
+    char* epilogue = (char*)mem_ctx_heap_hi(ctx->mem) + 1;
+    unsigned int tag = GET_AS_WORD_POINTER(epilogue - DOUBLE_WORD_SIZE);
+    size_t size = GET_SIZE(epilogue - DOUBLE_WORD_SIZE);
+    size_t cut = size;
+    char* bp = epilogue - size;
+
+    if (IS_ALLOCATED(epilogue - DOUBLE_WORD_SIZE) || size < CHUNK_SIZE)
+    {
+        return;
+    }
+    if (cut > limit)
+    {
+        cut = limit & ~(size_t)(CHUNK_SIZE - 1);
+    }
+    /* What stays behind must still make a block */
+    if (cut < size && size - cut < 2*DOUBLE_WORD_SIZE)
+    {
+        cut -= CHUNK_SIZE;
+    }
+    if (cut == 0)
+    {
+        return;
+    }
+
+    remove_free_block(ctx, bp);
+    mem_ctx_sbrk(ctx->mem, -(intptr_t)cut);
+    if (cut < size)
+    {
+        PUT_IN_WORD_POINTER(getHeaderPointer(bp), tag - cut);
+        PUT_IN_WORD_POINTER(getFooterPointer(bp), tag - cut);
+        insert_free_block(ctx, bp);
+    }
+    PUT_IN_WORD_POINTER(epilogue - cut - WORD_SIZE, PACK(0, 1)); /* New epilogue header */
+}
+
+/*
+* mm_ctx_compact - Run the compactor for about budget bytes of work. Each
+*     pass walks the heap from the bottom, sliding movable blocks down
+*     over the free space below them, and trims the heap when it reaches
+*     the top. Returns 0 when a pass has just finished, 1 otherwise.
+*/
+int mm_ctx_compact(mm_ctx_t *ctx, size_t budget)
+{
+    size_t spent = 0;
+    char* bp;
+
+    LOCK(ctx);
+    if (ctx->heap->compact_cursor == 0)
+    {
+        ctx->heap->compact_cursor = HEAP_BASE_OFFSET;
+    }
+
+    while (spent < budget)
+    {
+        bp = FROM_OFFSET(ctx, ctx->heap->compact_cursor);
+        if (GET_SIZE(getHeaderPointer(bp)) == 0)
+        {
+            trim_heap(ctx, budget * COMPACT_TRIM_RATIO);
+            ctx->heap->compact_cursor = 0;
+            UNLOCK(ctx);
+            return 0;
+        }
+        if (!IS_ALLOCATED(getHeaderPointer(bp)) && IS_HANDLE(getHeaderPointer(getNextBlockPointer(bp))))
+        {
+            slide(ctx, bp);
+            spent += GET_SIZE(getHeaderPointer(bp));
+        }
+        else
+        {
+            spent += COMPACT_VISIT_COST;
+        }
+        ctx->heap->compact_cursor = TO_OFFSET(ctx, getNextBlockPointer(bp));
+    }
+
+    UNLOCK(ctx);
+    return 1;
+}
+
+/*Checks that movable block bp is the one its handle points at*/
+static int check_handle(mm_ctx_t* ctx, char* bp)
+{
+    unsigned int h = HANDLE_OF(bp);
+
+    if (!IS_ALLOCATED(getHeaderPointer(bp)) || h == 0 || h > ctx->heap->handle_slots ||
+        HANDLE_TABLE(ctx)[h - 1] != TO_OFFSET(ctx, bp))
+    {
+        printf("Error: movable block %p is not owned by its handle %u\n", bp, h);
+        return 0;
+    }
+
+    return 1;
+}
+
+/*Checks one block: alignment, bounds, size and matching boundary tags*/
+static int check_block(mm_ctx_t* ctx, char* bp)
+{
+    char* lo = ctx->heap_base + HEAP_BASE_OFFSET;
+    char* hi = (char*)mem_ctx_heap_hi(ctx->mem);
+    size_t size;
+
+    if ((size_t)bp % DOUBLE_WORD_SIZE)
+    {
+        printf("Error: %p misaligned our headers and payload\n", bp);
+        return 0;
+    }
+    if (bp < lo || bp > hi)
+    {
+        printf("Error: pointer %p out of heap bounds (%p:%p)\n", bp, lo, hi);
+        return 0;
+    }
+    
+    size = GET_SIZE(getHeaderPointer(bp));
+    if (size % DOUBLE_WORD_SIZE || (bp != lo && size < 2*DOUBLE_WORD_SIZE) ||
+        bp + size > hi + 1)
+    {      
+        printf("Error: block %p has a bad size %lu\n", bp, (unsigned long)size);
+        return 0;
+    }
+    if (GET_AS_WORD_POINTER(getHeaderPointer(bp)) != GET_AS_WORD_POINTER(getFooterPointer(bp)))
+    {
+        printf("Error: block %p header %#x does not match footer %#x\n", bp,
+               GET_AS_WORD_POINTER(getHeaderPointer(bp)), GET_AS_WORD_POINTER(getFooterPointer(bp)));
+        return 0;
+    }
+
+    return 1;
+}
+
+/*Checks that free block bp sits on the right list and that its
+    neighbours on that list point back at it*/
+static int check_links(mm_ctx_t* ctx, char* bp)
+{
+    int class = size_class(GET_SIZE(getHeaderPointer(bp)));
+    int region = GET_REGION(getHeaderPointer(bp));
+    unsigned int next = NEXT_FREE(bp);
+    unsigned int prev = PREV_FREE(bp);
+
+    if (prev == 0 ? ctx->heap->free_lists[region][class] != TO_OFFSET(ctx, bp) :
+        (IS_ALLOCATED(getHeaderPointer(FROM_OFFSET(ctx, prev))) || NEXT_FREE(FROM_OFFSET(ctx, prev)) != TO_OFFSET(ctx, bp)))
+    {
+        printf("Error: free block %p is not linked from its predecessor\n", bp);
+        return 0;
+    }
+    if (next != 0 && (IS_ALLOCATED(getHeaderPointer(FROM_OFFSET(ctx, next))) || PREV_FREE(FROM_OFFSET(ctx, next)) != TO_OFFSET(ctx, bp)))
+    {
+        printf("Error: free block %p is not linked from its successor\n", bp);
+        return 0;
+    }
+
+    return 1;
+}
+
+/*Walks every free list, checking each entry and that together they hold
+    exactly the nfree free blocks found in the heap*/
+static int check_free_lists(mm_ctx_t* ctx, unsigned long nfree)
+{
+    unsigned long count = 0;
+    unsigned int off;
+    char* bp;
+    int class;
+    int region;
+
+    for (region = 0; region < REGIONS; region++)
+    {
+        for (class = 0; class < SIZE_CLASSES; class++)
+        {
+            for (off = ctx->heap->free_lists[region][class]; off != 0 && count <= nfree; off = NEXT_FREE(bp), count++)
+            {
+                bp = FROM_OFFSET(ctx, off);
+                if (!check_block(ctx, bp) || IS_ALLOCATED(getHeaderPointer(bp)) || !check_links(ctx, bp))
+                {
+                    printf("Error: bad entry %p on free list %d.%d\n", bp, region, class);
+                    return 0;
+                }
+                if (size_class(GET_SIZE(getHeaderPointer(bp))) != class || GET_REGION(getHeaderPointer(bp)) != region)
+                {
+                    printf("Error: free block %p of %u bytes is on list %d.%d\n", bp, GET_SIZE(getHeaderPointer(bp)), region, class);
+                    return 0;
+                }
+            }
+        }
+    }
+    if (count != nfree)
+    {
+        printf("Error: %lu blocks on the free lists but %lu free in the heap\n", count, nfree);
+        return 0;
+    }
+
+    return 1;
+}
+
+/*Walks the blocks in [bp, end), stopping early at the epilogue.
+    Returns the number of problems found, where the walk stopped and
+    how many free blocks it passed*/
+static int check_range(mm_ctx_t* ctx, char* bp, char* end, char** stop, unsigned long* nfree)
+{
+    int errors = 0;
+
+    *nfree = 0;
+    for (; bp < end && GET_SIZE(getHeaderPointer(bp)) > 0; bp = getNextBlockPointer(bp))
+    {
+        if (!check_block(ctx, bp))
+        {
+            *stop = NULL;
+            return errors + 1; /* Sizes can no longer be trusted */
+        }
+        if (!IS_ALLOCATED(getHeaderPointer(bp)) && !IS_ALLOCATED(getHeaderPointer(getNextBlockPointer(bp))) &&
+            GET_REGION(getHeaderPointer(bp)) == GET_REGION(getHeaderPointer(getNextBlockPointer(bp))))
+        {        
+            printf("Error: Empty stacked blocks %p and %p not coalesced\n", bp, (char*)getNextBlockPointer(bp));
+            errors++;
+        }
+        if (!IS_ALLOCATED(getHeaderPointer(bp)))
+        {
+            (*nfree)++;
+        }
+        if (IS_HANDLE(getHeaderPointer(bp)) && !check_handle(ctx, bp))
+        {
+            errors++;
+        }
+    }
+
+    *stop = bp;
+    return errors;
+}
+
+/*Arguments and result of one parallel walk thread*/
+typedef struct {
+    mm_ctx_t* ctx;
+    char* start;
+    char* end;
+    char* stop;
+    unsigned long nfree;
+    int errors;
+    pthread_t tid;
+} check_segment_t;
+
+static void* check_segment(void* arg)
+{
+    check_segment_t* seg = arg;
+    seg->errors = check_range(seg->ctx, seg->start, seg->end, &seg->stop, &seg->nfree);
+    return NULL;
+}
+
+/*Checks consistency of heap
+    -Walks every block and checks its invariants
+    -Checks that the last block ends at the epilogue
+    -Prints error messages
+    -Returns non-zero value if heap is consistent
+
+    With parallel set, a header-only pass splits a large heap into
+    segments on block boundaries, and the full checks on each segment
+    then run on their own thread.
+*/
+static int check_heap(mm_ctx_t* ctx, int parallel)
+{
+    char* first = ctx->heap_base + HEAP_BASE_OFFSET;
+    char* epilogue = (char*)mem_ctx_heap_hi(ctx->mem) + 1;
+    size_t heapsize = mem_ctx_heapsize(ctx->mem);
+    check_segment_t segs[CHECK_MAX_THREADS];
+    unsigned long nfree = 0;
+    int nsegs = 1;
+    int errors = 0;
+    int i;
+    char* bp;
+
+    segs[0].start = first;
+    if (parallel && heapsize >= CHECK_PARALLEL_MIN)
+    {
+        long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        int wanted = (ncpus > CHECK_MAX_THREADS) ? CHECK_MAX_THREADS : (int)ncpus;
+        size_t step = heapsize / (wanted > 0 ? wanted : 1);
+
+        for (bp = first; GET_SIZE(getHeaderPointer(bp)) > 0 && nsegs < wanted; bp = getNextBlockPointer(bp))
+        {
+            if (bp >= epilogue)
+            {
+                break; /* check_range reports the broken size */
+            }
+            if (bp >= first + nsegs * step)
+            {
+                segs[nsegs - 1].end = bp;
+                segs[nsegs++].start = bp;
+            }
+        }
+    }
+    segs[nsegs - 1].end = epilogue;
+
+    for (i = 0; i < nsegs; i++)
+    {
+        segs[i].ctx = ctx;
+    }
+    for (i = 1; i < nsegs; i++)
+    {
+        if (pthread_create(&segs[i].tid, NULL, check_segment, &segs[i]) != 0)
+        {
+            segs[i].tid = pthread_self(); /* Run it inline below instead */
+            check_segment(&segs[i]);
+        }
+    }
+    check_segment(&segs[0]);
+    for (i = 0; i < nsegs; i++)
+    {
+        if (i > 0 && !pthread_equal(segs[i].tid, pthread_self()))
+        {
+            pthread_join(segs[i].tid, NULL);
+        }
+        errors += segs[i].errors;
+        nfree += segs[i].nfree;
+    }
+
+    /* The blocks must tile the heap exactly, up to the epilogue */
+    bp = segs[nsegs - 1].stop;
+    if (errors == 0 && (bp != epilogue || !IS_ALLOCATED(getHeaderPointer(bp))))
+    {
+        printf("Error: epilogue at %p, expected %p\n", bp, epilogue);
+        errors++;
+    }
+
+    /* The free lists are walked once, after the segments are done */
+    if (errors == 0 && !check_free_lists(ctx, nfree))
+    {
+        errors++;
+    }
+
+    return errors == 0;
+}
+
+/*Checks the blocks within CHECK_WINDOW of bp in both directions*/
+static int check_window(mm_ctx_t* ctx, char* bp)
+{
+    char* first = ctx->heap_base + HEAP_BASE_OFFSET;
+    char* end;
+    unsigned long nfree;
+    int i;
+
+    if (!check_block(ctx, bp) || (!IS_ALLOCATED(getHeaderPointer(bp)) && !check_links(ctx, bp)))
+    {
+        return 0;
+    }
+    for (i = 0; i < CHECK_WINDOW && bp > first; i++)
+    {
+        char* prev = getPreviousBlockPointer(bp);
+        if (prev < first || !check_block(ctx, prev))
+        {
+            printf("Error: block before %p is corrupt\n", bp);
+            return 0;
+        }
+        bp = prev;
+    }
+    for (end = bp, i = 0; i < 2*CHECK_WINDOW + 1 && GET_SIZE(getHeaderPointer(end)) > 0; i++)
+    {
+        end = getNextBlockPointer(end);
+    }
+
+    return check_range(ctx, bp, end, &end, &nfree) == 0;
+}
+
+/*Runs after every operation while checking is on. The counts live in
+    the heap, under its lock, like the rest of its state*/
+static void check_after(mm_ctx_t* ctx, void* bp)
+{
+    int ok = 1;
+
+    if (check_level == MM_CHECK_SAMPLED)
+    {
+        ok = check_window(ctx, bp);
+    }
+    else if (++ctx->heap->check_ops >= check_period)
+    {
+        ctx->heap->check_ops = 0;
+        ok = check_heap(ctx, check_level == MM_CHECK_PARALLEL);
+    }
+
+    if (!ok)
+    {
+        printf("mm_check: heap inconsistent after operation on %p\n", bp);
+        ctx->heap->check_failures++;
+    }
+}
+
+/*Selects how much checking runs after each operation, on every heap.
+    Each heap counts its operations and failures from mm_ctx_init*/
+void mm_setcheck(mm_check_t level, unsigned long period)
+{
+    check_level = level;
+    check_period = (period > 0) ? period : 1;
+}
+
+/*Returns the number of failed checks on the heap since mm_ctx_init*/
+int mm_ctx_checkfailures(mm_ctx_t *ctx)
+{
+    int failures;
+
+    LOCK(ctx);
+    failures = ctx->heap->check_failures;
+    UNLOCK(ctx);
+    return failures;
+}
+
+/*Checks consistency of the whole heap on demand.
+    Returns non-zero value if heap is consistent*/
+int mm_ctx_check(mm_ctx_t *ctx)
+{
+    int ok;
+
+    LOCK(ctx);
+    ok = check_heap(ctx, 0);
+    UNLOCK(ctx);
+    return ok;
+}
+
+/*
+* The plain mm_ functions work on the default context, which mm_init
+* starts on memlib's default heap.
+*/
+mm_ctx_t *mm_default(void)
+{
+    return &default_ctx;
+}
+
+int mm_init(void)
+{
+    return mm_ctx_init(&default_ctx, mem_default());
+}
+
+/*Returns every block on the calling thread's fast lists to the heap*/
+void mm_fast_flush(void)
+{
+    int class;
+    void* bp;
+
+    for (class = 0; class < MM_FAST_CLASSES; class++)
+    {
+        while ((bp = mm_fast.head[class]) != NULL)
+        {
+            mm_fast.head[class] = *(void**)bp;
+            mm_free(bp);
+        }
+        mm_fast.count[class] = 0;
+    }
+}
+
+void *mm_malloc(size_t size)
+{
+    return mm_ctx_malloc(&default_ctx, size);
+}
+
+void *mm_malloc_hint(size_t size, mm_lifetime_t lifetime)
+{
+    return mm_ctx_malloc_hint(&default_ctx, size, lifetime);
+}
+
+void *mm_memalign(size_t align, size_t size)
+{
+    return mm_ctx_memalign(&default_ctx, align, size);
+}
+
+void mm_free(void *ptr)
+{
+    mm_ctx_free(&default_ctx, ptr);
+}
+
+void *mm_realloc(void *ptr, size_t size)
+{
+    return mm_ctx_realloc(&default_ctx, ptr, size);
+}
+
+void *mm_malloc_at_least(size_t size, size_t *actual)
+{
+    return mm_ctx_malloc_at_least(&default_ctx, size, actual);
+}
+
+size_t mm_try_expand(void *ptr, size_t new_size)
+{
+    return mm_ctx_try_expand(&default_ctx, ptr, new_size);
+}
+
+mm_handle_t mm_halloc(size_t size)
+{
+    return mm_ctx_halloc(&default_ctx, size);
+}
+
+void *mm_hderef(mm_handle_t h)
+{
+    return mm_ctx_hderef(&default_ctx, h);
+}
+
+void mm_hfree(mm_handle_t h)
+{
+    mm_ctx_hfree(&default_ctx, h);
+}
+
+int mm_compact(size_t budget)
+{
+    return mm_ctx_compact(&default_ctx, budget);
+}
+
+int mm_async_start(unsigned int depth)
+{
+    return mm_ctx_async_start(&default_ctx, depth);
+}
+
+void mm_async_stop(void)
+{
+    mm_ctx_async_stop(&default_ctx);
+}
+
+int mm_check(void)
+{
+    return mm_ctx_check(&default_ctx);
+}
+
+int mm_checkfailures(void)
+{
+    return mm_ctx_checkfailures(&default_ctx);
+}
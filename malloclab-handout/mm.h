@@ -4,6 +4,159 @@ extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
+extern void *mm_memalign(size_t align, size_t size);
+
+/* Capacity-aware allocation for growable containers: the real usable
+   size of a new block, and growth in place that never moves the block */
+extern void *mm_malloc_at_least(size_t size, size_t *actual);
+extern size_t mm_try_expand(void *ptr, size_t new_size);
+
+/*
+ * Inline fast path for small blocks whose size is known at compile time.
+ * mm_free_small keeps up to MM_FAST_DEPTH blocks of each size class on
+ * a list of their own, still allocated as far as the heap is concerned,
+ * and mm_malloc_small pops them back without a call. A miss, or a full
+ * list, falls back to mm_malloc and mm_free. The lists serve the default
+ * heap, and each thread has lists of its own, so the path takes no lock
+ * even in an MM_THREADSAFE build. mm_init, or mm_ctx_init on the default
+ * heap, empties the calling thread's lists; other threads must have
+ * stopped using theirs by then. mm_fast_flush returns the calling
+ * thread's blocks to the heap, as a thread should before it exits.
+ */
+#define MM_FAST_MAX     120 /* largest request the lists serve */
+#define MM_FAST_CLASSES 15  /* one per block size, 16 to 128 bytes */
+#define MM_FAST_DEPTH   64  /* blocks kept per class */
+
+/* The class of a request, as mm_malloc would size its block */
+#define MM_FAST_CLASS(size) (((size) + 15) / 8 - 2)
+
+typedef struct {
+    void *head[MM_FAST_CLASSES];         /* next link in each block's payload */
+    unsigned int count[MM_FAST_CLASSES];
+} mm_fast_t;
+
+extern __thread mm_fast_t mm_fast;
+extern void mm_fast_flush(void);
+
+static inline void *mm_malloc_small(size_t size)
+{
+    void *p;
+
+    if (size > 0 && size <= MM_FAST_MAX &&
+        (p = mm_fast.head[MM_FAST_CLASS(size)]) != NULL) {
+        mm_fast.head[MM_FAST_CLASS(size)] = *(void **)p;
+        mm_fast.count[MM_FAST_CLASS(size)]--;
+        return p;
+    }
+    return mm_malloc(size);
+}
+
+/* size must be the size p was allocated with */
+static inline void mm_free_small(void *p, size_t size)
+{
+    if (size > 0 && size <= MM_FAST_MAX &&
+        mm_fast.count[MM_FAST_CLASS(size)] < MM_FAST_DEPTH) {
+        *(void **)p = mm_fast.head[MM_FAST_CLASS(size)];
+        mm_fast.head[MM_FAST_CLASS(size)] = p;
+        mm_fast.count[MM_FAST_CLASS(size)]++;
+        return;
+    }
+    mm_free(p);
+}
+
+/* How long the caller expects a block to live, for mm_malloc_hint */
+typedef enum {
+    MM_LIFETIME_UNKNOWN, /* no prediction; placed like a long-lived block */
+    MM_LIFETIME_SHORT,   /* freed soon; kept apart from the rest of the heap */
+    MM_LIFETIME_LONG
+} mm_lifetime_t;
+
+extern void *mm_malloc_hint(size_t size, mm_lifetime_t lifetime);
+
+/* Movable blocks, reached through a handle that survives compaction */
+typedef unsigned int mm_handle_t; /* 0 is never a valid handle */
+
+extern mm_handle_t mm_halloc(size_t size);
+extern void *mm_hderef(mm_handle_t h);
+extern void mm_hfree(mm_handle_t h);
+extern int mm_compact(size_t budget);
+
+/* How mm_malloc picks among free blocks, selected with mm_setplacement */
+typedef enum {
+    MM_PLACE_FIRST_FIT, /* first block in the size's class that fits */
+    MM_PLACE_RESIDENT   /* prefer resident pages; purge big free blocks */
+} mm_placement_t;
+
+extern void mm_setplacement(mm_placement_t policy);
+
+/* Which end of a free block mm_malloc splits from, set with mm_setsplit */
+typedef enum {
+    MM_SPLIT_LOW,    /* always the low end */
+    MM_SPLIT_BY_SIZE /* smaller than the recent mean from the high end */
+} mm_split_t;
+
+extern void mm_setsplit(mm_split_t policy);
+
+/* Frees handed to a background thread; depth bounds each thread's queue */
+extern int mm_async_start(unsigned int depth);
+extern void mm_async_stop(void);
+
+/* Heap checking run after each operation, selected with mm_setcheck */
+typedef enum {
+    MM_CHECK_OFF,      /* no checking */
+    MM_CHECK_SAMPLED,  /* a few blocks either side of the touched block */
+    MM_CHECK_PERIODIC, /* full heap walk every period operations */
+    MM_CHECK_PARALLEL  /* full walk, split across threads on large heaps */
+} mm_check_t;
+
+/*
+ * Independent heaps. Each manages one memlib heap, created with
+ * mem_ctx_init, and keeps its state at the bottom of it; mm_ctx_init
+ * on a heap in use empties it in O(1). A context is one process's
+ * view of a heap. On a heap from mem_ctx_init_shared, other processes
+ * mm_ctx_attach their own view, and every operation takes a lock
+ * kept in the heap. While mm_ctx_async_start has a reclaimer running,
+ * operations take that lock too; stop it before mm_ctx_init. Built with
+ * -DMM_THREADSAFE, every operation takes it, and the threads of one
+ * process may share any heap (though not the inline fast path lists).
+ * The plain functions above work on mm_default(), set up by mm_init.
+ */
+struct mem_ctx;
+struct mm_heap;
+struct mm_async;
+
+typedef struct mm_ctx {
+    struct mem_ctx *mem;  /* the memlib heap underneath */
+    struct mm_heap *heap; /* allocator state, at the bottom of the heap */
+    char *heap_base;      /* where this process sees heap offset 0 */
+    int shared;           /* lock around each operation */
+    struct mm_async *async; /* reclaimer thread, or NULL if frees are inline */
+} mm_ctx_t;
+
+extern int mm_ctx_init(mm_ctx_t *ctx, struct mem_ctx *mem);
+extern int mm_ctx_attach(mm_ctx_t *ctx, struct mem_ctx *mem);
+extern mm_ctx_t *mm_default(void);
+extern void *mm_ctx_malloc(mm_ctx_t *ctx, size_t size);
+extern void *mm_ctx_malloc_hint(mm_ctx_t *ctx, size_t size,
+                                mm_lifetime_t lifetime);
+extern void *mm_ctx_memalign(mm_ctx_t *ctx, size_t align, size_t size);
+extern void mm_ctx_free(mm_ctx_t *ctx, void *ptr);
+extern void *mm_ctx_realloc(mm_ctx_t *ctx, void *ptr, size_t size);
+extern void *mm_ctx_malloc_at_least(mm_ctx_t *ctx, size_t size,
+                                    size_t *actual);
+extern size_t mm_ctx_try_expand(mm_ctx_t *ctx, void *ptr, size_t new_size);
+extern mm_handle_t mm_ctx_halloc(mm_ctx_t *ctx, size_t size);
+extern void *mm_ctx_hderef(mm_ctx_t *ctx, mm_handle_t h);
+extern void mm_ctx_hfree(mm_ctx_t *ctx, mm_handle_t h);
+extern int mm_ctx_compact(mm_ctx_t *ctx, size_t budget);
+extern int mm_ctx_async_start(mm_ctx_t *ctx, unsigned int depth);
+extern void mm_ctx_async_stop(mm_ctx_t *ctx);
+extern int mm_ctx_check(mm_ctx_t *ctx);
+extern int mm_ctx_checkfailures(mm_ctx_t *ctx);
+
+extern void mm_setcheck(mm_check_t level, unsigned long period);
+extern int mm_checkfailures(void);
+extern int mm_check(void);
 
 
 /* 
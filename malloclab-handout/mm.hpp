@@ -0,0 +1,144 @@
+#ifndef __MM_HPP_
+#define __MM_HPP_
+
+/*
+ * mm.hpp - C++ adapters over the mm.h allocator
+ *
+ *     mm_resource is a std::pmr::memory_resource and mm_allocator<T>
+ *     a drop-in std::allocator replacement. Both draw from the default
+ *     mm heap, so the caller must have run mem_init and mm_init, and
+ *     every instance compares equal to every other.
+ *
+ *     Over-aligned requests go to mm_memalign. Sizes passed to
+ *     deallocate are not forwarded: the block's boundary tags already
+ *     record its size, so mm_free needs only the pointer.
+ */
+#include <cstddef>
+#include <limits>
+#include <memory_resource>
+#include <new>
+
+extern "C" {
+#include "mm.h"
+#include "memlib.h"
+}
+
+namespace mm {
+
+/* Largest alignment mm_malloc guarantees on its own */
+constexpr std::size_t malloc_alignment = 8;
+
+/*
+ * allocate - bytes from the mm heap aligned to align, or bad_alloc
+ */
+inline void *allocate(std::size_t bytes, std::size_t align)
+{
+    void *p;
+
+    if (bytes == 0)
+	bytes = 1; /* operator new never returns null for a zero size */
+    if (align <= malloc_alignment)
+	p = mm_malloc(bytes);
+    else
+	p = mm_memalign(align, bytes);
+    if (p == NULL)
+	throw std::bad_alloc();
+    return p;
+}
+
+inline void deallocate(void *p)
+{
+    if (p != NULL)
+	mm_free(p);
+}
+
+/*
+ * mm_resource - std::pmr::memory_resource over the mm heap
+ */
+class mm_resource : public std::pmr::memory_resource {
+protected:
+    void *do_allocate(std::size_t bytes, std::size_t align) override
+    {
+	return mm::allocate(bytes, align);
+    }
+
+    void do_deallocate(void *p, std::size_t, std::size_t) override
+    {
+	mm::deallocate(p);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other)
+	const noexcept override
+    {
+	return dynamic_cast<const mm_resource *>(&other) != nullptr;
+    }
+};
+
+/*
+ * resource - the shared mm_resource instance
+ */
+inline mm_resource *resource()
+{
+    static mm_resource r;
+    return &r;
+}
+
+/*
+ * mm_allocator - std::allocator compatible allocator over the mm heap
+ */
+template <typename T>
+struct mm_allocator {
+    typedef T value_type;
+
+    mm_allocator() noexcept {}
+    template <typename U>
+    mm_allocator(const mm_allocator<U> &) noexcept {}
+
+    T *allocate(std::size_t n)
+    {
+	if (n > std::numeric_limits<std::size_t>::max() / sizeof(T))
+	    throw std::bad_array_new_length();
+	return static_cast<T *>(mm::allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *p, std::size_t) noexcept
+    {
+	mm::deallocate(p);
+    }
+};
+
+/*
+ * mm_alloc_fixed - an N byte block through the inline fast path in mm.h,
+ *     with its size class resolved at compile time; null if out of memory
+ */
+template <std::size_t N>
+inline void *mm_alloc_fixed()
+{
+    static_assert(N > 0, "mm_alloc_fixed needs a nonzero size");
+    return mm_malloc_small(N);
+}
+
+/*
+ * mm_free_fixed - free a block from mm_alloc_fixed<N>
+ */
+template <std::size_t N>
+inline void mm_free_fixed(void *p)
+{
+    mm_free_small(p, N);
+}
+
+template <typename T, typename U>
+bool operator==(const mm_allocator<T> &, const mm_allocator<U> &) noexcept
+{
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const mm_allocator<T> &, const mm_allocator<U> &) noexcept
+{
+    return false;
+}
+
+} /* namespace mm */
+
+#endif /* __MM_HPP_ */
@@ -0,0 +1,46 @@
+/*
+ * mmplugin.c - mm.c as an mmplugin.h backend
+ *
+ * The Makefile links this with its own copies of mm.c and memlib.c
+ * into plugin-mm.so, and with -DMM_THREADSAFE into plugin-mm-mt.so;
+ * other builds of mm.c, say with other CFLAGS or from another
+ * checkout, can be made the same way and compared side by side with
+ * mdriver -P.
+ */
+#include "mm.h"
+#include "memlib.h"
+#include "mmplugin.h"
+
+/*
+ * plugin_init - empty the heap and set mm.c up on it afresh
+ */
+static int plugin_init(void)
+{
+    static int heap_ready = 0;
+
+    if (!heap_ready) {
+	mem_init();
+	heap_ready = 1;
+    }
+    mem_reset_brk();
+    return mm_init();
+}
+
+static size_t plugin_heapsize(void)
+{
+    return mem_heapsize();
+}
+
+const mm_plugin_t mm_plugin = {
+    MM_PLUGIN_VERSION,
+#ifdef MM_THREADSAFE
+    "mm.c-mt",
+#else
+    "mm.c",
+#endif
+    plugin_init,
+    mm_malloc,
+    mm_free,
+    mm_realloc,
+    plugin_heapsize,
+};
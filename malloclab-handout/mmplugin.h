@@ -0,0 +1,35 @@
+#ifndef __MMPLUGIN_H_
+#define __MMPLUGIN_H_
+
+/*
+ * mmplugin.h - an allocator backend that mdriver loads from a shared
+ *     object (-P) and runs the traces through next to mm.c
+ *
+ *     A backend exports one mm_plugin_t, named by MM_PLUGIN_SYMBOL.
+ *     mdriver calls init before every replay of a trace, then the
+ *     trace's requests. heapsize is optional: given it, mdriver takes
+ *     the largest value it returns over a replay as the heap size for
+ *     utilization, much as it takes mem_heapsize for mm.c; without it,
+ *     the backend gets no utilization.
+ *
+ *     mdriver opens backends with RTLD_DEEPBIND, so a backend's own
+ *     symbols and those of the libraries it links come before
+ *     mdriver's: a build of mm.c uses its own mm_malloc, and a wrapper
+ *     linked with another malloc gets that malloc, not libc's.
+ */
+#include <stddef.h>
+
+#define MM_PLUGIN_VERSION 1
+#define MM_PLUGIN_SYMBOL  "mm_plugin"
+
+typedef struct {
+    int version;                             /* MM_PLUGIN_VERSION */
+    const char *name;                        /* its column in the tables */
+    int (*init)(void);                       /* start afresh; -1 on error */
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+    size_t (*heapsize)(void);                /* bytes of heap, or NULL */
+} mm_plugin_t;
+
+#endif /* __MMPLUGIN_H_ */
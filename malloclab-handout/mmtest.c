@@ -0,0 +1,143 @@
+/*
+ * mmtest.c - regression cases for the mm.c heap
+ *
+ * Each case replays a short sequence of calls that once left the heap
+ * in a bad state, on a fresh default heap, and then walks the heap
+ * with mm_check. A case fails if it finds a wrong result on its own
+ * or if the walk does; a case that still corrupts the heap is likely
+ * to crash instead, which "make check" reports as a failure as well.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memlib.h"
+#include "mm.h"
+
+typedef struct {
+    const char *name;
+    int (*run)(void); /* 0 if the case passed */
+} mmtest_t;
+
+/*
+ * realloc_absorbs_cursor - mm_realloc grows a block in place over the
+ * free block the compactor is due to resume from. The compactor must
+ * resume from the grown block, not from its old neighbour's tags,
+ * which now lie in the middle of the payload
+ */
+static int realloc_absorbs_cursor(void)
+{
+    unsigned char *a;
+    void *b, *gap;
+    mm_handle_t h;
+    int i;
+
+    a = mm_malloc(64);
+    gap = mm_malloc(200);
+    h = mm_halloc(32);
+    b = mm_malloc(64);
+    mm_free(gap);
+
+    /* Walk past the prologue and a, stopping on the hole left by gap */
+    mm_compact(1);
+    mm_compact(1);
+
+    a = mm_realloc(a, 150);
+    if (a == NULL)
+	return 1;
+    memset(a, 0xa5, 150);
+    while (mm_compact(64))
+	;
+
+    for (i = 0; i < 150; i++)
+	if (a[i] != 0xa5)
+	    return 1;
+    if (mm_hderef(h) == NULL)
+	return 1;
+    mm_hfree(h);
+    mm_free(a);
+    mm_free(b);
+    return 0;
+}
+
+/*
+ * slide_takes_region - a handle block slid down into free space of the
+ * short-lived region belongs to that region afterwards, so that once
+ * freed it merges with the short-lived space around it again
+ */
+static int slide_takes_region(void)
+{
+    void *s;
+    mm_handle_t h;
+    size_t heapsize;
+
+    s = mm_malloc_hint(64, MM_LIFETIME_SHORT);
+    h = mm_halloc(8192); /* too big for the short region's chunk */
+    mm_free(s);
+    while (mm_compact(1 << 20))
+	;
+
+    mm_hfree(h);
+    heapsize = mem_heapsize();
+    s = mm_malloc_hint(8192, MM_LIFETIME_SHORT);
+    if (s == NULL || mem_heapsize() != heapsize)
+	return 1;
+    mm_free(s);
+    return 0;
+}
+
+/*
+ * trim_leaves_block - trimming the free block at the top of the heap a
+ * page at a time keeps a whole block below the cut. Each block size
+ * below it is tried in turn, so that for one of them the top block
+ * ends up 8 bytes over a page
+ */
+static int trim_leaves_block(void)
+{
+    size_t size, heapsize;
+    void *top;
+
+    for (size = 16; size <= 2 * 4096; size += 8) {
+	mem_reset_brk();
+	if (mm_init() < 0 || mm_malloc(size) == NULL ||
+	    (top = mm_malloc(2 * 4096)) == NULL)
+	    return 1;
+	mm_free(top);
+	do { /* each pass trims 4096 bytes at most */
+	    heapsize = mem_heapsize();
+	    while (mm_compact(64))
+		;
+	} while (mem_heapsize() < heapsize);
+	if (!mm_check())
+	    return 1;
+    }
+    return 0;
+}
+
+static mmtest_t tests[] = {
+    {"realloc_absorbs_cursor", realloc_absorbs_cursor},
+    {"slide_takes_region", slide_takes_region},
+    {"trim_leaves_block", trim_leaves_block},
+};
+
+int main(void)
+{
+    int i, bad;
+    int failed = 0;
+
+    mem_init();
+    for (i = 0; i < (int)(sizeof(tests) / sizeof(tests[0])); i++) {
+	mem_reset_brk();
+	if (mm_init() < 0) {
+	    fprintf(stderr, "mm_init failed\n");
+	    exit(1);
+	}
+	bad = tests[i].run();
+	if (!mm_check())
+	    bad = 1;
+	printf("%-28s %s\n", tests[i].name, bad ? "FAIL" : "ok");
+	failed += bad;
+    }
+    mem_deinit();
+    return failed != 0;
+}
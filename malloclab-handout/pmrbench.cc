@@ -0,0 +1,260 @@
+/*
+ * pmrbench.cc - STL container churn against mm, glibc and monotonic
+ *
+ * Runs vector, map, unordered_map and list workloads through the
+ * adapters in mm.hpp (as a std::pmr::memory_resource and as an
+ * allocator template), through std::allocator (operator new, i.e.
+ * glibc malloc) and through a std::pmr::monotonic_buffer_resource,
+ * and prints the time each took. The mm heap is reset before every
+ * round, like mdriver does before every trace.
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <list>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+#include <unistd.h>
+
+#include "mm.hpp"
+
+/* Defaults for -n and -r */
+#define DEFAULT_ELEMS  20000
+#define DEFAULT_ROUNDS 20
+
+/* The allocators each workload runs against */
+enum { MM_PMR, MM_ALLOC, GLIBC, MONOTONIC, NVARIANTS };
+
+static const char *variant_names[NVARIANTS] = {
+    "mm pmr", "mm alloc", "glibc", "monotonic"
+};
+
+static volatile std::size_t sink; /* keeps the workloads from being elided */
+
+template <typename Alloc, typename T>
+using rebind = typename std::allocator_traits<Alloc>::template rebind_alloc<T>;
+
+/* Cheap deterministic keys */
+static inline unsigned next_key(unsigned &seed)
+{
+    seed = seed * 1103515245u + 12345u;
+    return seed >> 8;
+}
+
+/*
+ * vector_churn - grow vectors element by element, then drop them
+ */
+template <typename Alloc>
+struct vector_churn {
+    static std::size_t run(const Alloc &a, int n)
+    {
+	std::vector<int, rebind<Alloc, int> > small(a), big(a);
+	int i;
+
+	for (i = 0; i < n; i++) {
+	    big.push_back(i);
+	    if (i % 64 == 0) {
+		small.clear();
+		small.shrink_to_fit();
+	    }
+	    small.push_back(i);
+	}
+	return big.size() + small.size();
+    }
+};
+
+/*
+ * map_churn - insert n keys, erase half of them, insert again
+ */
+template <typename Alloc>
+struct map_churn {
+    static std::size_t run(const Alloc &a, int n)
+    {
+	typedef std::pair<const unsigned, unsigned> value_t;
+	std::map<unsigned, unsigned, std::less<unsigned>,
+		 rebind<Alloc, value_t> > m(a);
+	unsigned seed = 1;
+	int i;
+
+	for (i = 0; i < n; i++)
+	    m[next_key(seed)] = i;
+	for (auto it = m.begin(); it != m.end(); )
+	    it = (it->second & 1) ? m.erase(it) : std::next(it);
+	for (i = 0; i < n / 2; i++)
+	    m[next_key(seed)] = i;
+	return m.size();
+    }
+};
+
+/*
+ * unordered_map_churn - as map_churn, with rehashing along the way
+ */
+template <typename Alloc>
+struct unordered_map_churn {
+    static std::size_t run(const Alloc &a, int n)
+    {
+	typedef std::pair<const unsigned, unsigned> value_t;
+	std::unordered_map<unsigned, unsigned, std::hash<unsigned>,
+			   std::equal_to<unsigned>,
+			   rebind<Alloc, value_t> > m(a);
+	unsigned seed = 1;
+	int i;
+
+	for (i = 0; i < n; i++)
+	    m[next_key(seed)] = i;
+	for (auto it = m.begin(); it != m.end(); )
+	    it = (it->second & 1) ? m.erase(it) : std::next(it);
+	for (i = 0; i < n / 2; i++)
+	    m[next_key(seed)] = i;
+	return m.size();
+    }
+};
+
+/*
+ * list_churn - append n nodes, drop every other one, append again
+ */
+template <typename Alloc>
+struct list_churn {
+    static std::size_t run(const Alloc &a, int n)
+    {
+	std::list<int, rebind<Alloc, int> > l(a);
+	int i;
+
+	for (i = 0; i < n; i++)
+	    l.push_back(i);
+	for (auto it = l.begin(); it != l.end(); ) {
+	    it = l.erase(it);
+	    if (it != l.end())
+		++it;
+	}
+	for (i = 0; i < n / 2; i++)
+	    l.push_front(i);
+	return l.size();
+    }
+};
+
+/*
+ * run - seconds taken by rounds runs of Workload over n elements
+ */
+template <template <typename> class Workload>
+static double run(int variant, int n, int rounds)
+{
+    typedef std::pmr::polymorphic_allocator<char> pmr_alloc;
+    auto start = std::chrono::steady_clock::now();
+    int r;
+
+    for (r = 0; r < rounds; r++) {
+	switch (variant) {
+	case MM_PMR:
+	    mem_reset_brk();
+	    if (mm_init() < 0) {
+		fprintf(stderr, "mm_init failed\n");
+		exit(1);
+	    }
+	    sink += Workload<pmr_alloc>::run(pmr_alloc(mm::resource()), n);
+	    break;
+	case MM_ALLOC:
+	    mem_reset_brk();
+	    if (mm_init() < 0) {
+		fprintf(stderr, "mm_init failed\n");
+		exit(1);
+	    }
+	    sink += Workload<mm::mm_allocator<char> >::run(
+		mm::mm_allocator<char>(), n);
+	    break;
+	case GLIBC:
+	    sink += Workload<std::allocator<char> >::run(
+		std::allocator<char>(), n);
+	    break;
+	case MONOTONIC: {
+	    std::pmr::monotonic_buffer_resource mono;
+	    sink += Workload<pmr_alloc>::run(pmr_alloc(&mono), n);
+	    break;
+	}
+	}
+    }
+
+    std::chrono::duration<double> secs =
+	std::chrono::steady_clock::now() - start;
+    return secs.count();
+}
+
+/*
+ * report - one table row: a workload's time under every variant
+ */
+template <template <typename> class Workload>
+static void report(const char *name, int n, int rounds)
+{
+    int v;
+
+    printf("%-14s", name);
+    for (v = 0; v < NVARIANTS; v++)
+	printf("%12.2f", run<Workload>(v, n, rounds) * 1e3);
+    printf("\n");
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: pmrbench [-h] [-n <elems>] [-r <rounds>] "
+	    "[-m <bytes>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-m <bytes> Maximum mm heap size.\n");
+    fprintf(stderr, "\t-n <elems> Elements per workload (default %d).\n",
+	    DEFAULT_ELEMS);
+    fprintf(stderr, "\t-r <rounds> Rounds per workload (default %d).\n",
+	    DEFAULT_ROUNDS);
+}
+
+int main(int argc, char **argv)
+{
+    int n = DEFAULT_ELEMS;
+    int rounds = DEFAULT_ROUNDS;
+    int c, v;
+
+    while ((c = getopt(argc, argv, "hn:r:m:")) != EOF) {
+	switch (c) {
+	case 'n':
+	    n = atoi(optarg);
+	    break;
+	case 'r':
+	    rounds = atoi(optarg);
+	    break;
+	case 'm':
+	    mem_set_max_heap(strtoul(optarg, NULL, 0));
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (n <= 0 || rounds <= 0) {
+	usage();
+	exit(1);
+    }
+
+    mem_init();
+
+    printf("%d elements, %d rounds (ms)\n", n, rounds);
+    printf("%-14s", "workload");
+    for (v = 0; v < NVARIANTS; v++)
+	printf("%12s", variant_names[v]);
+    printf("\n");
+
+    report<vector_churn>("vector", n, rounds);
+    report<map_churn>("map", n, rounds);
+    report<unordered_map_churn>("unordered_map", n, rounds);
+    report<list_churn>("list", n, rounds);
+
+    mem_deinit();
+    return 0;
+}
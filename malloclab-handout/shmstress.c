@@ -0,0 +1,336 @@
+/*
+ * shmstress.c - two processes allocating from one shared mm heap
+ *
+ * Starts a shared heap on a memfd (or on the file given with -f) and
+ * forks. The child maps the heap a second time, at an address of its
+ * own, and both processes run the same random mix of malloc, realloc
+ * and free on it. Each also hands blocks to the other through a pair
+ * of rings kept in the heap, so that blocks are freed by a process
+ * other than the one that allocated them.
+ *
+ * Every block is stamped with its size and a key and filled with a
+ * pattern derived from them. The pattern is checked before each
+ * realloc and free, and the parent walks the heap with mm_ctx_check
+ * once both processes have finished.
+ */
+#define _GNU_SOURCE /* for memfd_create */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "memlib.h"
+#include "mm.h"
+
+/* Defaults for -n and -m */
+#define DEFAULT_OPS      200000
+#define DEFAULT_MAX_HEAP (64*(1<<20))
+
+#define LIVE_SLOTS 1024 /* blocks each process holds at once */
+#define RING_SLOTS 256  /* blocks in flight from one process to the other */
+#define MAX_SMALL  512  /* most requests are at most this large */
+#define MAX_LARGE  16384 /* one in LARGE_ODDS is up to this large */
+#define LARGE_ODDS 16
+
+/* Blocks in flight from one process to the other, as heap offsets */
+typedef struct {
+    unsigned int head;              /* next slot to fill; the sender's */
+    unsigned int tail;              /* next slot to take; the receiver's */
+    unsigned int slot[RING_SLOTS];
+} ring_t;
+
+/* Kept in the shared heap; found by its offset, inherited over fork */
+typedef struct {
+    ring_t ring[2];     /* ring[i] carries blocks to process i */
+    unsigned int done;  /* processes that will send no more */
+} shared_area_t;
+
+/* Leading words of every block, followed by its pattern */
+typedef struct {
+    unsigned int size;
+    unsigned int key;
+} stamp_t;
+
+/* What one process did */
+typedef struct {
+    unsigned long ops;
+    unsigned long sent;
+    unsigned long received;
+    unsigned long errors;
+} counts_t;
+
+/*
+ * next_rand - cheap deterministic random numbers, one stream per process
+ */
+static unsigned int next_rand(unsigned int *seed)
+{
+    *seed = *seed * 1103515245u + 12345u;
+    return *seed >> 8;
+}
+
+/*
+ * random_size - a request size: mostly small, occasionally large
+ */
+static size_t random_size(unsigned int *seed)
+{
+    size_t max = (next_rand(seed) % LARGE_ODDS == 0) ? MAX_LARGE : MAX_SMALL;
+
+    return sizeof(stamp_t) + next_rand(seed) % max;
+}
+
+/*
+ * stamp - record size and key in block p and fill the rest with its pattern
+ */
+static void stamp(void *p, size_t size, unsigned int key)
+{
+    stamp_t *s = p;
+    unsigned char *bytes = (unsigned char *)(s + 1);
+    size_t i;
+
+    s->size = size;
+    s->key = key;
+    for (i = 0; i < size - sizeof(stamp_t); i++)
+	bytes[i] = (unsigned char)(key + i);
+}
+
+/*
+ * intact - check the first len bytes of block p against its stamp
+ */
+static int intact(void *p, size_t len)
+{
+    stamp_t *s = p;
+    unsigned char *bytes = (unsigned char *)(s + 1);
+    size_t i;
+
+    if (len > s->size)
+	len = s->size;
+    for (i = 0; i + sizeof(stamp_t) < len; i++)
+	if (bytes[i] != (unsigned char)(s->key + i))
+	    return 0;
+    return 1;
+}
+
+/*
+ * hand_off - put block p on ring r; returns 0 if the ring is full
+ */
+static int hand_off(ring_t *r, mem_ctx_t *mem, void *p)
+{
+    unsigned int head = r->head;
+
+    if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == RING_SLOTS)
+	return 0;
+    r->slot[head % RING_SLOTS] = (char *)p - (char *)mem_ctx_heap_lo(mem);
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/*
+ * collect - check and free every block waiting on ring r
+ */
+static void collect(ring_t *r, mm_ctx_t *ctx, mem_ctx_t *mem, counts_t *c)
+{
+    unsigned int tail = r->tail;
+    unsigned int head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    char *p;
+
+    for (; tail != head; tail++) {
+	p = (char *)mem_ctx_heap_lo(mem) + r->slot[tail % RING_SLOTS];
+	if (!intact(p, ((stamp_t *)p)->size))
+	    c->errors++;
+	mm_ctx_free(ctx, p);
+	c->received++;
+    }
+    __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+}
+
+/*
+ * run - one process's share of the stress test; me is 0 or 1
+ */
+static void run(mm_ctx_t *ctx, mem_ctx_t *mem, shared_area_t *area, int me,
+		unsigned long ops, counts_t *c)
+{
+    static void *live[LIVE_SLOTS];
+    unsigned int seed = 1 + me;
+    unsigned int key = me << 24;
+    unsigned long i;
+    size_t size;
+    void *p;
+    int j, r;
+
+    memset(c, 0, sizeof(counts_t));
+    for (i = 0; i < ops; i++) {
+	j = next_rand(&seed) % LIVE_SLOTS;
+	r = next_rand(&seed) % 100;
+	if (live[j] == NULL) {
+	    size = random_size(&seed);
+	    if ((live[j] = mm_ctx_malloc(ctx, size)) == NULL) {
+		c->errors++;
+		continue;
+	    }
+	    stamp(live[j], size, key++);
+	}
+	else if (r < 30) {
+	    size = random_size(&seed);
+	    if (!intact(live[j], ((stamp_t *)live[j])->size))
+		c->errors++;
+	    if ((p = mm_ctx_realloc(ctx, live[j], size)) == NULL) {
+		c->errors++;
+		continue;
+	    }
+	    if (!intact(p, size))
+		c->errors++;
+	    stamp(p, size, key++);
+	    live[j] = p;
+	}
+	else if (r < 45) {
+	    if (hand_off(&area->ring[1 - me], mem, live[j])) {
+		live[j] = NULL;
+		c->sent++;
+	    }
+	}
+	else {
+	    if (!intact(live[j], ((stamp_t *)live[j])->size))
+		c->errors++;
+	    mm_ctx_free(ctx, live[j]);
+	    live[j] = NULL;
+	}
+	if (i % 16 == 0)
+	    collect(&area->ring[me], ctx, mem, c);
+    }
+    c->ops = ops;
+
+    /* Drop what is left, then take blocks until the other side is done */
+    for (j = 0; j < LIVE_SLOTS; j++) {
+	if (live[j] != NULL) {
+	    if (!intact(live[j], ((stamp_t *)live[j])->size))
+		c->errors++;
+	    mm_ctx_free(ctx, live[j]);
+	    live[j] = NULL;
+	}
+    }
+    __atomic_add_fetch(&area->done, 1, __ATOMIC_ACQ_REL);
+    while (__atomic_load_n(&area->done, __ATOMIC_ACQUIRE) < 2)
+	collect(&area->ring[me], ctx, mem, c);
+    collect(&area->ring[me], ctx, mem, c);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: shmstress [-h] [-n <ops>] [-m <bytes>] "
+	    "[-f <file>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-f <file>  Back the heap with <file>, not a memfd.\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-m <bytes> Maximum heap size (default %d).\n",
+	    DEFAULT_MAX_HEAP);
+    fprintf(stderr, "\t-n <ops>   Operations per process (default %d).\n",
+	    DEFAULT_OPS);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long ops = DEFAULT_OPS;
+    size_t max_heap = DEFAULT_MAX_HEAP;
+    char *file = NULL;
+    mem_ctx_t mem, child_mem;
+    mm_ctx_t ctx, child_ctx;
+    shared_area_t *area;
+    unsigned int area_off;
+    struct timespec start, end;
+    counts_t c;
+    int fd, ch, status, ok;
+    pid_t pid;
+
+    while ((ch = getopt(argc, argv, "hn:m:f:")) != EOF) {
+	switch (ch) {
+	case 'n':
+	    ops = strtoul(optarg, NULL, 0);
+	    break;
+	case 'm':
+	    max_heap = strtoul(optarg, NULL, 0);
+	    break;
+	case 'f':
+	    file = optarg;
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+
+    if (file != NULL)
+	fd = open(file, O_RDWR | O_CREAT, 0600);
+    else
+	fd = memfd_create("mm-shared-heap", 0);
+    if (fd < 0) {
+	perror("shmstress: heap file");
+	exit(1);
+    }
+    if (mem_ctx_init_shared(&mem, fd, max_heap) < 0 ||
+	mm_ctx_init(&ctx, &mem) < 0) {
+	perror("shmstress: shared heap");
+	exit(1);
+    }
+    if ((area = mm_ctx_malloc(&ctx, sizeof(shared_area_t))) == NULL) {
+	fprintf(stderr, "shmstress: no room for the rings\n");
+	exit(1);
+    }
+    memset(area, 0, sizeof(shared_area_t));
+    area_off = (char *)area - (char *)mem_ctx_heap_lo(&mem);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if ((pid = fork()) < 0) {
+	perror("shmstress: fork");
+	exit(1);
+    }
+    if (pid == 0) {
+	/* Map the heap afresh, so that it sits elsewhere than the parent's */
+	if (mem_ctx_attach_shared(&child_mem, fd) < 0 ||
+	    mm_ctx_attach(&child_ctx, &child_mem) < 0) {
+	    perror("shmstress: attach");
+	    _exit(255);
+	}
+	mem_ctx_deinit(&mem);
+	printf("parent heap at %p, child heap at %p\n",
+	       (void *)ctx.heap, mem_ctx_heap_lo(&child_mem));
+	fflush(stdout);
+	area = (shared_area_t *)((char *)mem_ctx_heap_lo(&child_mem) + area_off);
+	run(&child_ctx, &child_mem, area, 1, ops, &c);
+	printf("child:  %lu ops, sent %lu, received %lu, %lu errors\n",
+	       c.ops, c.sent, c.received, c.errors);
+	fflush(stdout);
+	_exit(c.errors > 0);
+    }
+
+    run(&ctx, &mem, area, 0, ops, &c);
+    if (waitpid(pid, &status, 0) < 0) {
+	perror("shmstress: waitpid");
+	exit(1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("parent: %lu ops, sent %lu, received %lu, %lu errors\n",
+	   c.ops, c.sent, c.received, c.errors);
+
+    mm_ctx_free(&ctx, area);
+    ok = mm_ctx_check(&ctx) && c.errors == 0 &&
+	WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    printf("%.0f Kops/sec over both processes, peak heap %lu KB: %s\n",
+	   2 * ops / 1e3 / ((end.tv_sec - start.tv_sec) +
+			   (end.tv_nsec - start.tv_nsec) / 1e9),
+	   (unsigned long)(mem_ctx_peak_heapsize(&mem) >> 10),
+	   ok ? "ok" : "FAILED");
+
+    mem_ctx_deinit(&mem);
+    close(fd);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,73 @@
+#ifndef __SIZECLASSES_H_
+#define __SIZECLASSES_H_
+
+/*
+ * sizeclasses.h - segregated free-list classes for mm.c
+ *
+ * Generated by tracestat from:
+ *   traces/amptjp-bal.rep
+ *   traces/binary-bal.rep
+ *   traces/binary2-bal.rep
+ *   traces/cccp-bal.rep
+ *   traces/coalescing-bal.rep
+ *   traces/cp-decl-bal.rep
+ *   traces/expr-bal.rep
+ *   traces/random-bal.rep
+ *   traces/random2-bal.rep
+ *   traces/realloc-bal.rep
+ *   traces/realloc2-bal.rep
+ *   traces/short1-bal.rep
+ *   traces/short2-bal.rep
+ *
+ * Do not edit; run "make sizeclasses" to regenerate.
+ */
+
+#define SIZE_CLASSES 23
+#define SIZE_CLASS_LOOKUP_MAX 4096 /* largest block size in size_class_lookup */
+
+/* Largest block size on each free list; the last is unbounded */
+static const unsigned int size_class_max[SIZE_CLASSES] = {
+    16u, 24u, 32u, 64u, 72u, 112u,
+    120u, 128u, 136u, 256u, 512u, 1024u,
+    2048u, 4072u, 4080u, 4096u, 4104u, 8192u,
+    8200u, 16384u, 32768u, 65536u, 4294967295u
+};
+
+/* Free list for each block size up to SIZE_CLASS_LOOKUP_MAX, indexed by size/8 */
+static const unsigned char size_class_lookup[SIZE_CLASS_LOOKUP_MAX/8 + 1] = {
+    0, 0, 0, 1, 2, 3, 3, 3, 3, 4, 5, 5, 5, 5, 5, 6,
+    7, 8, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9,
+    9, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10,
+    10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10,
+    10, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11,
+    11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11,
+    11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11,
+    11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11, 11,
+    11, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+    12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12, 12,
+    12, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13,
+    13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13,
+    13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13,
+    13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13,
+    13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13,
+    13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13,
+    13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13,
+    13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13,
+    13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13,
+    13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13,
+    13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13,
+    13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13,
+    13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13,
+    13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13,
+    13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13,
+    13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 13, 14, 15,
+    15
+};
+
+#endif /* __SIZECLASSES_H_ */
@@ -0,0 +1,691 @@
+/*
+ * trace.c - Read trace files into memory, and write them back out
+ *
+ * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
+ * May not be used, modified, or copied without permission.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+#define MAXLINE 1024 /* max string size */
+
+extern int verbose; /* -v option of the program reading the trace */
+
+/* 
+ * unix_error - Report a Unix-style error
+ */
+static void unix_error(char *msg) 
+{
+    printf("%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
+
+/**********************************************
+ * The following routines manipulate tracefiles
+ *********************************************/
+
+/*
+ * alloc_blocks - allocate the per-id block arrays of a trace
+ */
+static void alloc_blocks(trace_t *trace)
+{
+    /* We'll keep an array of pointers to the allocated blocks here... */
+    if ((trace->blocks = 
+	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	unix_error("malloc 3 failed in read_trace");
+
+    /* ... along with the corresponding byte sizes of each block */
+    if ((trace->block_sizes = 
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	unix_error("malloc 4 failed in read_trace");
+}
+
+/*
+ * parse_request - parse one request line of a .rep file into *op.
+ *     Returns 0 for a blank line and 1 otherwise. Lines are read whole
+ *     because a and r requests may carry an optional site tag.
+ */
+static int parse_request(char *line, traceop_t *op, char *path)
+{
+    char type[MAXLINE];
+    unsigned index = 0, size = 0, thread = 0;
+    int site = NO_SITE;
+    int n;
+
+    if (sscanf(line, " %u%n", &thread, &n) == 1)
+	line += n; /* the thread id column */
+    if (sscanf(line, "%s", type) != 1)
+	return 0;
+    switch(type[0]) {
+    case 'a':
+    case 'r':
+	sscanf(line, "%*s %u %u %d", &index, &size, &site);
+	op->type = (type[0] == 'a') ? ALLOC : REALLOC;
+	break;
+    case 'f':
+	sscanf(line, "%*s %u", &index);
+	op->type = FREE;
+	break;
+    default:
+	printf("Bogus type character (%c) in tracefile %s\n", 
+	       type[0], path);
+	exit(1);
+    }
+    op->index = index;
+    op->size = size;
+    op->site = site;
+    op->thread = thread;
+    return 1;
+}
+
+/*
+ * check_varint - decode the varint at *pos into *v and step past it, as
+ *     trace_varint does, but return 0 rather than read at or past end
+ *     or decode more bits than an unsigned holds
+ */
+static int check_varint(const unsigned char **pos, const unsigned char *end,
+			unsigned *v)
+{
+    const unsigned char *p = *pos;
+    int shift = 0;
+
+    *v = 0;
+    do {
+	if (p == end || shift > 28)
+	    return 0;
+	*v |= (unsigned)(*p & 0x7f) << shift;
+	shift += 7;
+    } while (*p++ & 0x80);
+    *pos = p;
+    return 1;
+}
+
+/*
+ * check_packed - walk the packed requests of a mapped trace once and
+ *     exit if they do not match its header: too few or too many bytes
+ *     for num_ops requests, a bad type, or an index, thread, size or
+ *     site out of range. trace_next decodes the mapping without bounds
+ *     checks, so it must only ever see a trace that passed here.
+ */
+static void check_packed(trace_t *trace, char *path)
+{
+    const unsigned char *pos = trace->packed;
+    const unsigned char *end = (unsigned char *)trace->map + trace->map_len;
+    unsigned word, thread = 0, size = 0, site = 0;
+    int i;
+
+    if (trace->num_ids < 0 || trace->num_ops < 0 ||
+	trace->num_threads < 1 || (unsigned)trace->has_sites > 1) {
+	printf("Bad header in binary tracefile %s\n", path);
+	exit(1);
+    }
+    for (i = 0; i < trace->num_ops; i++) {
+	if (!check_varint(&pos, end, &word) ||
+	    (trace->num_threads > 1 && !check_varint(&pos, end, &thread)))
+	    break;
+	if ((word & 3) != FREE &&
+	    (!check_varint(&pos, end, &size) ||
+	     (trace->has_sites && !check_varint(&pos, end, &site))))
+	    break;
+	if ((word & 3) > REALLOC || (word >> 2) >= (unsigned)trace->num_ids ||
+	    thread >= (unsigned)trace->num_threads ||
+	    ((word & 3) != FREE &&
+	     (size > INT_MAX || (trace->has_sites && site > INT_MAX)))) {
+	    printf("Bad request %d in binary tracefile %s\n", i, path);
+	    exit(1);
+	}
+    }
+    if (i < trace->num_ops || pos != end) {
+	printf("Binary tracefile %s does not hold %d requests\n", path,
+	       trace->num_ops);
+	exit(1);
+    }
+}
+
+/*
+ * map_trace - map the binary trace file open on fd into trace. Its
+ *     requests stay packed in the mapping and are decoded as they
+ *     are replayed, once check_packed has vouched for them.
+ */
+static void map_trace(trace_t *trace, int fd, char *path)
+{
+    trace_header_t *header;
+    struct stat st;
+    char msg[MAXLINE];
+
+    if (fstat(fd, &st) < 0) {
+	sprintf(msg, "Could not stat %s in read_trace", path);
+	unix_error(msg);
+    }
+    trace->map_len = st.st_size;
+    trace->map = mmap(NULL, trace->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (trace->map == MAP_FAILED) {
+	sprintf(msg, "Could not map %s in read_trace", path);
+	unix_error(msg);
+    }
+    header = trace->map;
+    if (trace->map_len < sizeof(trace_header_t) ||
+	trace->map_len - sizeof(trace_header_t) != header->packed_len ||
+	(header->packed_len > 0 &&
+	 (((unsigned char *)trace->map)[trace->map_len - 1] & 0x80))) {
+	printf("Truncated binary tracefile %s\n", path);
+	exit(1);
+    }
+    madvise(trace->map, trace->map_len, MADV_SEQUENTIAL);
+
+    trace->sugg_heapsize = header->sugg_heapsize;
+    trace->num_ids = header->num_ids;
+    trace->num_ops = header->num_ops;
+    trace->weight = header->weight;
+    trace->has_sites = header->has_sites;
+    trace->num_threads = header->num_threads;
+    trace->ops = NULL;
+    trace->packed = (unsigned char *)(header + 1);
+    check_packed(trace, path);
+    alloc_blocks(trace);
+}
+
+/*
+ * read_trace - read a trace file and store it in memory. A binary
+ *     trace, recognized by its magic number, is mapped rather than read.
+ */
+trace_t *read_trace(char *tracedir, char *filename)
+{
+    FILE *tracefile;
+    trace_t *trace;
+    char path[MAXLINE];
+    unsigned max_index = 0;
+    unsigned op_index;
+    traceop_t *op;
+    char msg[MAXLINE];
+    char line[MAXLINE];
+    char magic[sizeof(TRACE_MAGIC) - 1];
+
+    if (verbose > 1)
+	printf("Reading tracefile: %s\n", filename);
+
+    /* Allocate the trace record */
+    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
+	unix_error("malloc 1 failed in read_trance");
+    trace->packed = NULL;
+    trace->map = NULL;
+    trace->map_len = 0;
+	
+    /* Read the trace file header */
+    strcpy(path, tracedir);
+    strcat(path, filename);
+    if ((tracefile = fopen(path, "r")) == NULL) {
+	sprintf(msg, "Could not open %s in read_trace", path);
+	unix_error(msg);
+    }
+    if (fread(magic, 1, sizeof(magic), tracefile) == sizeof(magic) &&
+	memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0) {
+	map_trace(trace, fileno(tracefile), path);
+	fclose(tracefile);
+	return trace;
+    }
+    rewind(tracefile);
+    fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
+    fscanf(tracefile, "%d", &(trace->num_ids));     
+    fscanf(tracefile, "%d", &(trace->num_ops));     
+    fscanf(tracefile, "%d", &(trace->weight));        /* not used */
+    
+    /* We'll store each request line in the trace in this array */
+    if ((trace->ops = 
+	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+	unix_error("malloc 2 failed in read_trace");
+    alloc_blocks(trace);
+    
+    /* read every request line in the trace file */
+    op_index = 0;
+    trace->has_sites = 0;
+    trace->num_threads = 1;
+    while (fgets(line, MAXLINE, tracefile) != NULL) {
+	op = &trace->ops[op_index];
+	if (!parse_request(line, op, path))
+	    continue; /* blank line, e.g. the rest of the header's */
+	if (op->site != NO_SITE)
+	    trace->has_sites = 1;
+	if (op->thread >= trace->num_threads)
+	    trace->num_threads = op->thread + 1;
+	if (op->type != FREE && (unsigned)op->index > max_index)
+	    max_index = op->index;
+	op_index++;
+    }
+    fclose(tracefile);
+    assert(max_index == trace->num_ids - 1);
+    assert(trace->num_ops == op_index);
+    
+    return trace;
+}
+
+/*
+ * free_trace - Free the trace record and the three arrays it points
+ *              to, all of which were allocated in read_trace(), or
+ *              unmap the file behind a binary trace.
+ */
+void free_trace(trace_t *trace)
+{
+    if (trace->map != NULL)
+	munmap(trace->map, trace->map_len);
+    free(trace->ops);         /* free the three arrays... */
+    free(trace->blocks);      
+    free(trace->block_sizes);
+    free(trace);              /* and the trace record itself... */
+}
+
+/*
+ * put_varint - append v to the file as a varint
+ */
+static void put_varint(FILE *file, unsigned v)
+{
+    while (v >= 0x80) {
+	putc((v & 0x7f) | 0x80, file);
+	v >>= 7;
+    }
+    putc(v, file);
+}
+
+/*
+ * write_trace - write trace to path, as a binary trace if binary is
+ *     nonzero and as a .rep text file otherwise. Returns 0 on success
+ *     and -1 on an I/O error.
+ */
+int write_trace(trace_t *trace, char *path, int binary)
+{
+    FILE *file;
+    trace_header_t header;
+    trace_iter_t it;
+    traceop_t op;
+    long len;
+    int ok;
+
+    if ((file = fopen(path, "w")) == NULL)
+	return -1;
+
+    if (binary) {
+	/* Leave room for the header until the packed length is known */
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+	header.sugg_heapsize = trace->sugg_heapsize;
+	header.num_ids = trace->num_ids;
+	header.num_ops = trace->num_ops;
+	header.weight = trace->weight;
+	header.has_sites = trace->has_sites;
+	header.num_threads = trace->num_threads;
+	fwrite(&header, sizeof(header), 1, file);
+    }
+    else
+	fprintf(file, "%d\n%d\n%d\n%d\n", trace->sugg_heapsize,
+		trace->num_ids, trace->num_ops, trace->weight);
+
+    for (trace_start(trace, &it); trace_next(&it, &op); ) {
+	if (binary) {
+	    put_varint(file, (unsigned)op.index << 2 | op.type);
+	    if (trace->num_threads > 1)
+		put_varint(file, op.thread);
+	    if (op.type == FREE)
+		continue;
+	    put_varint(file, op.size);
+	    if (trace->has_sites)
+		put_varint(file, op.site + 1);
+	    continue;
+	}
+	if (trace->num_threads > 1)
+	    fprintf(file, "%d ", op.thread);
+	if (op.type == FREE)
+	    fprintf(file, "f %d\n", op.index);
+	else if (op.site != NO_SITE)
+	    fprintf(file, "%c %d %d %d\n", op.type == ALLOC ? 'a' : 'r',
+		    op.index, op.size, op.site);
+	else
+	    fprintf(file, "%c %d %d\n", op.type == ALLOC ? 'a' : 'r',
+		    op.index, op.size);
+    }
+
+    if (binary) {
+	len = ftell(file);
+	header.packed_len = len - sizeof(header);
+	rewind(file);
+	fwrite(&header, sizeof(header), 1, file);
+    }
+    ok = !ferror(file);
+    if (fclose(file) != 0)
+	ok = 0;
+    return ok ? 0 : -1;
+}
+
+/**********************************************
+ * The following routines stream long traces
+ *********************************************/
+
+#define IDMAP_MIN 1024 /* initial id map size, a power of two */
+
+/* Maps a live trace id to the slot standing in for it */
+typedef struct {
+    unsigned id;
+    int slot;            /* -1 in an empty entry */
+} idmap_entry_t;
+
+struct trace_stream {
+    FILE *file;
+    char path[MAXLINE];
+    int binary;          /* packed requests follow a trace_header_t */
+    int has_sites;       /* binary only: requests carry a site varint */
+    int threaded;        /* binary only: requests carry a thread varint */
+    int left;            /* binary only: requests still to decode */
+
+    /* Live ids, open addressed on id, and the slots they hold */
+    idmap_entry_t *map;
+    size_t map_size;     /* a power of two */
+    size_t map_count;
+    int *free_slots;     /* stack of slots given back by frees */
+    int nfree;
+    int next_slot;       /* slots ever handed out */
+    int max_slots;       /* room in free_slots */
+
+    /* Ring of decoded chunks; the reader fills, the caller drains */
+    trace_chunk_t ring[STREAM_CHUNKS];
+    unsigned head;       /* chunks filled */
+    unsigned tail;       /* chunks drained */
+    int held;            /* the caller still holds ring[tail] */
+    int eof;             /* the reader has filled its last chunk */
+    int closing;         /* the caller wants the reader to stop */
+    pthread_mutex_t lock;
+    pthread_cond_t filled;
+    pthread_cond_t drained;
+    pthread_t reader;
+};
+
+/*
+ * idmap_find - the entry for id, or the empty entry where it would go
+ */
+static idmap_entry_t *idmap_find(trace_stream_t *s, unsigned id)
+{
+    size_t mask = s->map_size - 1;
+    size_t i = (id * 2654435761u) & mask;
+
+    while (s->map[i].slot >= 0 && s->map[i].id != id)
+	i = (i + 1) & mask;
+    return &s->map[i];
+}
+
+/*
+ * idmap_grow - double the id map, rehashing every live id
+ */
+static void idmap_grow(trace_stream_t *s)
+{
+    idmap_entry_t *old = s->map;
+    size_t old_size = s->map_size;
+    size_t i;
+
+    s->map_size = old_size ? 2 * old_size : IDMAP_MIN;
+    if ((s->map = malloc(s->map_size * sizeof(idmap_entry_t))) == NULL)
+	unix_error("malloc failed in idmap_grow");
+    for (i = 0; i < s->map_size; i++)
+	s->map[i].slot = -1;
+    for (i = 0; i < old_size; i++)
+	if (old[i].slot >= 0)
+	    *idmap_find(s, old[i].id) = old[i];
+    free(old);
+}
+
+/*
+ * idmap_delete - empty entry e, shifting back the entries after it so
+ *     that no lookup stops short at the hole
+ */
+static void idmap_delete(trace_stream_t *s, idmap_entry_t *e)
+{
+    size_t mask = s->map_size - 1;
+    size_t hole = e - s->map;
+    size_t i = hole, home;
+
+    for (;;) {
+	i = (i + 1) & mask;
+	if (s->map[i].slot < 0)
+	    break;
+	home = (s->map[i].id * 2654435761u) & mask;
+	/* move it back unless its home lies cyclically in (hole, i] */
+	if (((i - home) & mask) >= ((i - hole) & mask)) {
+	    s->map[hole] = s->map[i];
+	    hole = i;
+	}
+    }
+    s->map[hole].slot = -1;
+    s->map_count--;
+}
+
+/*
+ * renumber - replace the trace id in op by its slot, handing out a slot
+ *     when the id is allocated and taking it back when it is freed
+ */
+static void renumber(trace_stream_t *s, traceop_t *op)
+{
+    idmap_entry_t *e = idmap_find(s, op->index);
+
+    if (op->type == FREE) {
+	if (e->slot < 0) {
+	    printf("Free of unallocated id %d in tracefile %s\n",
+		   op->index, s->path);
+	    exit(1);
+	}
+	op->index = e->slot;
+	s->free_slots[s->nfree++] = e->slot;
+	idmap_delete(s, e);
+	return;
+    }
+    if (e->slot < 0) {
+	if (2 * (s->map_count + 1) > s->map_size) {
+	    idmap_grow(s);
+	    e = idmap_find(s, op->index);
+	}
+	e->id = op->index;
+	if (s->nfree > 0)
+	    e->slot = s->free_slots[--s->nfree];
+	else {
+	    /* free_slots must be able to hold every slot at once */
+	    if (s->next_slot == s->max_slots) {
+		s->max_slots = s->max_slots ? 2 * s->max_slots : IDMAP_MIN;
+		s->free_slots = realloc(s->free_slots,
+					s->max_slots * sizeof(int));
+		if (s->free_slots == NULL)
+		    unix_error("realloc failed in renumber");
+	    }
+	    e->slot = s->next_slot++;
+	}
+	s->map_count++;
+    }
+    op->index = e->slot;
+}
+
+/*
+ * get_varint - decode a varint from the stream's file
+ */
+static unsigned get_varint(trace_stream_t *s)
+{
+    unsigned v = 0;
+    int shift = 0;
+    int c;
+
+    do {
+	if ((c = getc_unlocked(s->file)) == EOF) {
+	    printf("Truncated binary tracefile %s\n", s->path);
+	    exit(1);
+	}
+	v |= (unsigned)(c & 0x7f) << shift;
+	shift += 7;
+    } while (c & 0x80);
+    return v;
+}
+
+/*
+ * decode - read the next request of the stream into *op; returns 0 at
+ *     the end of the trace
+ */
+static int decode(trace_stream_t *s, traceop_t *op)
+{
+    char line[MAXLINE];
+    unsigned word;
+
+    if (!s->binary) {
+	while (fgets(line, MAXLINE, s->file) != NULL)
+	    if (parse_request(line, op, s->path))
+		return 1;
+	return 0;
+    }
+    if (s->left == 0)
+	return 0;
+    s->left--;
+    word = get_varint(s);
+    op->type = word & 3;
+    op->index = word >> 2;
+    op->size = 0;
+    op->site = NO_SITE;
+    op->thread = s->threaded ? (int)get_varint(s) : 0;
+    if (op->type != FREE) {
+	op->size = get_varint(s);
+	if (s->has_sites)
+	    op->site = (int)get_varint(s) - 1;
+    }
+    return 1;
+}
+
+/*
+ * stream_reader - the reader thread: decode chunks into the ring until
+ *     the trace ends or the stream is closed
+ */
+static void *stream_reader(void *arg)
+{
+    trace_stream_t *s = arg;
+    trace_chunk_t *chunk;
+    int n, closing;
+
+    for (;;) {
+	pthread_mutex_lock(&s->lock);
+	while (s->head - s->tail == STREAM_CHUNKS && !s->closing)
+	    pthread_cond_wait(&s->drained, &s->lock);
+	closing = s->closing;
+	pthread_mutex_unlock(&s->lock);
+	if (closing)
+	    break;
+
+	/* The caller never touches ring[head] until head moves past it */
+	chunk = &s->ring[s->head % STREAM_CHUNKS];
+	for (n = 0; n < STREAM_CHUNK && decode(s, &chunk->ops[n]); n++)
+	    renumber(s, &chunk->ops[n]);
+	chunk->count = n;
+	chunk->slots = s->next_slot;
+
+	pthread_mutex_lock(&s->lock);
+	if (n > 0)
+	    s->head++;
+	if (n < STREAM_CHUNK)
+	    s->eof = 1;
+	pthread_cond_signal(&s->filled);
+	pthread_mutex_unlock(&s->lock);
+	if (n < STREAM_CHUNK)
+	    break;
+    }
+    return NULL;
+}
+
+/*
+ * trace_stream_open - open the trace file at path, in either format,
+ *     and start decoding it on a reader thread
+ */
+trace_stream_t *trace_stream_open(char *path)
+{
+    trace_stream_t *s;
+    trace_header_t header;
+    int sugg_heapsize, num_ids, num_ops, weight;
+    char msg[MAXLINE];
+
+    if ((s = calloc(1, sizeof(trace_stream_t))) == NULL)
+	unix_error("calloc failed in trace_stream_open");
+    if ((s->file = fopen(path, "r")) == NULL) {
+	sprintf(msg, "Could not open %s in trace_stream_open", path);
+	unix_error(msg);
+    }
+    snprintf(s->path, MAXLINE, "%s", path);
+
+    /* Skip the header, keeping what the decoder needs */
+    if (fread(&header, sizeof(header), 1, s->file) == 1 &&
+	memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) == 0) {
+	s->binary = 1;
+	s->has_sites = header.has_sites;
+	s->threaded = header.num_threads > 1;
+	s->left = header.num_ops;
+    }
+    else {
+	rewind(s->file);
+	if (fscanf(s->file, "%d %d %d %d", &sugg_heapsize, &num_ids,
+		   &num_ops, &weight) != 4) {
+	    printf("Bad header in tracefile %s\n", path);
+	    exit(1);
+	}
+    }
+
+    idmap_grow(s);
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->filled, NULL);
+    pthread_cond_init(&s->drained, NULL);
+    if (pthread_create(&s->reader, NULL, stream_reader, s) != 0)
+	unix_error("pthread_create failed in trace_stream_open");
+    return s;
+}
+
+/*
+ * trace_stream_next - give back the previous chunk, if any, and wait for
+ *     the next one. Returns NULL at the end of the trace. The chunk
+ *     stays valid until the next call.
+ */
+const trace_chunk_t *trace_stream_next(trace_stream_t *s)
+{
+    const trace_chunk_t *chunk = NULL;
+
+    pthread_mutex_lock(&s->lock);
+    if (s->held) {
+	s->tail++;
+	s->held = 0;
+	pthread_cond_signal(&s->drained);
+    }
+    while (s->head == s->tail && !s->eof)
+	pthread_cond_wait(&s->filled, &s->lock);
+    if (s->head != s->tail) {
+	chunk = &s->ring[s->tail % STREAM_CHUNKS];
+	s->held = 1;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return chunk;
+}
+
+/*
+ * trace_stream_close - stop the reader thread and free the stream
+ */
+void trace_stream_close(trace_stream_t *s)
+{
+    pthread_mutex_lock(&s->lock);
+    s->closing = 1;
+    pthread_cond_signal(&s->drained);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->reader, NULL);
+
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->filled);
+    pthread_cond_destroy(&s->drained);
+    fclose(s->file);
+    free(s->map);
+    free(s->free_slots);
+    free(s);
+}
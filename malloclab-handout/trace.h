@@ -0,0 +1,158 @@
+#ifndef __TRACE_H_
+#define __TRACE_H_
+
+/*
+ * trace.h - in-memory form of the trace files, shared by mdriver
+ *     and the trace tools
+ *
+ *     A trace is either a .rep text file, which read_trace parses into
+ *     an array of requests, or a binary trace, which it maps as is.
+ *     A request line of a .rep file may start with a thread id column,
+ *     giving the thread of a concurrent program that made the request;
+ *     lines without one belong to thread 0.
+ *
+ *     A binary trace is a trace_header_t followed by the packed
+ *     requests, each a varint of (index << 2 | type), then, if the trace
+ *     has several threads, a varint of the thread and, for ALLOC and
+ *     REALLOC, a varint of the size and, if the trace has sites, a
+ *     varint of site + 1. Varints are little-endian base 128, seven
+ *     bits to a byte, with the top bit set on all bytes but the last.
+ *     Either kind is walked in order with trace_start and trace_next.
+ *
+ *     Traces too long to load are replayed through a trace_stream_t
+ *     instead: a reader thread decodes the file into a ring of chunks
+ *     while the caller consumes them, and renumbers block ids into
+ *     dense slots that are reused once freed, so memory grows with the
+ *     live set rather than with the length of the trace.
+ */
+#include <stddef.h>
+
+/* Characterizes a single trace operation (allocator request) */
+typedef struct {
+    enum {ALLOC, FREE, REALLOC} type; /* type of request */
+    int index;                        /* index for free() to use later */
+    int size;                         /* byte size of alloc/realloc request */
+    int site;                         /* allocation-site tag, or NO_SITE */
+    int thread;                       /* thread that made the request */
+} traceop_t;
+
+#define NO_SITE (-1) /* the request line carried no site tag */
+
+/* Holds the information for one trace file*/
+typedef struct {
+    int sugg_heapsize;   /* suggested heap size (unused) */
+    int num_ids;         /* number of alloc/realloc ids */
+    int num_ops;         /* number of distinct requests */
+    int weight;          /* weight for this trace (unused) */
+    int has_sites;       /* did any request carry a site tag? */
+    int num_threads;     /* one more than the largest thread id */
+    traceop_t *ops;      /* array of requests, or NULL if packed */
+    const unsigned char *packed; /* encoded requests of a binary trace */
+    void *map;           /* mapping of a binary trace file... */
+    size_t map_len;      /* ... and its length */
+    char **blocks;       /* array of ptrs returned by malloc/realloc... */
+    size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+} trace_t;
+
+
+/* Leads a binary trace file; fields are in host byte order */
+typedef struct {
+    char magic[8];       /* TRACE_MAGIC */
+    int sugg_heapsize;
+    int num_ids;
+    int num_ops;
+    int weight;
+    int has_sites;
+    int num_threads;
+    unsigned packed_len; /* bytes of packed requests that follow */
+} trace_header_t;
+
+#define TRACE_MAGIC "MMTRACE1" /* 8 bytes, without the terminating nul */
+
+/* Position in a trace being replayed */
+typedef struct {
+    const trace_t *trace;
+    int next;                 /* number of the next request... */
+    const unsigned char *pos; /* ... and its encoding, if packed */
+} trace_iter_t;
+
+#define STREAM_CHUNK  16384 /* requests per chunk of a stream */
+#define STREAM_CHUNKS 8     /* chunks in a stream's ring */
+
+/* A run of requests from a stream; indexes are slots, not trace ids */
+typedef struct {
+    traceop_t ops[STREAM_CHUNK];
+    int count;           /* requests in ops */
+    int slots;           /* every index so far is below this */
+} trace_chunk_t;
+
+typedef struct trace_stream trace_stream_t;
+
+trace_t *read_trace(char *tracedir, char *filename);
+void free_trace(trace_t *trace);
+int write_trace(trace_t *trace, char *path, int binary);
+
+trace_stream_t *trace_stream_open(char *path);
+const trace_chunk_t *trace_stream_next(trace_stream_t *stream);
+void trace_stream_close(trace_stream_t *stream);
+
+/*
+ * trace_start - position it before the first request of trace
+ */
+static inline void trace_start(const trace_t *trace, trace_iter_t *it)
+{
+    it->trace = trace;
+    it->next = 0;
+    it->pos = trace->packed;
+}
+
+/*
+ * trace_varint - decode the varint at *pos and step past it
+ */
+static inline unsigned trace_varint(const unsigned char **pos)
+{
+    const unsigned char *p = *pos;
+    unsigned v = 0;
+    int shift = 0;
+
+    do {
+	v |= (unsigned)(*p & 0x7f) << shift;
+	shift += 7;
+    } while (*p++ & 0x80);
+    *pos = p;
+    return v;
+}
+
+/*
+ * trace_next - store the next request of the trace in *op and return 1,
+ *     or return 0 once every request has been seen. Packed requests
+ *     are decoded straight from the mapped file, without bounds checks:
+ *     read_trace has checked the whole of it already.
+ */
+static inline int trace_next(trace_iter_t *it, traceop_t *op)
+{
+    const trace_t *trace = it->trace;
+    unsigned word;
+
+    if (it->next == trace->num_ops)
+	return 0;
+    if (trace->packed == NULL) {
+	*op = trace->ops[it->next++];
+	return 1;
+    }
+    word = trace_varint(&it->pos);
+    op->type = word & 3;
+    op->index = word >> 2;
+    op->size = 0;
+    op->site = NO_SITE;
+    op->thread = (trace->num_threads > 1) ? (int)trace_varint(&it->pos) : 0;
+    if (op->type != FREE) {
+	op->size = trace_varint(&it->pos);
+	if (trace->has_sites)
+	    op->site = (int)trace_varint(&it->pos) - 1;
+    }
+    it->next++;
+    return 1;
+}
+
+#endif /* __TRACE_H_ */
@@ -0,0 +1,70 @@
+/*
+ * traceconv.c - Convert traces between the .rep text format and the
+ *     binary format described in trace.h
+ *
+ * Reads a trace in either format (read_trace tells them apart by the
+ * binary magic number) and writes it in the other one, or in the one
+ * chosen with -b or -t. mdriver and tracestat accept both formats, so
+ * a converted trace can be replayed without further changes; binary
+ * traces load in a fraction of the time a long .rep file takes to parse.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+int verbose = 0; /* read by read_trace */
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: traceconv [-h] [-b | -t] <in> <out>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-b  Write <out> as a binary trace.\n");
+    fprintf(stderr, "\t-h  Print this message.\n");
+    fprintf(stderr, "\t-t  Write <out> as a .rep text trace.\n");
+    fprintf(stderr, "Without -b or -t, <out> gets the format <in> lacks.\n");
+}
+
+int main(int argc, char **argv)
+{
+    trace_t *trace;
+    int binary = -1; /* not chosen yet */
+    int c;
+
+    while ((c = getopt(argc, argv, "hbt")) != EOF) {
+	switch (c) {
+	case 'b':
+	    binary = 1;
+	    break;
+	case 't':
+	    binary = 0;
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (argc - optind != 2) {
+	usage();
+	exit(1);
+    }
+
+    trace = read_trace("", argv[optind]);
+    if (binary < 0)
+	binary = (trace->packed == NULL);
+    if (write_trace(trace, argv[optind + 1], binary) < 0) {
+	perror("traceconv: write");
+	exit(1);
+    }
+    printf("%s: %d requests written as %s\n", argv[optind + 1],
+	   trace->num_ops, binary ? "binary" : "text");
+    free_trace(trace);
+    exit(0);
+}
@@ -0,0 +1,48 @@
+#!/usr/bin/perl
+#!/usr/local/bin/perl
+
+# A long-running cache: each phase fills the heap with blocks larger
+# than the last phase's, then evicts most of them. The survivors pin
+# the old holes, which are too small for the next phase's blocks.
+
+$out_filename = "fragment.rep";
+$num_phases = 6;
+$blks_per_phase = 1500;
+$min_size = 16;
+$keep_every = 10;
+
+srand(213);
+
+# Open output file
+open OUTFILE, ">$out_filename" or die "Cannot create $out_filename\n";
+
+@ops = ();
+$id = 0;
+$heap = 0;
+for ($p = 0; $p < $num_phases; $p += 1) {
+    $size = $min_size << $p;
+    @ids = ();
+    for ($i = 0; $i < $blks_per_phase; $i += 1) {
+	$bytes = $size + int(rand($size));
+	push @ops, "a $id $bytes";
+	push @ids, $id;
+	$heap += $bytes;
+	$id += 1;
+    }
+    for ($i = 0; $i < $blks_per_phase; $i += 1) {
+	if ($i % $keep_every != 0) {
+	    push @ops, "f $ids[$i]";
+	}
+    }
+}
+
+$num_ops = scalar(@ops);
+print OUTFILE "$heap\n";
+print OUTFILE "$id\n";
+print OUTFILE "$num_ops\n";
+print OUTFILE "1\n";
+foreach $op (@ops) {
+    print OUTFILE "$op\n";
+}
+
+close OUTFILE;
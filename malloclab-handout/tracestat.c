@@ -0,0 +1,398 @@
+/*
+ * tracestat.c - Profile .rep traces and derive mm.c's size classes
+ *
+ * Reads one or more traces with read_trace and reports the request
+ * size histogram, the live-bytes curve, object lifetimes per size and
+ * realloc growth. With -o it also writes a header holding the
+ * segregated free-list classes that fit those traces best, which mm.c
+ * compiles in. "make sizeclasses" reruns it on the trace directory.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "trace.h"
+
+/* Report and class-table tuning */
+#define NBUCKETS     32   /* power-of-two size buckets */
+#define CURVE_POINTS 16   /* samples of the live-bytes curve per trace */
+#define TOP_SIZES    10   /* most frequent block sizes to list */
+#define HOT_SHARE    0.02 /* share of requests that earns an exact class */
+#define MAX_CLASSES  64   /* upper bound for -n */
+#define LOOKUP_MAX   4096 /* largest block size in the lookup array */
+#define MIN_BLOCK    16   /* smallest block mm.c hands out */
+
+int verbose = 0; /* read by read_trace */
+
+/* One row per distinct block size */
+typedef struct {
+    unsigned size;      /* block size in bytes, as mm.c rounds it */
+    double count;       /* requests that asked for this block size */
+} sizecount_t;
+
+/* Everything accumulated across the traces */
+typedef struct {
+    double bucket_count[NBUCKETS];    /* requests per power-of-two bucket */
+    double bucket_life[NBUCKETS];     /* summed lifetimes (in ops) */
+    double bucket_objs[NBUCKETS];     /* objects whose lifetime was summed */
+    double requests;                  /* malloc and realloc requests */
+    double growth[6];                 /* realloc new/old ratio buckets */
+    double growth_bytes;              /* summed new-old of growing reallocs */
+    sizecount_t *sizes;               /* histogram by block size */
+    int nsizes;
+    int maxsizes;
+} stats_t;
+
+static const char *growth_names[6] = {
+    "shrink", "same", "<1.25x", "<1.5x", "<2x", ">=2x"
+};
+
+/*
+ * block_size - the block mm_malloc carves out for a request, matching
+ *     its header/footer overhead and double-word alignment
+ */
+static unsigned block_size(unsigned size)
+{
+    if (size <= 8)
+	return MIN_BLOCK;
+    return 8 * ((size + 8 + 7) / 8);
+}
+
+/*
+ * bucket - index of the power-of-two bucket holding size
+ */
+static int bucket(unsigned size)
+{
+    int b = 0;
+
+    while (b < NBUCKETS - 1 && (1u << b) < size)
+	b++;
+    return b;
+}
+
+/*
+ * count_size - add one request for a block of the given size
+ */
+static void count_size(stats_t *st, unsigned size)
+{
+    int i;
+
+    for (i = 0; i < st->nsizes; i++)
+	if (st->sizes[i].size == size) {
+	    st->sizes[i].count++;
+	    return;
+	}
+    if (st->nsizes == st->maxsizes) {
+	st->maxsizes = st->maxsizes ? 2 * st->maxsizes : 256;
+	st->sizes = realloc(st->sizes, st->maxsizes * sizeof(sizecount_t));
+	if (st->sizes == NULL) {
+	    fprintf(stderr, "tracestat: out of memory\n");
+	    exit(1);
+	}
+    }
+    st->sizes[st->nsizes].size = size;
+    st->sizes[st->nsizes].count = 1;
+    st->nsizes++;
+}
+
+/*
+ * profile - replay one trace symbolically, accumulating into st and
+ *     printing its live-bytes curve
+ */
+static void profile(stats_t *st, trace_t *trace, char *name)
+{
+    trace_iter_t it;
+    traceop_t op;
+    int *born = calloc(trace->num_ids, sizeof(int));
+    int i, index, size, b;
+    double live = 0, peak = 0, ratio;
+    double curve[CURVE_POINTS];
+    int next_point = 0;
+
+    if (born == NULL) {
+	fprintf(stderr, "tracestat: out of memory\n");
+	exit(1);
+    }
+    for (i = 0; i < trace->num_ids; i++)
+	trace->block_sizes[i] = 0;
+
+    for (trace_start(trace, &it), i = 0; trace_next(&it, &op); i++) {
+	index = op.index;
+	size = op.size;
+
+	switch (op.type) {
+	case ALLOC:
+	    st->bucket_count[bucket(size)]++;
+	    st->requests++;
+	    count_size(st, block_size(size));
+	    born[index] = i;
+	    trace->block_sizes[index] = size;
+	    live += size;
+	    break;
+
+	case REALLOC:
+	    st->bucket_count[bucket(size)]++;
+	    st->requests++;
+	    count_size(st, block_size(size));
+	    ratio = (double)size / trace->block_sizes[index];
+	    st->growth[ratio < 1 ? 0 : ratio == 1 ? 1 : ratio < 1.25 ? 2 :
+		       ratio < 1.5 ? 3 : ratio < 2 ? 4 : 5]++;
+	    if (ratio > 1)
+		st->growth_bytes += size - trace->block_sizes[index];
+	    live += size - (double)trace->block_sizes[index];
+	    trace->block_sizes[index] = size;
+	    break;
+
+	case FREE:
+	    b = bucket(trace->block_sizes[index]);
+	    st->bucket_life[b] += i - born[index];
+	    st->bucket_objs[b]++;
+	    live -= trace->block_sizes[index];
+	    trace->block_sizes[index] = 0;
+	    break;
+	}
+
+	peak = (live > peak) ? live : peak;
+	while (next_point < CURVE_POINTS &&
+	       i + 1 >= (long)trace->num_ops * (next_point + 1) / CURVE_POINTS)
+	    curve[next_point++] = live;
+    }
+
+    /* objects never freed live until the end of the trace */
+    for (i = 0; i < trace->num_ids; i++)
+	if (trace->block_sizes[i] > 0) {
+	    b = bucket(trace->block_sizes[i]);
+	    st->bucket_life[b] += trace->num_ops - born[i];
+	    st->bucket_objs[b]++;
+	}
+
+    printf("%-20s %8d %8.0f ", name, trace->num_ops, peak / 1024);
+    for (i = 0; i < next_point; i++)
+	printf(" %3.0f", peak > 0 ? 100 * curve[i] / peak : 0.0);
+    printf("\n");
+    free(born);
+}
+
+/*
+ * by_count - qsort order: most requested block sizes first
+ */
+static int by_count(const void *a, const void *b)
+{
+    double d = ((sizecount_t *)b)->count - ((sizecount_t *)a)->count;
+    return (d > 0) - (d < 0);
+}
+
+/*
+ * by_value - qsort order for class bounds
+ */
+static int by_value(const void *a, const void *b)
+{
+    unsigned x = *(unsigned *)a, y = *(unsigned *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * report - print the histograms gathered from all traces
+ */
+static void report(stats_t *st)
+{
+    double reallocs = 0, cum = 0;
+    int b, i;
+
+    printf("\nRequest sizes\n%12s %10s %7s %7s %12s\n",
+	   "bytes", "requests", "share", "cum", "lifetime");
+    for (b = 0; b < NBUCKETS; b++) {
+	if (st->bucket_count[b] == 0 && st->bucket_objs[b] == 0)
+	    continue;
+	cum += st->bucket_count[b];
+	printf("%5u-%-6u %10.0f %6.1f%% %6.1f%% %12.0f\n",
+	       b ? (1u << (b - 1)) + 1 : 1, 1u << b, st->bucket_count[b],
+	       100 * st->bucket_count[b] / st->requests,
+	       100 * cum / st->requests,
+	       st->bucket_objs[b] ? st->bucket_life[b] / st->bucket_objs[b] : 0);
+    }
+
+    qsort(st->sizes, st->nsizes, sizeof(sizecount_t), by_count);
+    printf("\nMost requested block sizes\n");
+    for (i = 0; i < st->nsizes && i < TOP_SIZES; i++)
+	printf("%8u bytes %10.0f %6.1f%%\n", st->sizes[i].size,
+	       st->sizes[i].count, 100 * st->sizes[i].count / st->requests);
+
+    for (i = 0; i < 6; i++)
+	reallocs += st->growth[i];
+    if (reallocs > 0) {
+	printf("\nRealloc growth (new/old size)\n");
+	for (i = 0; i < 6; i++)
+	    printf("%8s %10.0f %6.1f%%\n", growth_names[i], st->growth[i],
+		   100 * st->growth[i] / reallocs);
+	if (reallocs - st->growth[0] - st->growth[1] > 0)
+	    printf("mean growth %.0f bytes\n", st->growth_bytes /
+		   (reallocs - st->growth[0] - st->growth[1]));
+    }
+}
+
+/*
+ * add_bound - add a class bound unless it is already there
+ */
+static int add_bound(unsigned *bounds, int n, unsigned bound)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+	if (bounds[i] == bound)
+	    return n;
+    bounds[n] = bound;
+    return n + 1;
+}
+
+/*
+ * make_classes - choose nclasses free-list bounds. Half the classes
+ *     are powers of two up to the largest block requested. The rest go
+ *     to block sizes that make up at least HOT_SHARE of the requests,
+ *     most requested first, each of which gets an exact class of its
+ *     own. The last class is unbounded. Returns the number of classes.
+ */
+static int make_classes(stats_t *st, unsigned *bounds, int nclasses)
+{
+    unsigned largest = 0, pow, size;
+    int n = 0, i;
+
+    for (i = 0; i < st->nsizes; i++)
+	largest = (st->sizes[i].size > largest) ? st->sizes[i].size : largest;
+    for (pow = 2 * MIN_BLOCK; n < nclasses / 2 && pow != 0 && pow < largest;
+	 pow <<= 1)
+	n = add_bound(bounds, n, pow);
+
+    /* st->sizes is already sorted by descending request count */
+    for (i = 0; i < st->nsizes && n + 2 < nclasses; i++) {
+	size = st->sizes[i].size;
+	if (st->sizes[i].count < HOT_SHARE * st->requests)
+	    break;
+	n = add_bound(bounds, n, size);
+	if (size > MIN_BLOCK)
+	    n = add_bound(bounds, n, size - 8);
+    }
+
+    qsort(bounds, n, sizeof(unsigned), by_value);
+    bounds[n++] = 0xffffffffu; /* unbounded last class */
+    return n;
+}
+
+/*
+ * write_header - emit the class table and size-to-class lookup array
+ */
+static void write_header(char *path, unsigned *bounds, int n,
+			 int ntraces, char **names)
+{
+    FILE *fp = fopen(path, "w");
+    int i, c;
+    unsigned size;
+
+    if (fp == NULL) {
+	perror(path);
+	exit(1);
+    }
+
+    fprintf(fp, "#ifndef __SIZECLASSES_H_\n#define __SIZECLASSES_H_\n\n");
+    fprintf(fp, "/*\n * sizeclasses.h - segregated free-list classes for mm.c\n"
+	    " *\n * Generated by tracestat from:\n");
+    for (i = 0; i < ntraces; i++)
+	fprintf(fp, " *   %s\n", names[i]);
+    fprintf(fp, " *\n * Do not edit; run \"make sizeclasses\" to regenerate.\n"
+	    " */\n\n");
+
+    fprintf(fp, "#define SIZE_CLASSES %d\n", n);
+    fprintf(fp, "#define SIZE_CLASS_LOOKUP_MAX %d "
+	    "/* largest block size in size_class_lookup */\n\n", LOOKUP_MAX);
+
+    fprintf(fp, "/* Largest block size on each free list; the last is "
+	    "unbounded */\n");
+    fprintf(fp, "static const unsigned int size_class_max[SIZE_CLASSES] = {");
+    for (i = 0; i < n; i++)
+	fprintf(fp, "%s%s%uu", i ? "," : "", (i % 6) ? " " : "\n    ",
+		bounds[i]);
+    fprintf(fp, "\n};\n\n");
+
+    fprintf(fp, "/* Free list for each block size up to "
+	    "SIZE_CLASS_LOOKUP_MAX, indexed by size/8 */\n");
+    fprintf(fp, "static const unsigned char "
+	    "size_class_lookup[SIZE_CLASS_LOOKUP_MAX/8 + 1] = {");
+    for (size = 0, c = 0; size <= LOOKUP_MAX; size += 8) {
+	while (bounds[c] < size)
+	    c++;
+	fprintf(fp, "%s%s%d", size ? "," : "", (size % 128) ? " " : "\n    ",
+		c);
+    }
+    fprintf(fp, "\n};\n\n#endif /* __SIZECLASSES_H_ */\n");
+    fclose(fp);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: tracestat [-h] [-n <classes>] [-o <header>] "
+	    "<trace>...\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h           Print this message.\n");
+    fprintf(stderr, "\t-n <classes> Number of size classes (default 24).\n");
+    fprintf(stderr, "\t-o <header>  Write the size-class table to <header>.\n");
+}
+
+int main(int argc, char **argv)
+{
+    stats_t st;
+    trace_t *trace;
+    char *header = NULL;
+    unsigned bounds[MAX_CLASSES];
+    int nclasses = 24;
+    int c, i, n;
+
+    while ((c = getopt(argc, argv, "hn:o:")) != EOF) {
+	switch (c) {
+	case 'n':
+	    nclasses = atoi(optarg);
+	    if (nclasses < 2 || nclasses > MAX_CLASSES) {
+		fprintf(stderr, "tracestat: -n must be 2..%d\n", MAX_CLASSES);
+		exit(1);
+	    }
+	    break;
+	case 'o':
+	    header = optarg;
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (optind == argc) {
+	usage();
+	exit(1);
+    }
+
+    memset(&st, 0, sizeof(st));
+    printf("%-20s %8s %8s  live bytes over the trace, %% of peak\n",
+	   "trace", "ops", "peak KB");
+    for (i = optind; i < argc; i++) {
+	char *name = strrchr(argv[i], '/');
+	trace = read_trace("", argv[i]);
+	profile(&st, trace, name ? name + 1 : argv[i]);
+	free_trace(trace);
+    }
+    report(&st);
+
+    if (header != NULL) {
+	n = make_classes(&st, bounds, nclasses);
+	printf("\nSize classes (largest block size per class)\n");
+	for (i = 0; i < n - 1; i++)
+	    printf(" %u", bounds[i]);
+	printf(" inf\n");
+	write_header(header, bounds, n, argc - optind, argv + optind);
+    }
+    exit(0);
+}